@@ -54,8 +54,7 @@ get_bfu_color(struct terminal *term, unsigned char *stylename)
 		 * aren't mixed. */
 		foreach_hash_item (item, *bfu_colors, i) {
 			mem_free_if(item->value);
-			item = item->prev;
-			del_hash_item(bfu_colors, item->next);
+			del_hash_item(bfu_colors, item);
 		}
 
 		last_color_mode = color_mode;
@@ -5,12 +5,20 @@
 #endif
 
 #include <string.h>
+#include <sys/types.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
 
 #include "elinks.h"
 
 #include "bfu/dialog.h"
 #include "cache/cache.h"
 #include "cache/dialogs.h"
+#include "cache/disk.h"
 #include "config/options.h"
 #include "main/main.h"
 #include "main/object.h"
@@ -22,6 +30,7 @@
 # include "scripting/smjs/smjs.h"
 #endif
 #include "util/error.h"
+#include "util/math.h"
 #include "util/memory.h"
 #include "util/string.h"
 #include "util/time.h"
@@ -32,6 +41,27 @@ static INIT_LIST_OF(struct cache_entry, cache_entries);
 static unsigned longlong cache_size;
 static int id_counter = 1;
 
+/* The @cache_entries list only keeps the LRU order. Lookups go through
+ * a hash index of the entries instead, one for cache_entry.uri and one
+ * for cache_entry.proxy_uri. Entries with the same key are kept in
+ * the same relative order as in @cache_entries so the most recently
+ * used one is found first, just like when walking the list. */
+enum cache_index_type {
+	CACHE_INDEX_URI,
+	CACHE_INDEX_PROXY_URI,
+	CACHE_INDEXES,
+};
+
+struct cache_index {
+	struct cache_entry **buckets;
+	unsigned int width;	/* The index has 1 << width buckets. */
+};
+
+static struct cache_index cache_index[CACHE_INDEXES];
+static int cache_entries_count;
+
+#define CACHE_INDEX_MIN_WIDTH 8
+
 static void truncate_entry(struct cache_entry *cached, off_t offset, int final);
 
 /* Change 0 to 1 to enable cache debugging features (redirect stderr to a file). */
@@ -73,7 +103,7 @@ get_cache_size(void)
 int
 get_cache_entry_count(void)
 {
-	return list_size(&cache_entries);
+	return cache_entries_count;
 }
 
 int
@@ -100,23 +130,142 @@ get_cache_entry_loading_count(void)
 	return i;
 }
 
+
+#define hash_bytes(h, p, len) \
+do { \
+	const unsigned char *p_ = (p); \
+	int len_ = (len); \
+ \
+	while (len_-- > 0) (h) = ((h) << 5) - (h) + *p_++; \
+} while (0)
+
+/* Hash the URI components compared by compare_uri() for URI_BASE, so
+ * URIs equal in that sense always end up in the same bucket. */
+static unsigned int
+hash_cache_uri(struct uri *uri)
+{
+	unsigned int h = uri->protocol;
+
+	hash_bytes(h, uri->host, uri->hostlen);
+	hash_bytes(h, uri->port, uri->portlen);
+	hash_bytes(h, uri->data, uri->datalen);
+	if (uri->post) hash_bytes(h, uri->post, strlen(uri->post));
+
+	/* Let the high bits also have their say in the bucket choice. */
+	return h ^ (h >> 16);
+}
+
+#undef hash_bytes
+
+static inline struct uri *
+get_cache_index_uri(struct cache_entry *cached, enum cache_index_type type)
+{
+	return type == CACHE_INDEX_URI ? cached->uri : cached->proxy_uri;
+}
+
+static inline struct cache_entry **
+get_cache_index_bucket(enum cache_index_type type, struct uri *uri)
+{
+	struct cache_index *index = &cache_index[type];
+
+	return &index->buckets[hash_cache_uri(uri)
+			       & ((1 << index->width) - 1)];
+}
+
+static void
+add_to_cache_index(struct cache_entry *cached, enum cache_index_type type)
+{
+	struct cache_entry **bucket;
+
+	bucket = get_cache_index_bucket(type, get_cache_index_uri(cached, type));
+	cached->index_next[type] = *bucket;
+	*bucket = cached;
+}
+
+static void
+del_from_cache_index(struct cache_entry *cached, enum cache_index_type type)
+{
+	struct cache_entry **pos;
+
+	pos = get_cache_index_bucket(type, get_cache_index_uri(cached, type));
+	for (; *pos; pos = &(*pos)->index_next[type]) {
+		if (*pos != cached) continue;
+
+		*pos = cached->index_next[type];
+		cached->index_next[type] = NULL;
+		return;
+	}
+
+	INTERNAL("cache entry %s missing from the cache index",
+		 struri(cached->uri));
+}
+
+/* Make sure the indexes have at least as many buckets as there are cache
+ * entries. If memory is short an index keeps its old buckets and only the
+ * chains get longer. Returns zero if there is no index at all. */
+static int
+grow_cache_index(int entries)
+{
+	struct cache_entry *cached;
+	int type;
+
+	for (type = 0; type < CACHE_INDEXES; type++) {
+		struct cache_index *index = &cache_index[type];
+		unsigned int width = CACHE_INDEX_MIN_WIDTH;
+		struct cache_entry **buckets;
+
+		if (index->buckets && entries <= (1 << index->width))
+			continue;
+
+		while (entries > (1 << width)) width++;
+
+		buckets = mem_calloc(1 << width, sizeof(*buckets));
+		if (!buckets) {
+			if (index->buckets) continue;
+			return 0;
+		}
+
+		mem_free_if(index->buckets);
+		index->buckets = buckets;
+		index->width = width;
+
+		/* Rehash from the least recently used entry so that the
+		 * chains end up in the LRU order again. */
+		foreachback (cached, cache_entries)
+			add_to_cache_index(cached, type);
+	}
+
+	return 1;
+}
+
 struct cache_entry *
 find_in_cache(struct uri *uri)
 {
-	struct cache_entry *cached;
-	int proxy = (uri->protocol == PROTOCOL_PROXY);
+	struct cache_entry *cached, **pos;
+	enum cache_index_type type = (uri->protocol == PROTOCOL_PROXY)
+				   ? CACHE_INDEX_PROXY_URI : CACHE_INDEX_URI;
 
-	foreach (cached, cache_entries) {
-		struct uri *c_uri;
+	if (!cache_index[type].buckets) return NULL;
 
+	pos = get_cache_index_bucket(type, uri);
+	for (; (cached = *pos); pos = &cached->index_next[type]) {
 		if (!cached->valid) continue;
 
-		c_uri = proxy ? cached->proxy_uri : cached->uri;
-		if (!compare_uri(c_uri, uri, URI_BASE))
+		if (!compare_uri(get_cache_index_uri(cached, type), uri, URI_BASE))
 			continue;
 
 		move_to_top_of_list(cache_entries, cached);
 
+		/* Keep the chain in the LRU order too. */
+		*pos = cached->index_next[type];
+		add_to_cache_index(cached, type);
+
+		/* The entry is at the top of the list so it must also
+		 * be the first one with its key in the other index. */
+		type = !type;
+		del_from_cache_index(cached, type);
+		add_to_cache_index(cached, type);
+
 		return cached;
 	}
 
@@ -156,9 +305,19 @@ get_cache_entry(struct uri *uri)
 	cached->cache_id = id_counter++;
 	object_nolock(cached, "cache_entry"); /* Debugging purpose. */
 
+	if (!grow_cache_index(cache_entries_count + 1)) {
+		done_uri(cached->proxy_uri);
+		done_uri(cached->uri);
+		mem_free(cached);
+		return NULL;
+	}
+
 	cached->box_item = add_listbox_leaf(&cache_browser, NULL, cached);
 
 	add_to_list(cache_entries, cached);
+	add_to_cache_index(cached, CACHE_INDEX_URI);
+	add_to_cache_index(cached, CACHE_INDEX_PROXY_URI);
+	cache_entries_count++;
 
 	return cached;
 }
@@ -184,6 +343,7 @@ get_validated_cache_entry(struct uri *uri, enum cache_mode cache_mode)
 
 	/* We only consider complete entries */
 	cached = find_in_cache(uri);
+	if (!cached) cached = load_disk_cache_entry(uri);
 	if (!cached || cached->incomplete)
 		return NULL;
 
@@ -295,28 +455,82 @@ enlarge_entry(struct cache_entry *cached, off_t size)
  * we need to stuff the rendered documents in too, because they seem to amount
  * the major memory bursts. */
 
+/* Whether a fragment of @size bytes can be allocated at all.  The lengths
+ * are off_t, which may be bigger than size_t. */
+static inline int
+frag_fits(off_t size)
+{
+	size_t real_size = size;
+
+	return size > 0 && (off_t) real_size == size
+	       && FRAGSIZE(real_size) > real_size;
+}
+
 static struct fragment *
 frag_alloc(size_t size)
 {
 	struct fragment *f = mem_mmap_alloc(FRAGSIZE(size));
 
 	if (!f) return NULL;
-	memset(f, 0, FRAGSIZE(size));
+	/* Leave the data alone, so that the pages reserved for data still
+	 * to come are not touched. */
+	memset(f, 0, FRAGMENT_HEADER_SIZE);
 	return f;
 }
 
+static void
+frag_free(struct fragment *f)
+{
+#ifdef HAVE_MMAP
+	if (f->mapped) {
+		munmap(f, FRAGSIZE(f->real_length));
+		return;
+	}
+#endif
+	mem_mmap_free(f, FRAGSIZE(f->real_length));
+}
+
 static struct fragment *
 frag_realloc(struct fragment *f, size_t size)
 {
-	return mem_mmap_realloc(f, FRAGSIZE(f->real_length), FRAGSIZE(size));
+	struct fragment *nf;
+
+	if (!f->mapped)
+		return mem_mmap_realloc(f, FRAGSIZE(f->real_length), FRAGSIZE(size));
+
+	/* The mapping cannot grow past the end of the file so move the
+	 * fragment to anonymous memory first. */
+	nf = frag_alloc(size);
+	if (!nf) return NULL;
+
+	memcpy(nf, f, FRAGSIZE(MIN(f->length, size)));
+	nf->mapped = 0;
+	frag_free(f);
+
+	return nf;
 }
 
-static void
-frag_free(struct fragment *f)
+
+/* Make room for @size bytes in @f.  Some more is reserved for the data likely
+ * to follow, so that a document arriving in many small pieces does not end up
+ * in as many fragments which get_cache_fragment() would have to copy. */
+static struct fragment *
+frag_grow(struct fragment *f, off_t size)
 {
-	mem_mmap_free(f, FRAGSIZE(f->real_length));
-}
+	off_t real_length = CACHE_PAD(MAX(size, 2 * f->real_length));
+	struct fragment *nf;
 
+	if (!frag_fits(real_length)) return NULL;
+
+	nf = frag_realloc(f, real_length);
+	if (!nf) return NULL;
+
+	nf->prev->next = nf;
+	nf->next->prev = nf;
+	nf->real_length = real_length;
+
+	return nf;
+}
 
 /* Concatenate overlapping fragments. */
 static void
@@ -378,7 +592,7 @@ add_fragment(struct cache_entry *cached, off_t offset,
 {
 	struct fragment *f, *nf;
 	int trunc = 0;
-	off_t end_offset;
+	off_t end_offset, real_length;
 
 	if (!length) return 0;
 
@@ -402,6 +616,12 @@ add_fragment(struct cache_entry *cached, off_t offset,
 		if (end_offset > f_end_offset) {
 			/* Overlap - we end further than original fragment. */
 
+			if (end_offset - f->offset > f->real_length) {
+				/* Try to make the fragment big enough. */
+				nf = frag_grow(f, end_offset - f->offset);
+				if (nf) f = nf;
+			}
+
 			if (end_offset - f->offset <= f->real_length) {
 				/* We fit here, so let's enlarge it by delta of
 				 * old and new end.. */
@@ -445,13 +665,29 @@ add_fragment(struct cache_entry *cached, off_t offset,
 		return ret;
 	}
 
-	/* Make up new fragment. */
-	nf = frag_alloc(CACHE_PAD(length));
+	/* Make up new fragment.  If it is the first one and the server said how
+	 * big the whole thing is going to be, make room for all of it, but not
+	 * for more than the whole memory cache would hold, since the server
+	 * may be lying. */
+	nf = NULL;
+	if (!offset && cached->size_hint > length) {
+		off_t size_hint = MIN(cached->size_hint,
+				      get_opt_long("document.cache.memory.size",
+						   NULL));
+
+		real_length = CACHE_PAD(size_hint);
+		if (size_hint > length && frag_fits(real_length))
+			nf = frag_alloc(real_length);
+	}
+	if (!nf) {
+		real_length = CACHE_PAD(length);
+		nf = frag_alloc(real_length);
+	}
 	if (!nf) return -1;
 
 	nf->offset = offset;
 	nf->length = length;
-	nf->real_length = CACHE_PAD(length);
+	nf->real_length = real_length;
 	memcpy(nf->data, data, length);
 	add_at_pos(f->prev, nf);
 
@@ -465,6 +701,63 @@ add_fragment(struct cache_entry *cached, off_t offset,
 	return 1;
 }
 
+int
+add_mapped_fragment(struct cache_entry *cached, int fd, off_t offset,
+		    off_t length)
+{
+	struct fragment *f = NULL;
+
+	assert(list_empty(cached->frag) && length > 0);
+	if_assert_failed return -1;
+
+#ifdef HAVE_MMAP
+	/* The file offset has to be at a page boundary.  It may not be if
+	 * the file was written on a system with smaller pages. */
+	if (get_page_size() && !(offset % get_page_size())) {
+		f = mmap(NULL, FRAGSIZE(length), PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE, fd, offset);
+		if (f == MAP_FAILED) return -1;
+
+		/* Only the page with the header gets copied on write. */
+		memset(f, 0, FRAGMENT_HEADER_SIZE);
+		f->mapped = 1;
+	}
+#endif
+
+	if (!f) {
+		off_t done = 0;
+
+		f = frag_alloc(length);
+		if (!f) return -1;
+
+		if (lseek(fd, offset + FRAGMENT_HEADER_SIZE, SEEK_SET) < 0)
+			length = 0;
+
+		while (done < length) {
+			ssize_t n = read(fd, f->data + done, length - done);
+
+			if (n <= 0) break;
+			done += n;
+		}
+
+		if (done < length) {
+			frag_free(f);
+			return -1;
+		}
+	}
+
+	f->offset = 0;
+	f->length = length;
+	f->real_length = length;
+	add_to_list(cached->frag, f);
+
+	enlarge_entry(cached, length);
+	cached->length = length;
+	cached->cache_id = id_counter++;
+
+	return 0;
+}
+
 /* Try to defragment the cache entry. Defragmentation will not be possible
  * if there is a gap in the fragments; if we have bytes 1-100 in one fragment
  * and bytes 201-300 in the second, we must leave those two fragments separate
@@ -550,6 +843,25 @@ get_cache_fragment(struct cache_entry *cached)
 	return new_frag;
 }
 
+struct fragment *
+get_next_cache_fragment(struct cache_entry *cached, struct fragment *fragment)
+{
+	struct fragment *next;
+
+	if (!fragment) {
+		if (list_empty(cached->frag)) return NULL;
+
+		next = cached->frag.next;
+		return next->offset ? NULL : next;
+	}
+
+	if (!list_has_next(cached->frag, fragment)) return NULL;
+
+	next = fragment->next;
+	return next->offset == fragment->offset + fragment->length
+	       ? next : NULL;
+}
+
 static void
 delete_fragment(struct cache_entry *cached, struct fragment *f)
 {
@@ -644,6 +956,7 @@ delete_entry_content(struct cache_entry *cached)
 	}
 	cached->cache_id = id_counter++;
 	cached->length = 0;
+	cached->size_hint = 0;
 	cached->incomplete = 1;
 
 	mem_free_set(&cached->last_modified, NULL);
@@ -681,6 +994,9 @@ void
 delete_cache_entry(struct cache_entry *cached)
 {
 	del_from_list(cached);
+	del_from_cache_index(cached, CACHE_INDEX_URI);
+	del_from_cache_index(cached, CACHE_INDEX_PROXY_URI);
+	cache_entries_count--;
 
 	done_cache_entry(cached);
 }
@@ -912,8 +1228,24 @@ shrinked_enough:
 
 	for (; (void *) cached != &cache_entries; ) {
 		cached = cached->next;
-		if (cached->prev->gc_target)
+		if (cached->prev->gc_target) {
+			/* Give it a second chance on the disk, unless the
+			 * whole cache is flushed on purpose, for example to
+			 * forget the pages loaded with credentials. */
+			if (!whole) save_disk_cache_entry(cached->prev);
 			delete_cache_entry(cached->prev);
+		}
+	}
+
+	if (whole) done_disk_cache();
+
+	if (list_empty(cache_entries)) {
+		int type;
+
+		for (type = 0; type < CACHE_INDEXES; type++) {
+			mem_free_set(&cache_index[type].buckets, NULL);
+			cache_index[type].width = 0;
+		}
 	}
 
 
@@ -926,3 +1258,12 @@ shrinked_enough:
 	}
 #endif
 }
+
+void
+save_cache_to_disk(void)
+{
+	struct cache_entry *cached;
+
+	foreach (cached, cache_entries)
+		save_disk_cache_entry(cached);
+}
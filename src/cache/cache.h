@@ -33,6 +33,9 @@ struct cache_entry {
 
 	struct uri *uri;		/* Identifier for the cached data */
 	struct uri *proxy_uri;		/* Proxy identifier or same as @uri */
+
+	/* Chains of the cache index buckets for @uri and @proxy_uri. */
+	struct cache_entry *index_next[2];
 	struct uri *redirect;		/* Location we were redirected to */
 
 	unsigned char *head;		/* The protocol header */
@@ -43,11 +46,13 @@ struct cache_entry {
 	unsigned char *encoding_info;	/* Encoding used during transfer */
 
 	unsigned int cache_id;		/* Change each time entry is modified. */
+	unsigned int disk_cache_id;	/* The @cache_id stored on disk. */
 
 	time_t seconds;			/* Access time. Used by 'If-Modified-Since' */
 
 	off_t length;			/* The expected and complete size */
 	off_t data_size;		/* The actual size of all fragments */
+	off_t size_hint;		/* The size announced by the server */
 
 	struct listbox_item *box_item;	/* Dialog data for cache manager */
 #ifdef CONFIG_SCRIPTING_SPIDERMONKEY
@@ -67,6 +72,7 @@ struct cache_entry {
 	 * an entry with this set to 1 in wild nature ;-). */
 	unsigned int gc_target:1;	/* The GC touch of death */
 	unsigned int cgi:1;		/* Is a CGI output? */
+	unsigned int no_store:1;	/* Must not be kept on disk */
 
 	enum cache_mode cache_mode;	/* Reload condition */
 };
@@ -77,9 +83,14 @@ struct fragment {
 	off_t offset;
 	off_t length;
 	off_t real_length;
+	unsigned int mapped:1; /* Mapped from a disk cache file */
 	unsigned char data[1]; /* Must be last */
 };
 
+/* The room a disk cache file has to reserve in front of a body for it to be
+ * mapped by add_mapped_fragment(). */
+#define FRAGMENT_HEADER_SIZE (offsetof(struct fragment, data))
+
 
 /* Searches the cache for an entry matching the URI. Returns NULL if no one
  * matches. */
@@ -112,11 +123,32 @@ struct cache_entry *get_redirected_cache_entry(struct uri *uri);
 int add_fragment(struct cache_entry *cached, off_t offset,
 		 const unsigned char *data, ssize_t length);
 
+/* Make the @length bytes of @fd at @offset + FRAGMENT_HEADER_SIZE the
+ * content of the empty @cached object. The data is mapped instead of copied
+ * if possible, so @offset has to be aligned to the page size. Returns -1
+ * upon error. */
+int add_mapped_fragment(struct cache_entry *cached, int fd, off_t offset,
+			off_t length);
+
 /* Defragments the cache entry and returns the resulting fragment containing the
  * complete source of all currently downloaded fragments. Returns NULL if
  * validation of the fragments fails. */
 struct fragment *get_cache_fragment(struct cache_entry *cached);
 
+/* Returns the fragment holding the data right after @fragment, or the first
+ * fragment if @fragment is NULL. Returns NULL at the first gap and at the end.
+ * Unlike get_cache_fragment() this never copies any data, so it is the way
+ * to go for users which do not need the data in one piece. */
+struct fragment *get_next_cache_fragment(struct cache_entry *cached,
+					 struct fragment *fragment);
+
+/* Iterates over the fragments with the data from the start of @cached up to
+ * the first gap. */
+#define foreach_cache_fragment(fragment, cached) \
+	for ((fragment) = get_next_cache_fragment(cached, NULL); \
+	     (fragment); \
+	     (fragment) = get_next_cache_fragment(cached, fragment))
+
 /* Should be called when creation of a new cache has been completed. Most
  * importantly, it will updates cached->incomplete. */
 void normalize_cache_entry(struct cache_entry *cached, off_t length);
@@ -142,6 +174,11 @@ redirect_cache(struct cache_entry *cached, unsigned char *location,
  * being one, remove all unused cache entries. */
 void garbage_collection(int whole);
 
+/* Store the cache entries worth keeping in the disk cache. This is done at
+ * exit, since garbage_collection() only saves the entries it drops when
+ * the cache grows too big. */
+void save_cache_to_disk(void);
+
 /* Used by the resource and memory info dialogs for getting information about
  * the cache. */
 unsigned longlong get_cache_size(void);
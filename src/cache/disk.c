@@ -0,0 +1,736 @@
+/* Disk cache */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h> /* OS/2 needs this after sys/types.h */
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_UTIME_H
+#include <utime.h>
+#endif
+
+#include "elinks.h"
+
+#include "cache/cache.h"
+#include "cache/disk.h"
+#include "config/home.h"
+#include "config/options.h"
+#include "protocol/protocol.h"
+#include "protocol/proxy.h"
+#include "protocol/uri.h"
+#include "util/conv.h"
+#include "util/file.h"
+#include "util/hash.h"
+#include "util/lists.h"
+#include "util/md5.h"
+#include "util/memory.h"
+#include "util/string.h"
+#include "util/time.h"
+
+
+/* Each cache entry lives in its own file in the DISK_CACHE_DIRNAME
+ * subdirectory of the ELinks home directory. The file is named after the
+ * MD5 of the URI and looks like this:
+ *
+ *	ELinks disk cache 1 <offset of the body, fixed width>\n
+ *	URI: <uri>\n
+ *	<more "Name: value" lines>\n
+ *	\n
+ *	<protocol header>
+ *	<zero padding up to the page aligned body offset>
+ *	<FRAGMENT_HEADER_SIZE zero bytes>
+ *	<body>
+ *
+ * The room in front of the body lets add_mapped_fragment() map the body
+ * together with its struct fragment, so it never has to be copied. */
+
+#define DISK_CACHE_DIRNAME	"cache/"
+#define DISK_CACHE_MAGIC	"ELinks disk cache 1"
+#define DISK_CACHE_OFFSET_WIDTH	20
+#define DISK_CACHE_FIRST_LINE	(sizeof(DISK_CACHE_MAGIC) + DISK_CACHE_OFFSET_WIDTH + 1)
+
+/* Refuse larger headers, so garbage files cannot make us allocate much. */
+#define DISK_CACHE_MAX_HEADER	(1024 * 1024)
+
+struct disk_cache_item {
+	LIST_HEAD(struct disk_cache_item);
+
+	struct hash_item *hash_item;
+	off_t size;
+	time_t mtime;
+	unsigned char name[DISK_CACHE_NAME_LENGTH + 1];
+};
+
+/* The index of the cache directory, built when first needed. The list is
+ * sorted with the most recently used files first and the hash maps the
+ * file names to the items. */
+static INIT_LIST_OF(struct disk_cache_item, disk_cache_items);
+static struct hash *disk_cache_hash;
+static unsigned longlong disk_cache_size;
+
+
+int
+get_disk_cache_enable(void)
+{
+	return elinks_home
+		&& get_opt_bool("document.cache.disk.enable", NULL)
+		&& !get_cmd_opt_bool("anonymous");
+}
+
+/* Only plain GET requests of HTTP documents are stored. */
+static int
+is_disk_cacheable_uri(struct uri *uri)
+{
+	return (uri->protocol == PROTOCOL_HTTP
+		|| uri->protocol == PROTOCOL_HTTPS)
+		&& !uri->post;
+}
+
+void
+get_disk_cache_digest_name(md5_digest_bin_T digest, unsigned char *name)
+{
+	int i;
+
+	for (i = 0; i < MD5_DIGEST_LENGTH; i++) {
+		name[i * 2] = hx(digest[i] >> 4);
+		name[i * 2 + 1] = hx(digest[i] & 0xF);
+	}
+	name[DISK_CACHE_NAME_LENGTH] = '\0';
+}
+
+static void
+get_disk_cache_name(struct uri *uri, unsigned char *name)
+{
+	md5_digest_bin_T digest;
+
+	MD5(struri(uri), strlen(struri(uri)), digest);
+	get_disk_cache_digest_name(digest, name);
+}
+
+static unsigned char *
+get_disk_cache_filename(unsigned char *name)
+{
+	return straconcat(elinks_home, DISK_CACHE_DIRNAME, name,
+			  (unsigned char *) NULL);
+}
+
+static int
+is_disk_cache_name(unsigned char *name)
+{
+	int i;
+
+	for (i = 0; i < DISK_CACHE_NAME_LENGTH; i++)
+		if (!isxdigit(name[i]))
+			return 0;
+
+	return !name[i];
+}
+
+
+static struct disk_cache_item *
+add_disk_cache_item(unsigned char *name, off_t size, time_t mtime)
+{
+	struct disk_cache_item *item = mem_calloc(1, sizeof(*item));
+
+	if (!item) return NULL;
+
+	memcpy(item->name, name, DISK_CACHE_NAME_LENGTH);
+	item->size = size;
+	item->mtime = mtime;
+	item->hash_item = add_hash_item(disk_cache_hash, item->name,
+					DISK_CACHE_NAME_LENGTH, item);
+	if (!item->hash_item) {
+		mem_free(item);
+		return NULL;
+	}
+
+	add_to_list_end(disk_cache_items, item);
+	disk_cache_size += size;
+
+	return item;
+}
+
+static struct disk_cache_item *
+find_disk_cache_item(unsigned char *name)
+{
+	struct hash_item *hash_item;
+
+	hash_item = get_hash_item(disk_cache_hash, name, DISK_CACHE_NAME_LENGTH);
+
+	return hash_item ? hash_item->value : NULL;
+}
+
+static void
+delete_disk_cache_item(struct disk_cache_item *item, int remove_file)
+{
+	if (remove_file) {
+		unsigned char *filename = get_disk_cache_filename(item->name);
+
+		if (filename) {
+			unlink(filename);
+			mem_free(filename);
+		}
+	}
+
+	disk_cache_size -= item->size;
+	del_hash_item(disk_cache_hash, item->hash_item);
+	del_from_list(item);
+	mem_free(item);
+}
+
+static int
+compare_disk_cache_items(const void *v1, const void *v2)
+{
+	const struct disk_cache_item *i1 = *(const struct disk_cache_item **) v1;
+	const struct disk_cache_item *i2 = *(const struct disk_cache_item **) v2;
+
+	/* Newest first. */
+	return (i1->mtime < i2->mtime) - (i1->mtime > i2->mtime);
+}
+
+/* Build the index from the files in the cache directory. The modification
+ * time of the files tells the LRU order since it is updated on each use. */
+static int
+init_disk_cache(void)
+{
+	struct disk_cache_item **items = NULL;
+	struct disk_cache_item *item;
+	unsigned char *dirname;
+	struct dirent *entry;
+	int count = 0, i;
+	DIR *dir;
+
+	if (disk_cache_hash) return 1;
+
+	disk_cache_hash = init_hash8();
+	if (!disk_cache_hash) return 0;
+
+	dirname = straconcat(elinks_home, DISK_CACHE_DIRNAME,
+			     (unsigned char *) NULL);
+	if (!dirname) return 1;
+
+	dir = opendir(dirname);
+	if (!dir) {
+		if (errno == ENOENT) mkdir(dirname, 0700);
+		mem_free(dirname);
+		return 1;
+	}
+
+	while ((entry = readdir(dir))) {
+		struct disk_cache_item **new_items;
+		unsigned char *filename;
+		struct stat st;
+
+		if (!is_disk_cache_name(entry->d_name)) continue;
+
+		filename = straconcat(dirname, entry->d_name,
+				      (unsigned char *) NULL);
+		if (!filename) continue;
+
+		if (stat(filename, &st) || !S_ISREG(st.st_mode)) {
+			mem_free(filename);
+			continue;
+		}
+		mem_free(filename);
+
+		new_items = mem_realloc(items, (count + 1) * sizeof(*items));
+		if (!new_items) break;
+		items = new_items;
+
+		item = mem_calloc(1, sizeof(*item));
+		if (!item) break;
+
+		memcpy(item->name, entry->d_name, DISK_CACHE_NAME_LENGTH);
+		item->size = st.st_size;
+		item->mtime = st.st_mtime;
+		items[count++] = item;
+	}
+
+	closedir(dir);
+	mem_free(dirname);
+
+	if (!count) {
+		mem_free_if(items);
+		return 1;
+	}
+
+	qsort(items, count, sizeof(*items), compare_disk_cache_items);
+
+	for (i = 0; i < count; i++) {
+		item = items[i];
+		item->hash_item = add_hash_item(disk_cache_hash, item->name,
+						DISK_CACHE_NAME_LENGTH, item);
+		if (!item->hash_item) {
+			mem_free(item);
+			continue;
+		}
+
+		add_to_list_end(disk_cache_items, item);
+		disk_cache_size += item->size;
+	}
+
+	mem_free(items);
+
+	return 1;
+}
+
+void
+done_disk_cache(void)
+{
+	while (!list_empty(disk_cache_items))
+		delete_disk_cache_item(disk_cache_items.next, 0);
+
+	if (disk_cache_hash) free_hash(&disk_cache_hash);
+	disk_cache_size = 0;
+}
+
+/* Drop the least recently used files until the cache fits the limit. */
+static void
+shrink_disk_cache(void)
+{
+	unsigned longlong max_size = get_opt_long("document.cache.disk.size", NULL);
+
+	while (disk_cache_size > max_size && !list_empty(disk_cache_items))
+		delete_disk_cache_item(disk_cache_items.prev, 1);
+}
+
+
+/* Works out where the body will go: the header has to fit in front of it
+ * and the body has to start at a page boundary so it can be mapped.  If
+ * the page size is not known, the body is never mapped. */
+static off_t
+get_disk_cache_data_offset(struct cache_entry *cached)
+{
+	off_t header_length = DISK_CACHE_FIRST_LINE + 1024
+			      + strlen(struri(cached->uri))
+			      + (cached->head ? strlen(cached->head) : 0)
+			      + (cached->etag ? strlen(cached->etag) : 0)
+			      + (cached->last_modified ? strlen(cached->last_modified) : 0)
+			      + (cached->content_type ? strlen(cached->content_type) : 0);
+	int page_size = get_page_size();
+
+	if (!page_size) return header_length;
+
+	return (header_length + page_size - 1) / page_size * page_size;
+}
+
+static int
+write_disk_cache_entry(FILE *file, void *data)
+{
+	struct cache_entry *cached = data;
+	off_t data_offset = get_disk_cache_data_offset(cached);
+	struct string header;
+	struct fragment *frag;
+	int head_length = cached->head ? strlen(cached->head) : 0;
+	off_t pos;
+
+	if (!init_string(&header)) return -1;
+
+	add_format_to_string(&header, "%s %0*"OFF_PRINT_FORMAT"\n",
+			     DISK_CACHE_MAGIC, DISK_CACHE_OFFSET_WIDTH,
+			     (off_print_T) data_offset);
+	add_format_to_string(&header, "URI: %s\n", struri(cached->uri));
+	add_format_to_string(&header, "Fragment-Header: %d\n",
+			     (int) FRAGMENT_HEADER_SIZE);
+	add_format_to_string(&header, "Length: %"OFF_PRINT_FORMAT"\n",
+			     (off_print_T) cached->length);
+	add_format_to_string(&header, "Head-Length: %d\n", head_length);
+	add_format_to_string(&header, "Seconds: %"TIME_PRINT_FORMAT"\n",
+			     (time_print_T) cached->seconds);
+	add_format_to_string(&header, "Max-Age: %ld %ld\n",
+			     cached->max_age.sec, cached->max_age.usec);
+	add_format_to_string(&header, "Expire: %d\n", cached->expire);
+	add_format_to_string(&header, "Cache-Mode: %d\n", cached->cache_mode);
+	if (cached->etag)
+		add_format_to_string(&header, "ETag: %s\n", cached->etag);
+	if (cached->last_modified)
+		add_format_to_string(&header, "Last-Modified: %s\n",
+				     cached->last_modified);
+	if (cached->content_type)
+		add_format_to_string(&header, "Content-Type: %s\n",
+				     cached->content_type);
+	add_char_to_string(&header, '\n');
+	if (head_length)
+		add_bytes_to_string(&header, cached->head, head_length);
+
+	if (header.length > data_offset) {
+		done_string(&header);
+		return -1;
+	}
+
+	fwrite(header.source, 1, header.length, file);
+	pos = header.length;
+	done_string(&header);
+
+	for (; pos < data_offset + FRAGMENT_HEADER_SIZE; pos++)
+		fputc(0, file);
+
+	foreach_cache_fragment (frag, cached)
+		fwrite(frag->data, 1, frag->length, file);
+
+	return ferror(file) ? -1 : 0;
+}
+
+int
+save_disk_cache_file(unsigned char *name, off_t size,
+		     int (*write_file)(FILE *, void *), void *data)
+{
+	unsigned char *filename, *tmp_filename;
+	struct disk_cache_item *item;
+	FILE *file;
+	int fd, saved = 0;
+
+	if (size > get_opt_long("document.cache.disk.size", NULL)
+	    || !init_disk_cache())
+		return 0;
+
+	filename = get_disk_cache_filename(name);
+	if (!filename) return 0;
+
+	tmp_filename = straconcat(elinks_home, DISK_CACHE_DIRNAME, "tmpXXXXXX",
+				  (unsigned char *) NULL);
+	if (!tmp_filename) {
+		mem_free(filename);
+		return 0;
+	}
+
+	/* Write to a temporary file and rename it, so other instances never
+	 * see a partial file and existing mappings of the old one stay
+	 * intact. */
+	fd = safe_mkstemp(tmp_filename);
+	file = fd >= 0 ? fdopen(fd, "wb") : NULL;
+	if (!file) {
+		if (fd >= 0) {
+			close(fd);
+			unlink(tmp_filename);
+		}
+		goto free_filenames;
+	}
+
+	if (write_file(file, data) < 0) {
+		fclose(file);
+		unlink(tmp_filename);
+		goto free_filenames;
+	}
+
+	if (fclose(file) || rename(tmp_filename, filename)) {
+		unlink(tmp_filename);
+		goto free_filenames;
+	}
+
+	saved = 1;
+
+	item = find_disk_cache_item(name);
+	if (item) {
+		disk_cache_size += size - item->size;
+		item->size = size;
+		move_to_top_of_list(disk_cache_items, item);
+	} else {
+		item = add_disk_cache_item(name, size, time(NULL));
+		if (item) move_to_top_of_list(disk_cache_items, item);
+	}
+
+	shrink_disk_cache();
+
+free_filenames:
+	mem_free(tmp_filename);
+	mem_free(filename);
+
+	return saved;
+}
+
+void
+save_disk_cache_entry(struct cache_entry *cached)
+{
+	unsigned char name[DISK_CACHE_NAME_LENGTH + 1];
+	struct fragment *frag;
+	off_t size, length = 0;
+
+	if (!get_disk_cache_enable()
+	    || !cached->valid
+	    || cached->incomplete
+	    || cached->redirect
+	    || cached->cgi
+	    || cached->no_store
+	    || cached->cache_mode == CACHE_MODE_NEVER
+	    || cached->disk_cache_id == cached->cache_id
+	    || !is_disk_cacheable_uri(cached->uri))
+		return;
+
+	/* Only whole documents without holes are worth keeping. */
+	foreach_cache_fragment (frag, cached)
+		length += frag->length;
+	if (!length || length != cached->length) return;
+
+	size = get_disk_cache_data_offset(cached) + FRAGMENT_HEADER_SIZE + length;
+
+	get_disk_cache_name(cached->uri, name);
+	if (save_disk_cache_file(name, size, write_disk_cache_entry, cached))
+		cached->disk_cache_id = cached->cache_id;
+}
+
+
+/* The values of a disk cache file header. */
+struct disk_cache_header {
+	unsigned char *uri;
+	unsigned char *head;
+	unsigned char *etag;
+	unsigned char *last_modified;
+	unsigned char *content_type;
+	off_t length;
+	int head_length;
+	int fragment_header;
+	time_t seconds;
+	timeval_T max_age;
+	int expire;
+	int cache_mode;
+};
+
+/* Parse the "Name: value" lines in @buffer, which is modified in place. The
+ * strings in @header point into @buffer. Returns zero if the header is not
+ * valid. */
+static int
+parse_disk_cache_header(unsigned char *buffer, int buffer_length,
+			struct disk_cache_header *header)
+{
+	unsigned char *line = buffer;
+	unsigned char *end = buffer + buffer_length;
+
+	memset(header, 0, sizeof(*header));
+	header->fragment_header = -1;
+	header->length = -1;
+
+	while (line < end && *line != '\n') {
+		unsigned char *eol = memchr(line, '\n', end - line);
+		unsigned char *value;
+
+		if (!eol) return 0;
+		*eol = '\0';
+
+		value = strchr(line, ':');
+		if (!value || value[1] != ' ') return 0;
+		*value = '\0';
+		value += 2;
+
+		if (!strcmp(line, "URI")) {
+			header->uri = value;
+		} else if (!strcmp(line, "Fragment-Header")) {
+			header->fragment_header = atoi(value);
+		} else if (!strcmp(line, "Length")) {
+			header->length = (off_t) strtoll(value, NULL, 10);
+		} else if (!strcmp(line, "Head-Length")) {
+			header->head_length = atoi(value);
+		} else if (!strcmp(line, "Seconds")) {
+			header->seconds = str_to_time_t(value);
+		} else if (!strcmp(line, "Max-Age")) {
+			unsigned char *usec;
+
+			header->max_age.sec = strtol(value, (char **) &usec, 10);
+			header->max_age.usec = strtol(usec, NULL, 10);
+		} else if (!strcmp(line, "Expire")) {
+			header->expire = !!atoi(value);
+		} else if (!strcmp(line, "Cache-Mode")) {
+			header->cache_mode = atoi(value);
+		} else if (!strcmp(line, "ETag")) {
+			header->etag = value;
+		} else if (!strcmp(line, "Last-Modified")) {
+			header->last_modified = value;
+		} else if (!strcmp(line, "Content-Type")) {
+			header->content_type = value;
+		}
+
+		line = eol + 1;
+	}
+
+	if (line >= end || !header->uri || header->length <= 0
+	    || header->head_length < 0
+	    || header->fragment_header != FRAGMENT_HEADER_SIZE
+	    || header->cache_mode < CACHE_MODE_INCREMENT
+	    || header->cache_mode > CACHE_MODE_NEVER)
+		return 0;
+
+	/* Skip the empty line. */
+	line++;
+	if (header->head_length > end - line) return 0;
+
+	if (header->head_length) {
+		header->head = line;
+		line[header->head_length] = '\0';
+	}
+
+	return 1;
+}
+
+static int
+read_disk_cache_bytes(int fd, unsigned char *buffer, int length)
+{
+	int done = 0;
+
+	while (done < length) {
+		ssize_t n = read(fd, buffer + done, length - done);
+
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return -1;
+		done += n;
+	}
+
+	return 0;
+}
+
+int
+open_disk_cache_file(unsigned char *name)
+{
+	struct disk_cache_item *item;
+	unsigned char *filename;
+	int fd;
+
+	if (!init_disk_cache()) return -1;
+
+	item = find_disk_cache_item(name);
+	if (!item) return -1;
+
+	filename = get_disk_cache_filename(name);
+	if (!filename) return -1;
+
+	fd = open(filename, O_RDONLY);
+	mem_free(filename);
+
+	/* Removed behind our back. */
+	if (fd < 0) delete_disk_cache_item(item, 0);
+
+	return fd;
+}
+
+void
+release_disk_cache_file(unsigned char *name, int invalid)
+{
+	struct disk_cache_item *item = find_disk_cache_item(name);
+
+	if (!item) return;
+
+	if (invalid) {
+		delete_disk_cache_item(item, 1);
+		return;
+	}
+
+	/* Mark it as recently used, also for the next sessions. */
+#ifdef HAVE_UTIME
+	{
+		unsigned char *filename = get_disk_cache_filename(name);
+
+		if (filename) {
+			utime(filename, NULL);
+			mem_free(filename);
+		}
+	}
+#endif
+	move_to_top_of_list(disk_cache_items, item);
+}
+
+struct cache_entry *
+load_disk_cache_entry(struct uri *uri)
+{
+	unsigned char name[DISK_CACHE_NAME_LENGTH + 1];
+	unsigned char first_line[DISK_CACHE_FIRST_LINE + 1];
+	unsigned char *buffer = NULL;
+	struct cache_entry *cached = NULL;
+	struct disk_cache_header header;
+	struct uri *proxied_uri;
+	off_t data_offset;
+	struct stat st;
+	int fd = -1;
+
+	if (!get_disk_cache_enable()
+	    || !init_disk_cache()
+	    || list_empty(disk_cache_items))
+		return NULL;
+
+	proxied_uri = get_proxied_uri(uri);
+	if (!proxied_uri) return NULL;
+
+	if (!is_disk_cacheable_uri(proxied_uri)) goto out;
+
+	get_disk_cache_name(proxied_uri, name);
+	fd = open_disk_cache_file(name);
+	if (fd < 0) goto out;
+
+	if (fstat(fd, &st)
+	    || read_disk_cache_bytes(fd, first_line, DISK_CACHE_FIRST_LINE) < 0)
+		goto invalid;
+
+	first_line[DISK_CACHE_FIRST_LINE] = '\0';
+	if (strncmp(first_line, DISK_CACHE_MAGIC " ", sizeof(DISK_CACHE_MAGIC))
+	    || first_line[DISK_CACHE_FIRST_LINE - 1] != '\n')
+		goto invalid;
+
+	data_offset = (off_t) strtoll(first_line + sizeof(DISK_CACHE_MAGIC),
+				      NULL, 10);
+	if (data_offset <= DISK_CACHE_FIRST_LINE
+	    || data_offset > DISK_CACHE_MAX_HEADER)
+		goto invalid;
+
+	buffer = mem_alloc(data_offset - DISK_CACHE_FIRST_LINE + 1);
+	if (!buffer) goto out;
+
+	if (read_disk_cache_bytes(fd, buffer, data_offset - DISK_CACHE_FIRST_LINE) < 0
+	    || !parse_disk_cache_header(buffer, data_offset - DISK_CACHE_FIRST_LINE,
+					&header)
+	    || data_offset + FRAGMENT_HEADER_SIZE + header.length > st.st_size)
+		goto invalid;
+
+	/* Different URI with the same MD5, unlikely but not impossible. */
+	if (strcmp(header.uri, struri(proxied_uri)))
+		goto out;
+
+	cached = get_cache_entry(uri);
+	if (!cached) goto out;
+
+	if (!list_empty(cached->frag)
+	    || add_mapped_fragment(cached, fd, data_offset, header.length) < 0) {
+		if (!is_object_used(cached)) delete_cache_entry(cached);
+		cached = NULL;
+		goto out;
+	}
+
+	mem_free_set(&cached->head, header.head ? stracpy(header.head) : NULL);
+	mem_free_set(&cached->etag, header.etag ? stracpy(header.etag) : NULL);
+	mem_free_set(&cached->last_modified,
+		     header.last_modified ? stracpy(header.last_modified) : NULL);
+	mem_free_set(&cached->content_type,
+		     header.content_type ? stracpy(header.content_type) : NULL);
+	cached->seconds = header.seconds;
+	timeval_copy(&cached->max_age, &header.max_age);
+	cached->expire = header.expire;
+	cached->cache_mode = header.cache_mode;
+	cached->incomplete = 0;
+	cached->disk_cache_id = cached->cache_id;
+
+	/* get_cache_entry() might have evicted other entries and shrunk the
+	 * index meanwhile but the file is looked up again by its name. */
+	release_disk_cache_file(name, 0);
+	goto out;
+
+invalid:
+	release_disk_cache_file(name, 1);
+
+out:
+	if (fd >= 0) close(fd);
+	mem_free_if(buffer);
+	done_uri(proxied_uri);
+
+	return cached;
+}
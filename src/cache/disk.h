@@ -0,0 +1,45 @@
+#ifndef EL__CACHE_DISK_H
+#define EL__CACHE_DISK_H
+
+#include "util/md5.h"
+
+struct cache_entry;
+struct uri;
+
+/* The files in the disk cache are named after a MD5 digest in hex. */
+#define DISK_CACHE_NAME_LENGTH	MD5_HEX_DIGEST_LENGTH
+
+/* Whether the disk cache can be used. */
+int get_disk_cache_enable(void);
+
+/* Store the complete @cached object in the disk cache if it is worth it.
+ * Called when the entry is about to be dropped from the memory cache. */
+void save_disk_cache_entry(struct cache_entry *cached);
+
+/* Look up @uri in the disk cache and if it is there, bring it back to the
+ * memory cache. Returns the new cache entry or NULL. */
+struct cache_entry *load_disk_cache_entry(struct uri *uri);
+
+/* Forget the in-memory index of the disk cache. The files are kept. */
+void done_disk_cache(void);
+
+/* Fill in the DISK_CACHE_NAME_LENGTH + 1 bytes of @name with the name of
+ * the file for @digest. */
+void get_disk_cache_digest_name(md5_digest_bin_T digest, unsigned char *name);
+
+/* Store @size bytes written by @write_file in the disk cache file @name,
+ * replacing the old one atomically. The file counts towards the size of
+ * the disk cache as any other. @write_file returns -1 on errors. Returns
+ * zero if the file was not stored. */
+int save_disk_cache_file(unsigned char *name, off_t size,
+			 int (*write_file)(FILE *, void *), void *data);
+
+/* Open the disk cache file @name for reading. Returns -1 if there is no
+ * such file. */
+int open_disk_cache_file(unsigned char *name);
+
+/* Done reading the disk cache file @name. If it turned out to be @invalid
+ * it is removed, otherwise it is marked as recently used. */
+void release_disk_cache_file(unsigned char *name, int invalid);
+
+#endif
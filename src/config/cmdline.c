@@ -812,6 +812,11 @@ union option_info cmdline_options_info[] = {
 		"dump-color-mode", 0, "document.dump.color_mode",
 		N_("Color mode used with -dump.")),
 
+	INIT_OPT_CMDALIAS("", N_("Number of URLs loaded at once with -dump"),
+		"dump-parallel", 0, "document.dump.parallel",
+		N_("Number of URLs loaded at the same time with -dump "
+		"or -source.")),
+
 	INIT_OPT_CMDALIAS("", N_("Width of document formatted with -dump"),
 		"dump-width", 0, "document.dump.width",
 		N_("Width of the dump output.")),
@@ -30,6 +30,7 @@
 #include "terminal/terminal.h"
 #include "util/color.h"
 #include "util/error.h"
+#include "util/hash.h"
 #include "util/memory.h"
 #include "util/string.h"
 #include "viewer/text/draw.h"
@@ -159,6 +160,46 @@ debug_check_option_syntax(struct option *option)
 /* Ugly kludge */
 static int no_autocreate = 0;
 
+/* Options looked up by their full name in ::config_options and
+ * ::cmdline_options are remembered here, so that the get_opt_*() calls
+ * on hot paths need not copy and walk the name every time.  Only found
+ * options are indexed, so adding options needs no care; deleting any
+ * option drops the indexes (see drop_option_indexes()). */
+static struct hash *config_options_index;
+static struct hash *cmdline_options_index;
+
+static struct hash **
+get_option_index(struct option *tree)
+{
+	if (tree == config_options) return &config_options_index;
+	if (tree == cmdline_options) return &cmdline_options_index;
+	return NULL;
+}
+
+static void
+drop_option_index(struct hash **index)
+{
+	struct hash_item *item;
+	int i;
+
+	if (!*index) return;
+
+	foreach_hash_item (item, **index, i)
+		mem_free(item->key);
+
+	free_hash(index);
+}
+
+static void
+drop_option_indexes(void)
+{
+	drop_option_index(&config_options_index);
+	drop_option_index(&cmdline_options_index);
+}
+
+static struct option *get_opt_rec_walk(struct option *tree,
+				       const unsigned char *name_);
+
 /** Get record of option of given name, or NULL if there's no such option.
  *
  * If the specified option is an ::OPT_ALIAS, this function returns the
@@ -170,7 +211,40 @@ static int no_autocreate = 0;
  *
  * @relates option */
 struct option *
-get_opt_rec(struct option *tree, const unsigned char *name_)
+get_opt_rec(struct option *tree, const unsigned char *name)
+{
+	struct hash **index = get_option_index(tree);
+	int namelen = strlen(name);
+	struct hash_item *item;
+	struct option *option;
+	unsigned char *key;
+
+	if (!index || !namelen)
+		return get_opt_rec_walk(tree, name);
+
+	if (*index) {
+		item = get_hash_item(*index, (unsigned char *) name, namelen);
+		if (item) return item->value;
+	}
+
+	option = get_opt_rec_walk(tree, name);
+	if (!option) return NULL;
+
+	if (!*index) {
+		*index = init_hash8();
+		if (!*index) return option;
+	}
+
+	key = memacpy(name, namelen);
+	if (key && !add_hash_item(*index, key, namelen, option))
+		mem_free(key);
+
+	return option;
+}
+
+/* Resolve @name_ in @tree component by component. */
+static struct option *
+get_opt_rec_walk(struct option *tree, const unsigned char *name_)
 {
 	struct option *option;
 	unsigned char *aname = stracpy(name_);
@@ -616,6 +690,8 @@ done_option(struct option *option)
 static void
 delete_option_do(struct option *option, int recursive)
 {
+	drop_option_indexes();
+
 	if (option->next) {
 		del_from_list(option);
 		option->prev = option->next = NULL;
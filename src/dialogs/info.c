@@ -18,6 +18,8 @@
 #include "config/kbdbind.h"
 #include "config/options.h"
 #include "dialogs/info.h"
+#include "document/css/apply.h"
+#include "document/html/renderer.h"
 #include "document/renderer.h"
 #include "ecmascript/ecmascript.h"
 #include "intl/gettext/libintl.h"
@@ -25,6 +27,7 @@
 #include "main/timer.h"
 #include "main/version.h"
 #include "network/connection.h"
+#include "network/dns.h"
 #include "session/session.h"
 #include "terminal/terminal.h"
 #include "util/conv.h"
@@ -197,6 +200,21 @@ get_resource_info(struct terminal *term, void *data)
 	val_add(n_("%ld keepalive", "%ld keepalive", val, term));
 	add_to_string(&info, ".\n");
 
+	add_to_string(&info, _("DNS cache", term));
+	add_to_string(&info, ": ");
+
+	val = get_dns_cache_entry_count();
+	val_add(n_("%ld host", "%ld hosts", val, term));
+	add_to_string(&info, ", ");
+
+	val = get_dns_cache_hits();
+	val_add(n_("%ld hit", "%ld hits", val, term));
+	add_to_string(&info, ", ");
+
+	val = get_dns_cache_misses();
+	val_add(n_("%ld miss", "%ld misses", val, term));
+	add_to_string(&info, ".\n");
+
 	add_to_string(&info, _("Memory cache", term));
 	add_to_string(&info, ": ");
 
@@ -232,6 +250,38 @@ get_resource_info(struct terminal *term, void *data)
 	val_add(n_("%ld refreshing", "%ld refreshing", val, term));
 	add_to_string(&info, ".\n");
 
+	add_to_string(&info, _("Table layout cache", term));
+	add_to_string(&info, ": ");
+
+	val = get_table_cache_entry_count();
+	val_add(n_("%ld layout", "%ld layouts", val, term));
+	add_to_string(&info, ", ");
+
+	val = get_table_cache_hits();
+	val_add(n_("%ld hit", "%ld hits", val, term));
+	add_to_string(&info, ", ");
+
+	val = get_table_cache_misses();
+	val_add(n_("%ld miss", "%ld misses", val, term));
+	add_to_string(&info, ", ");
+
+	val = get_table_cache_saved_time();
+	val_add(n_("%ld ms saved", "%ld ms saved", val, term));
+	add_to_string(&info, ".\n");
+
+#ifdef CONFIG_CSS
+	add_to_string(&info, _("CSS styles", term));
+	add_to_string(&info, ": ");
+
+	val = get_shared_css_style_hits();
+	val_add(n_("%ld shared", "%ld shared", val, term));
+	add_to_string(&info, ", ");
+
+	val = get_shared_css_style_misses();
+	val_add(n_("%ld computed", "%ld computed", val, term));
+	add_to_string(&info, ".\n");
+#endif
+
 #ifdef CONFIG_ECMASCRIPT
 	add_to_string(&info, _("ECMAScript", term));
 	add_to_string(&info, ": ");
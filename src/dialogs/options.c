@@ -92,6 +92,7 @@ enum termopt {
 	TERM_OPT_TRANSPARENCY,
 	TERM_OPT_UNDERLINE,
 	TERM_OPT_ITALIC,
+	TERM_OPT_SCROLL_REGIONS,
 #ifdef CONFIG_COMBINE
 	TERM_OPT_COMBINE,
 #endif
@@ -109,6 +110,7 @@ static struct option_resolver resolvers[] = {
 	{ TERM_OPT_UTF_8_IO,	 "utf_8_io"	},
 	{ TERM_OPT_UNDERLINE,	 "underline"	},
 	{ TERM_OPT_ITALIC,	 "italic"	},
+	{ TERM_OPT_SCROLL_REGIONS, "scroll_regions" },
 #ifdef CONFIG_COMBINE
 	{ TERM_OPT_COMBINE,	 "combine"	},
 #endif
@@ -231,6 +233,7 @@ terminal_options(struct terminal *term, void *xxx, struct session *ses)
 	add_dlg_checkbox(dlg, _("Restrict frames in cp850/852", term), &values[TERM_OPT_RESTRICT_852].number);
 	add_dlg_checkbox(dlg, _("Block cursor", term), &values[TERM_OPT_BLOCK_CURSOR].number);
 	add_dlg_checkbox(dlg, _("Italic", term), &values[TERM_OPT_ITALIC].number);
+	add_dlg_checkbox(dlg, _("Scrolling regions", term), &values[TERM_OPT_SCROLL_REGIONS].number);
 	add_dlg_checkbox(dlg, _("Transparency", term), &values[TERM_OPT_TRANSPARENCY].number);
 	add_dlg_checkbox(dlg, _("Underline", term), &values[TERM_OPT_UNDERLINE].number);
 	add_dlg_checkbox(dlg, _("UTF-8 I/O", term), &values[TERM_OPT_UTF_8_IO].number);
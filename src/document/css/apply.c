@@ -155,14 +155,17 @@ static const css_applier_T css_appliers[CSS_PT_LAST] = {
 	/* CSS_PT_WHITE_SPACE */	css_apply_font_attribute,
 };
 
-/** This looks for a match in list of selectors. */
+/** This looks for a match in list of selectors.  @a layer is the set of
+ * basic element selectors of css_stylesheet.layer when @a selectors are
+ * the ones of the stylesheet itself, and NULL otherwise. */
 static void
 examine_element(struct html_context *html_context, struct css_selector *base,
 		enum css_selector_type seltype, enum css_selector_relation rel,
 		struct css_selector_set *selectors,
+		struct css_selector_set *layer,
 		struct html_element *element)
 {
-	struct css_selector *selector;
+	struct css_selector *selector, *layer_selector;
 
 #ifdef DEBUG_CSS
 	/* Cannot use list_empty() inside the arglist of DBG() because
@@ -179,10 +182,19 @@ examine_element(struct html_context *html_context, struct css_selector *base,
 #define dbginfo(sel, type, base)
 #endif
 
+#define find_selectors(type, name, namelen) \
+	selector = find_css_selector(selectors, type, rel, name, namelen); \
+	layer_selector = layer \
+		? find_css_selector(layer, type, rel, name, namelen) : NULL
+
 #define process_found_selector(sel, type, base) \
 	if (selector) { \
 		dbginfo(sel, type, base); \
 		merge_css_selectors(base, sel); \
+	} \
+	if (layer_selector) \
+		merge_css_layer_selector(base, layer_selector); \
+	if (selector) { \
 		/* Ancestor matches? */ \
 		if (sel->leaves.may_contain_rel_ancestor_or_parent \
 		    && (LIST_OF(struct html_element) *) element->next \
@@ -200,24 +212,22 @@ examine_element(struct html_context *html_context, struct css_selector *base,
 			     ancestor = ancestor->next) \
 				examine_element(html_context, base, \
 						CST_ELEMENT, CSR_ANCESTOR, \
-						&sel->leaves, ancestor); \
+						&sel->leaves, NULL, ancestor); \
 			examine_element(html_context, base, \
 			                CST_ELEMENT, CSR_PARENT, \
-			                &sel->leaves, element->next); \
+			                &sel->leaves, NULL, element->next); \
 		} \
 		/* More specific matches? */ \
 		examine_element(html_context, base, type + 1, \
 		                CSR_SPECIFITY, \
-		                &sel->leaves, element); \
+		                &sel->leaves, NULL, element); \
 	}
 
 	if (seltype <= CST_ELEMENT && element->namelen) {
-		selector = find_css_selector(selectors, CST_ELEMENT, rel,
-		                             "*", 1);
+		find_selectors(CST_ELEMENT, "*", 1);
 		process_found_selector(selector, CST_ELEMENT, base);
 
-		selector = find_css_selector(selectors, CST_ELEMENT, rel,
-		                             element->name, element->namelen);
+		find_selectors(CST_ELEMENT, element->name, element->namelen);
 		process_found_selector(selector, CST_ELEMENT, base);
 	}
 
@@ -226,11 +236,11 @@ examine_element(struct html_context *html_context, struct css_selector *base,
 
 	/* TODO: More pseudo-classess. --pasky */
 	if (element->pseudo_class & ELEMENT_LINK) {
-		selector = find_css_selector(selectors, CST_PSEUDO, rel, "link", -1);
+		find_selectors(CST_PSEUDO, "link", -1);
 		process_found_selector(selector, CST_PSEUDO, base);
 	}
 	if (element->pseudo_class & ELEMENT_VISITED) {
-		selector = find_css_selector(selectors, CST_PSEUDO, rel, "visited", -1);
+		find_selectors(CST_PSEUDO, "visited", -1);
 		process_found_selector(selector, CST_PSEUDO, base);
 	}
 
@@ -245,21 +255,189 @@ examine_element(struct html_context *html_context, struct css_selector *base,
 			begin = class_;
 			while (*class_ != ' ' && *class_ != '\0') ++class_;
 
-			selector = find_css_selector(selectors, CST_CLASS, rel,
-						     begin, class_ - begin);
+			find_selectors(CST_CLASS, begin, class_ - begin);
 			process_found_selector(selector, CST_CLASS, base);
 		}
 	}
 
 	if (element->attr.id && seltype <= CST_ID) {
-		selector = find_css_selector(selectors, CST_ID, rel, element->attr.id, -1);
+		find_selectors(CST_ID, element->attr.id, -1);
 		process_found_selector(selector, CST_ID, base);
 	}
 
 #undef process_found_selector
+#undef find_selectors
 #undef dbginfo
 }
 
+/** The style that the stylesheet gave to an element, for its next
+ * siblings and cousins to share.
+ *
+ * Every element gets a style context, html_element.css_context.  Two
+ * elements have the same one only if they have the same name, classes
+ * and pseudo classes and no id, and their parents have the same context
+ * too.  The same selectors then match them and their ancestors, so they
+ * get the same style from the stylesheet.
+ *
+ * Elements without name and attributes, such as those that tables put
+ * around their cells, match no selectors.  They are skipped when looking
+ * for the parent, and only counted. */
+struct css_shared_style {
+	LIST_HEAD(struct css_shared_style);
+
+	/** The style context of the parent of the element, and how many
+	 * elements without name and attributes are between them. */
+	unsigned int parent_context;
+	int anonymous_parents;
+
+	/** The html_context.css_id of the stylesheet that gave the style. */
+	hash_value_T css_id;
+
+	unsigned char *name;
+	int namelen;
+	unsigned char *class_;
+	enum html_element_pseudo_class pseudo_class;
+
+	/** The style context of the elements that have the style. */
+	unsigned int context;
+
+	/** The properties, without those of the style attribute. */
+	struct css_selector *selector;
+};
+
+static long shared_css_style_hits;
+static long shared_css_style_misses;
+
+static void
+done_shared_css_style(struct html_context *html_context,
+		      struct css_shared_style *style)
+{
+	del_from_list(style);
+	html_context->css_shared_styles_count--;
+	done_css_selector(style->selector);
+	mem_free(style->name);
+	mem_free_if(style->class_);
+	mem_free(style);
+}
+
+/** Get the style context of the parent of @a element, and store in
+ * @a anonymous_parents how many elements without name and attributes
+ * were skipped to find it. */
+static unsigned int
+get_parent_css_context(struct html_context *html_context,
+		       struct html_element *element, int *anonymous_parents)
+{
+	struct html_element *parent;
+
+	*anonymous_parents = 0;
+
+	for (parent = element->next;
+	     (LIST_OF(struct html_element) *) parent != &html_context->stack;
+	     parent = parent->next) {
+		if (parent->namelen || parent->options)
+			return parent->css_context;
+
+		++*anonymous_parents;
+	}
+
+	/* The contexts given to elements start from 1. */
+	return 0;
+}
+
+static struct css_shared_style *
+get_shared_css_style(struct html_context *html_context,
+		     struct html_element *element)
+{
+	struct css_shared_style *style;
+	unsigned int parent_context;
+	int anonymous_parents;
+
+	parent_context = get_parent_css_context(html_context, element,
+						&anonymous_parents);
+
+	foreach (style, html_context->css_shared_styles) {
+		if (style->parent_context != parent_context
+		    || style->anonymous_parents != anonymous_parents
+		    || style->css_id != html_context->css_id
+		    || style->pseudo_class != element->pseudo_class
+		    || c_strlcasecmp(style->name, style->namelen,
+				     element->name, element->namelen)
+		    || xstrcmp(style->class_, element->attr.class_))
+			continue;
+
+		move_to_top_of_list(html_context->css_shared_styles, style);
+		return style;
+	}
+
+	return NULL;
+}
+
+static struct css_shared_style *
+share_css_style(struct html_context *html_context,
+		struct html_element *element, struct css_selector *selector)
+{
+	struct css_shared_style *style = mem_calloc(1, sizeof(*style));
+
+	if (!style) return NULL;
+
+	style->parent_context = get_parent_css_context(html_context, element,
+						       &style->anonymous_parents);
+	style->css_id = html_context->css_id;
+	style->name = memacpy(element->name, element->namelen);
+	style->namelen = element->namelen;
+	style->class_ = null_or_stracpy(element->attr.class_);
+	style->pseudo_class = element->pseudo_class;
+	style->selector = init_css_selector(NULL, CST_ELEMENT, CSR_ROOT, NULL, 0);
+
+	if (!style->name || !style->selector
+	    || (element->attr.class_ && !style->class_)) {
+		if (style->selector) done_css_selector(style->selector);
+		mem_free_if(style->name);
+		mem_free_if(style->class_);
+		mem_free(style);
+		return NULL;
+	}
+
+	style->context = ++html_context->css_contexts;
+	copy_css_selector_properties(style->selector, selector);
+	add_to_list(html_context->css_shared_styles, style);
+	html_context->css_shared_styles_count++;
+
+	if (html_context->css_shared_styles_count > MAX_SHARED_CSS_STYLES)
+		done_shared_css_style(html_context,
+				      html_context->css_shared_styles.prev);
+
+	return style;
+}
+
+void
+forget_shared_css_styles(struct html_context *html_context,
+			 struct html_element *element)
+{
+	if (element != html_top)
+		done_shared_css_styles(html_context);
+}
+
+void
+done_shared_css_styles(struct html_context *html_context)
+{
+	while (!list_empty(html_context->css_shared_styles))
+		done_shared_css_style(html_context,
+				      html_context->css_shared_styles.next);
+}
+
+long
+get_shared_css_style_hits(void)
+{
+	return shared_css_style_hits;
+}
+
+long
+get_shared_css_style_misses(void)
+{
+	return shared_css_style_misses;
+}
+
 struct css_selector *
 get_css_selector_for_element(struct html_context *html_context,
 			     struct html_element *element,
@@ -268,24 +446,51 @@ get_css_selector_for_element(struct html_context *html_context,
 {
 	unsigned char *code;
 	struct css_selector *selector;
+	struct css_shared_style *shared = NULL;
+	int sharable;
 
 	assert(element && element->options && css);
 
+	/* An id is meant to be unique, so its element has nobody to share
+	 * the style with. */
+	sharable = element->namelen && !element->attr.id;
+
+	/* Until it gets a shared style, the element is like no other. */
+	element->css_context = ++html_context->css_contexts;
+
 	selector = init_css_selector(NULL, CST_ELEMENT, CSR_ROOT, NULL, 0);
 	if (!selector)
 		return NULL;
 
+	if (sharable)
+		shared = get_shared_css_style(html_context, element);
+
+	if (shared) {
+		copy_css_selector_properties(selector, shared->selector);
+		shared_css_style_hits++;
+
+	} else {
 #ifdef DEBUG_CSS
-	DBG("Applying to element %.*s...", element->namelen, element->name);
+		DBG("Applying to element %.*s...", element->namelen, element->name);
 #endif
 
-	examine_element(html_context, selector, CST_ELEMENT, CSR_ROOT,
-	                &css->selectors, element);
+		examine_element(html_context, selector, CST_ELEMENT, CSR_ROOT,
+				&css->selectors,
+				css->layer ? &css->layer->selectors : NULL,
+				element);
 
 #ifdef DEBUG_CSS
-	DBG("Element %.*s applied.", element->namelen, element->name);
+		DBG("Element %.*s applied.", element->namelen, element->name);
 #endif
 
+		shared_css_style_misses++;
+		if (sharable)
+			shared = share_css_style(html_context, element, selector);
+	}
+
+	if (shared)
+		element->css_context = shared->context;
+
 	code = get_attr_val(element->options, "style", html_context->doc_cp);
 	if (code) {
 		struct css_selector *stylesel;
@@ -12,7 +12,12 @@ struct html_context;
 struct html_element;
 
 /** Gather all style information for the given @a element, so it can later be
- * applied. Returned value should be freed using done_css_selector().  */
+ * applied. Returned value should be freed using done_css_selector().
+ *
+ * The style the stylesheet gives to the element is remembered, and shared
+ * with the next elements that have the same name, classes and pseudo
+ * classes, no id, and parents that got the same style the same way,
+ * until the stylesheet changes.  */
 struct css_selector *
 get_css_selector_for_element(struct html_context *html_context,
 			     struct html_element *element,
@@ -20,6 +25,18 @@ get_css_selector_for_element(struct html_context *html_context,
 			     LIST_OF(struct html_element) *html_stack);
 
 
+/** Tell the style sharing that @a element is being killed.  If it is not
+ * the top of the stack, this changes the ancestors of the elements above
+ * it, so their style contexts must not be shared any more.  */
+void forget_shared_css_styles(struct html_context *html_context,
+			      struct html_element *element);
+
+/** Drop all the styles shared in @a html_context. */
+void done_shared_css_styles(struct html_context *html_context);
+
+long get_shared_css_style_hits(void);
+long get_shared_css_style_misses(void);
+
 /** Apply properties from an existing selector. */
 void
 apply_css_selector_style(struct html_context *html_context,
@@ -127,12 +127,179 @@ supports_css_media_type(const unsigned char *optstr,
 	return 0;
 }
 
+/** A part of a parsed style sheet: the rules up to an @@import or
+ * the end of the style sheet, and the URL of that @@import. */
+struct css_part {
+	LIST_HEAD(struct css_part);
+
+	struct css_selector_set selectors;
+
+	/** The URL to import after the rules, or NULL for the rules
+	 * after the last @@import. */
+	unsigned char *url;
+};
+
+/** An imported style sheet as css_parse_stylesheet() left it.  Each
+ * document importing it gets its selectors merged in without parsing
+ * the style sheet again. */
+struct parsed_css {
+	LIST_HEAD(struct parsed_css);
+
+	/** The cache entry that was parsed.  It is only compared, never
+	 * dereferenced, since the entry may be gone by now. */
+	struct cache_entry *cached;
+	unsigned int cache_id;
+
+	LIST_OF(struct css_part) parts;
+
+	/** How many import_css() calls are merging the parts in.  The
+	 * @@import of a part can import more style sheets, which must
+	 * not drop this one from the cache. */
+	int locks;
+};
+
+static INIT_LIST_OF(struct parsed_css, parsed_css_cache);
+static int parsed_css_count;
+
+static void
+done_parsed_css(struct parsed_css *parsed)
+{
+	assert(!parsed->locks);
+
+	while (!list_empty(parsed->parts)) {
+		struct css_part *part = parsed->parts.next;
+
+		del_from_list(part);
+		done_css_selector_set(&part->selectors);
+		mem_free_if(part->url);
+		mem_free(part);
+	}
+
+	del_from_list(parsed);
+	parsed_css_count--;
+	mem_free(parsed);
+}
+
+static void
+done_parsed_css_cache(void)
+{
+	while (!list_empty(parsed_css_cache))
+		done_parsed_css(parsed_css_cache.next);
+}
+
+static struct parsed_css *
+get_parsed_css(struct cache_entry *cached)
+{
+	struct parsed_css *parsed;
+
+	foreach (parsed, parsed_css_cache) {
+		if (parsed->cached != cached
+		    || parsed->cache_id != cached->cache_id)
+			continue;
+
+		move_to_top_of_list(parsed_css_cache, parsed);
+		return parsed;
+	}
+
+	return NULL;
+}
+
+/** Move the rules parsed so far to a new part of the style sheet
+ * being cached.  @a url is NULL at the end of the style sheet. */
+static int
+add_css_part(struct css_stylesheet *css, const unsigned char *url, int urllen)
+{
+	struct parsed_css *parsed = css->import_data;
+	struct css_part *part = mem_calloc(1, sizeof(*part));
+
+	if (!part) return 0;
+
+	if (url) {
+		part->url = memacpy(url, urllen);
+		if (!part->url) {
+			mem_free(part);
+			return 0;
+		}
+	}
+
+	init_css_selector_set(&part->selectors);
+	while (!css_selector_set_empty(&css->selectors)) {
+		struct css_selector *selector = css_selector_set_front(&css->selectors);
+
+		del_css_selector_from_set(selector);
+		add_css_selector_to_set(selector, &part->selectors);
+	}
+	done_css_selector_set(&css->selectors);
+
+	add_to_list_end(parsed->parts, part);
+	return 1;
+}
+
+/** The import callback of the style sheets being cached.  It only
+ * records the @@import, since what it imports is looked up again
+ * whenever the style sheet is merged into a document. */
+static void
+import_css_part(struct css_stylesheet *css, struct uri *base_uri,
+		const unsigned char *url, int urllen)
+{
+	struct parsed_css *parsed = css->import_data;
+
+	/* Keep parsing but tell parse_css() not to use the result. */
+	if (!add_css_part(css, url, urllen))
+		parsed->cached = NULL;
+}
+
+/** Parse @a fragment of @a cached and add the result to the cache. */
+static struct parsed_css *
+parse_css(struct cache_entry *cached, struct uri *uri,
+	  struct fragment *fragment)
+{
+	struct parsed_css *parsed = mem_calloc(1, sizeof(*parsed));
+	struct css_stylesheet css = INIT_CSS_STYLESHEET(css, import_css_part);
+	struct parsed_css *old, *next;
+
+	if (!parsed) return NULL;
+
+	parsed->cached = cached;
+	parsed->cache_id = cached->cache_id;
+	init_list(parsed->parts);
+	add_to_list(parsed_css_cache, parsed);
+	parsed_css_count++;
+
+	css.import_data = parsed;
+	css_parse_stylesheet(&css, uri, fragment->data,
+			     fragment->data + fragment->length);
+
+	/* A part that could not be added would lose rules or an @import. */
+	if (!parsed->cached || !add_css_part(&css, NULL, 0)) {
+		done_css_stylesheet(&css);
+		done_parsed_css(parsed);
+		return NULL;
+	}
+
+	/* Drop the older versions of the style sheet and then the least
+	 * recently used ones. */
+	foreachsafe (old, next, parsed_css_cache)
+		if (old != parsed && old->cached == cached && !old->locks)
+			done_parsed_css(old);
+
+	foreachbacksafe (old, next, parsed_css_cache) {
+		if (parsed_css_count <= MAX_PARSED_STYLESHEETS)
+			break;
+		if (!old->locks && old != parsed)
+			done_parsed_css(old);
+	}
+
+	return parsed;
+}
+
 void
 import_css(struct css_stylesheet *css, struct uri *uri)
 {
-	/* Do we have it in the cache? (TODO: CSS cache) */
 	struct cache_entry *cached;
 	struct fragment *fragment;
+	struct parsed_css *parsed;
+	struct css_part *part;
 
 	if (!uri || css->import_level >= MAX_REDIRECTS)
 		return;
@@ -141,15 +308,31 @@ import_css(struct css_stylesheet *css, struct uri *uri)
 	if (!cached) return;
 
 	fragment = get_cache_fragment(cached);
-	if (fragment) {
+	if (!fragment) return;
+
+	parsed = get_parsed_css(cached);
+	if (!parsed) parsed = parse_css(cached, uri, fragment);
+	if (!parsed) {
 		unsigned char *end = fragment->data + fragment->length;
 
 		css->import_level++;
 		css_parse_stylesheet(css, uri, fragment->data, end);
 		css->import_level--;
+		return;
 	}
-}
 
+	css->import_level++;
+	parsed->locks++;
+	foreach (part, parsed->parts) {
+		merge_css_selector_set(&css->selectors, &part->selectors);
+		if (!part->url) continue;
+
+		assert(css->import);
+		css->import(css, uri, part->url, strlen(part->url));
+	}
+	parsed->locks--;
+	css->import_level--;
+}
 
 static void
 import_css_file(struct css_stylesheet *css, struct uri *base_uri,
@@ -193,6 +376,7 @@ import_default_css(void)
 	if (!*url) return;
 
 	import_css_file(&default_stylesheet, NULL, url, strlen(url));
+	pack_css_stylesheet(&default_stylesheet);
 }
 
 static int
@@ -206,8 +390,12 @@ change_hook_css(struct session *ses, struct option *current, struct option *chan
 		import_default_css();
 	}
 
-	if (!strcmp(changed->name, "media"))
+	if (!strcmp(changed->name, "media")) {
+		/* The @media rules of the cached style sheets were
+		 * parsed for the old media types. */
+		done_parsed_css_cache();
 		reload_css = 1;
+	}
 
 	/* Instead of using the value of the @ses parameter, iterate
 	 * through the @sessions list.  The parameter may be NULL and
@@ -232,6 +420,7 @@ init_css(struct module *module)
 void
 done_css(struct module *module)
 {
+	done_parsed_css_cache();
 	done_css_stylesheet(&default_stylesheet);
 }
 
@@ -12,18 +12,33 @@
 
 #include "document/css/property.h"
 #include "document/css/stylesheet.h"
+#include "util/conv.h"
 #include "util/error.h"
 #include "util/lists.h"
 #include "util/memory.h"
 #include "util/string.h"
 
 
-/* You can find some mysterious functions commented out here. I planned to use
- * them for various smart things (well they all report to
- * merge_css_stylesheets()), but it turns out it makes no sense to merge
- * stylesheets now (and maybe it won't in the future neither...). But maybe you
- * will find them useful at some time, so... Dunno. --pasky */
+/** Hash the key that find_css_selector() looks selectors up by.  Names
+ * differing only in the case of ASCII letters get the same hash. */
+static unsigned int
+hash_css_selector(enum css_selector_type type,
+		  enum css_selector_relation rel,
+		  const unsigned char *name, int namelen)
+{
+	/* FNV-1a */
+	unsigned int hash = 2166136261U ^ (type * 4 + rel);
+
+	if (namelen < 0)
+		namelen = strlen(name);
 
+	for (; namelen > 0; name++, namelen--) {
+		hash ^= c_tolower(*name);
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
 
 struct css_selector *
 find_css_selector(struct css_selector_set *sels,
@@ -35,6 +50,24 @@ find_css_selector(struct css_selector_set *sels,
 
 	assert(sels && name);
 
+	if (sels->index) {
+		unsigned int hash = hash_css_selector(type, rel, name, namelen);
+		unsigned int slot = hash & ((1 << sels->index_width) - 1);
+
+		for (selector = sels->index[slot]; selector;
+		     selector = selector->index_next) {
+			if (hash != selector->hash
+			    || type != selector->type
+			    || rel != selector->relation)
+				continue;
+			if (c_strlcasecmp(name, namelen, selector->name, -1))
+				continue;
+			return selector;
+		}
+
+		return NULL;
+	}
+
 	foreach_css_selector (selector, sels) {
 		if (type != selector->type || rel != selector->relation)
 			continue;
@@ -110,22 +143,6 @@ get_css_selector(struct css_selector_set *sels,
 	return init_css_selector(sels, type, rel, name, namelen);
 }
 
-static struct css_selector *
-copy_css_selector(struct css_stylesheet *css, struct css_selector *orig)
-{
-	struct css_selector *copy;
-
-	assert(css && orig);
-	assert(orig->relation == CSR_ROOT);
-
-	copy = init_css_selector(&css->selectors, orig->type, CSR_ROOT,
-	                         orig->name, strlen(orig->name));
-	if (!copy)
-		return NULL;
-
-	return copy;
-}
-
 static void
 add_selector_property(struct css_selector *selector, struct css_property *prop)
 {
@@ -148,18 +165,30 @@ add_selector_properties(struct css_selector *selector,
 	}
 }
 
-static struct css_selector *
-clone_css_selector(struct css_stylesheet *css, struct css_selector *orig)
+void
+copy_css_selector_properties(struct css_selector *to,
+			     struct css_selector *from)
+{
+	struct css_property *prop;
+
+	foreachback (prop, from->properties)
+		add_selector_property(to, prop);
+}
+
+static void
+merge_css_property(struct css_selector *selector, struct css_property *prop)
 {
-	struct css_selector *copy;
+	struct css_property *origprop;
 
-	assert(css && orig);
+	foreach (origprop, selector->properties)
+		if (origprop->type == prop->type) {
+			del_from_list(origprop);
+			mem_free(origprop);
+			break;
+		}
 
-	copy = copy_css_selector(css, orig);
-	if (!copy)
-		return NULL;
-	add_selector_properties(copy, &orig->properties);
-	return copy;
+	/* Not there yet, let's add it. */
+	add_selector_property(selector, prop);
 }
 
 void
@@ -168,17 +197,41 @@ merge_css_selectors(struct css_selector *sel1, struct css_selector *sel2)
 	struct css_property *prop;
 
 	foreach (prop, sel2->properties) {
-		struct css_property *origprop;
+		merge_css_property(sel1, prop);
+	}
+}
+
+void
+merge_css_layer_selector(struct css_selector *sel1, struct css_selector *sel2)
+{
+	struct css_property *prop;
+
+	foreachback (prop, sel2->properties) {
+		merge_css_property(sel1, prop);
+	}
+}
+
+void
+merge_css_selector_set(struct css_selector_set *sels,
+		       struct css_selector_set *from)
+{
+	struct css_selector *orig;
+
+	foreach_css_selector (orig, from) {
+		struct css_selector *selector;
+		struct css_property *prop;
+
+		selector = get_css_selector(sels, orig->type, orig->relation,
+					    orig->name, strlen(orig->name));
+		if (!selector) continue;
 
-		foreach (origprop, sel1->properties)
-			if (origprop->type == prop->type) {
-				del_from_list(origprop);
-				mem_free(origprop);
-				break;
-			}
+		/* The parser adds each property to the front of the list,
+		 * so put the copies in front of the older ones, keeping
+		 * their order. */
+		foreachback (prop, orig->properties)
+			add_selector_property(selector, prop);
 
-		/* Not there yet, let's add it. */
-		add_selector_property(sel1, prop);
+		merge_css_selector_set(&selector->leaves, &orig->leaves);
 	}
 }
 
@@ -198,6 +251,9 @@ void
 init_css_selector_set(struct css_selector_set *set)
 {
 	set->may_contain_rel_ancestor_or_parent = 0;
+	set->count = 0;
+	set->index = NULL;
+	set->index_width = 0;
 	init_list(set->list);
 }
 
@@ -207,6 +263,35 @@ done_css_selector_set(struct css_selector_set *set)
 	while (!css_selector_set_empty(set)) {
 		done_css_selector(css_selector_set_front(set));
 	}
+
+	mem_free_if(set->index);
+	init_css_selector_set(set);
+}
+
+/** Chain the selectors of @a set in 2^@a width new slots.  On failure,
+ * the old index, if any, stays and 0 is returned. */
+static int
+index_css_selector_set(struct css_selector_set *set, unsigned int width)
+{
+	struct css_selector **index = mem_calloc(1 << width, sizeof(*index));
+	struct css_selector *selector;
+
+	if (!index) return 0;
+
+	mem_free_if(set->index);
+	set->index = index;
+	set->index_width = width;
+
+	/* Each slot chains its selectors in the order of the list, so
+	 * that find_css_selector() finds the same one either way. */
+	foreachback (selector, set->list) {
+		unsigned int slot = selector->hash & ((1 << width) - 1);
+
+		selector->index_next = index[slot];
+		index[slot] = selector;
+	}
+
+	return 1;
 }
 
 void
@@ -216,6 +301,28 @@ add_css_selector_to_set(struct css_selector *selector,
 	assert(!css_selector_is_in_set(selector));
 
 	add_to_list(set->list, selector);
+	selector->set = set;
+	selector->hash = hash_css_selector(selector->type, selector->relation,
+					   selector->name ? selector->name
+					   : (unsigned char *) "", -1);
+
+	set->count++;
+	if (set->count < CSS_SELECTOR_INDEX_MIN
+	    || (set->index && set->count <= 1 << set->index_width)
+	    || !index_css_selector_set(set, set->index
+					    ? set->index_width + 1
+					    : CSS_SELECTOR_INDEX_WIDTH)) {
+		/* No new index chained the selector, so chain it in
+		 * the old one, if any. */
+		if (set->index) {
+			unsigned int slot = selector->hash
+					    & ((1 << set->index_width) - 1);
+
+			selector->index_next = set->index[slot];
+			set->index[slot] = selector;
+		}
+	}
+
 	if (selector->relation == CSR_ANCESTOR
 	    || selector->relation == CSR_PARENT)
 		set->may_contain_rel_ancestor_or_parent = 1;
@@ -224,9 +331,26 @@ add_css_selector_to_set(struct css_selector *selector,
 void
 del_css_selector_from_set(struct css_selector *selector)
 {
+	struct css_selector_set *set = selector->set;
+
 	del_from_list(selector);
 	selector->next = NULL;
 	selector->prev = NULL;
+	selector->set = NULL;
+
+	if (!set) return;
+
+	set->count--;
+	if (set->index) {
+		struct css_selector **slot;
+
+		slot = &set->index[selector->hash
+				   & ((1 << set->index_width) - 1)];
+		while (*slot != selector)
+			slot = &(*slot)->index_next;
+		*slot = selector->index_next;
+	}
+	selector->index_next = NULL;
 }
 
 #ifdef DEBUG_CSS
@@ -257,71 +381,53 @@ dump_css_selector_tree(struct css_selector_set *sels)
 #endif
 
 
-#if 0 /* used only by clone_css_stylesheet */
-struct css_stylesheet *
-init_css_stylesheet(css_stylesheet_importer_T importer, void *import_data)
+static int
+copy_css_selector_set(struct css_selector_set *sels,
+		      struct css_selector_set *from)
 {
-	struct css_stylesheet *css;
+	struct css_selector *orig;
 
-	css = mem_calloc(1, sizeof(*css));
-	if (!css)
-		return NULL;
-	css->import = importer;
-	css->import_data = import_data;
-	init_css_selector_set(&css->selectors);
-	return css;
-}
-#endif
+	foreach_css_selector (orig, from) {
+		struct css_selector *copy;
+		struct css_property *prop;
 
-void
-mirror_css_stylesheet(struct css_stylesheet *css1, struct css_stylesheet *css2)
-{
-	struct css_selector *selector;
+		copy = init_css_selector(sels, orig->type, orig->relation,
+					 orig->name, -1);
+		if (!copy) return 0;
 
-	foreach_css_selector (selector, &css1->selectors) {
-		clone_css_selector(css2, selector);
-	}
-}
+		foreachback (prop, orig->properties)
+			add_selector_property(copy, prop);
 
-#if 0
-struct css_stylesheet *
-clone_css_stylesheet(struct css_stylesheet *orig)
-{
-	struct css_stylesheet *copy;
-	struct css_selector *selector;
+		if (!copy_css_selector_set(&copy->leaves, &orig->leaves))
+			return 0;
+	}
 
-	copy = init_css_stylesheet(orig->import, orig->import_data);
-	if (!copy)
-		return NULL;
-	mirror_css_stylesheet(orig, copy);
-	return copy;
+	return 1;
 }
 
 void
-merge_css_stylesheets(struct css_stylesheet *css1,
-		      struct css_stylesheet *css2)
+pack_css_stylesheet(struct css_stylesheet *css)
 {
-	struct css_selector *selector;
+	struct css_selector_set packed;
 
-	assert(css1 && css2);
+	init_css_selector_set(&packed);
+	if (!copy_css_selector_set(&packed, &css->selectors)) {
+		done_css_selector_set(&packed);
+		return;
+	}
 
-	/* This is 100% evil. And gonna be a huge bottleneck. Essentially
-	 * O(N^2) where we could be much smarter (ie. sort it once and then
-	 * always be O(N)). */
+	done_css_selector_set(&css->selectors);
 
-	foreach_css_selector (selector, &css2->selectors) {
-		struct css_selector *origsel;
+	/* Move the copies over from the back, so that they stay in the
+	 * order of the rules. */
+	while (!css_selector_set_empty(&packed)) {
+		struct css_selector *selector = packed.list.prev;
 
-		origsel = find_css_selector(&css1->selectors, selector->name,
-					    strlen(selector->name));
-		if (!origsel) {
-			clone_css_selector(css1, selector);
-		} else {
-			merge_css_selectors(origsel, selector);
-		}
+		del_css_selector_from_set(selector);
+		add_css_selector_to_set(selector, &css->selectors);
 	}
+	done_css_selector_set(&packed);
 }
-#endif
 
 void
 done_css_stylesheet(struct css_stylesheet *css)
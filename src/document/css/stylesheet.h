@@ -48,21 +48,25 @@
 struct css_selector_set {
 	unsigned char may_contain_rel_ancestor_or_parent;
 
+	/** The number of selectors in #list. */
+	int count;
+
+	/** Once the set has CSS_SELECTOR_INDEX_MIN selectors, they are
+	 * also chained in these slots by css_selector.hash, so that
+	 * find_css_selector() need not go through the whole list.
+	 * There are 2^#index_width slots.  Small sets are searched
+	 * linearly, which is as fast as hashing: see ELinks bug 789.  */
+	struct css_selector **index;
+	unsigned int index_width;
+
 	/** The list of selectors in this set.
-	 *
-	 * Sets are currently represented as lists that
-	 * find_css_selector() then has to search linearly.
-	 * Hashing was also tested but did not help in practice:
-	 * each find_css_selector() call runs approximately one
-	 * strcasecmp(), and a hash function is unlikely to be
-	 * faster than that.  See ELinks bug 789 for details.
 	 *
 	 * Keep this away from the beginning of the structure,
 	 * so that nobody can cast the struct css_selector_set *
 	 * to LIST_OF(struct css_selector) * and get away with it.  */
 	LIST_OF(struct css_selector) list;
 };
-#define INIT_CSS_SELECTOR_SET(set) { 0, { D_LIST_HEAD(set.list) } }
+#define INIT_CSS_SELECTOR_SET(set) { 0, 0, NULL, 0, { D_LIST_HEAD(set.list) } }
 
 enum css_selector_relation {
 	CSR_ROOT, /**< First class stylesheet member. */
@@ -94,6 +98,14 @@ struct css_selector {
 	enum css_selector_type type;
 	unsigned char *name;
 
+	/** hash_css_selector() of the type, relation and name. */
+	unsigned int hash;
+
+	/** The set the selector is in, if any, and the next selector in
+	 * the same slot of its css_selector_set.index. */
+	struct css_selector_set *set;
+	struct css_selector *index_next;
+
 	LIST_OF(struct css_property) properties;
 };
 
@@ -103,9 +115,9 @@ typedef void (*css_stylesheet_importer_T)(struct css_stylesheet *, struct uri *,
 					  const unsigned char *url, int urllen);
 
 /** The struct css_stylesheet describes all the useful data that was extracted
- * from the CSS source. Currently we don't cache anything but the default user
- * stylesheet so it can contain stuff from both @<style> tags and @@import'ed
- * CSS documents. */
+ * from the CSS source. The stylesheet of a document can contain stuff from
+ * both @<style> tags and @@import'ed CSS documents, and has the default user
+ * stylesheet as its #layer. */
 struct css_stylesheet {
 	/** The import callback function.  The caller must check the
 	 * media types first.  */
@@ -120,19 +132,22 @@ struct css_stylesheet {
 
 	/** How deeply nested are we. Limited by MAX_REDIRECTS. */
 	int import_level;
+
+	/** A stylesheet shared with others, which must not be changed
+	 * through this one.  Its basic element selectors apply along
+	 * with the ones of the same name in #selectors, after them, but
+	 * their leaves are ignored. */
+	struct css_stylesheet *layer;
 };
 
 #define INIT_CSS_STYLESHEET(css, import) \
 	{ import, NULL, INIT_CSS_SELECTOR_SET(css.selectors) }
 
-/** Dynamically allocates a stylesheet. */
-struct css_stylesheet *init_css_stylesheet(css_stylesheet_importer_T importer,
-                                           void *import_data);
-
-/** Mirror given CSS stylesheet @a css1 to an identical copy of itself
- * (including all the selectors), @a css2. */
-void mirror_css_stylesheet(struct css_stylesheet *css1,
-			   struct css_stylesheet *css2);
+/** Copy the selectors of @a css to new memory, close to each other, in
+ * the order of the rules they came from, and free the old ones.  This
+ * makes looking them up faster in a stylesheet that was parsed once and
+ * is searched for every element of every document. */
+void pack_css_stylesheet(struct css_stylesheet *css);
 
 /** Releases all the content of the stylesheet (but not the stylesheet
  * itself). */
@@ -174,6 +189,23 @@ void add_selector_properties(struct css_selector *selector,
 /** Join @a sel2 to @a sel1, @a sel1 taking precedence in all conflicts. */
 void merge_css_selectors(struct css_selector *sel1, struct css_selector *sel2);
 
+/** Add copies of the properties of @a from in front of those of @a to,
+ * keeping their order. */
+void copy_css_selector_properties(struct css_selector *to,
+				  struct css_selector *from);
+
+/** Join @a sel2, a basic element selector of a css_stylesheet.layer, to
+ * @a sel1 the way merge_css_selectors() would if @a sel2 had been copied
+ * into the stylesheet before any other rules were added to it. */
+void merge_css_layer_selector(struct css_selector *sel1,
+			      struct css_selector *sel2);
+
+/** Add the selectors of @a from and their leaves to @a sels, along with
+ * their properties, the same way parsing the rules they came from into
+ * the stylesheet of @a sels would have done.  @a from is left as is. */
+void merge_css_selector_set(struct css_selector_set *sels,
+			    struct css_selector_set *from);
+
 /** Use this function instead of modifying css_selector.relation directly.  */
 void set_css_selector_relation(struct css_selector *,
 			       enum css_selector_relation);
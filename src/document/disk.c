@@ -0,0 +1,969 @@
+/* Formatted documents in the disk cache */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h> /* OS/2 needs this after sys/types.h */
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include "elinks.h"
+
+#include "bfu/listmenu.h"
+#include "bfu/menu.h"
+#include "cache/cache.h"
+#include "cache/disk.h"
+#include "config/options.h"
+#include "config/opttypes.h"
+#include "document/disk.h"
+#include "document/document.h"
+#include "document/forms.h"
+#include "document/options.h"
+#include "document/renderer.h"
+#include "protocol/uri.h"
+#include "terminal/draw.h"
+#include "util/conv.h"
+#include "util/lists.h"
+#include "util/md5.h"
+#include "util/memory.h"
+#include "util/string.h"
+
+
+/* A formatted document is kept in the disk cache directory next to the
+ * cache entries and shares their size limit. The file is named after the
+ * MD5 of the URI and the digest of the options it was formatted with, so
+ * there is one file for each way the document is displayed. It consists
+ * of a text header:
+ *
+ *	ELinks formatted document 1\n
+ *	URI: <uri>\n
+ *	Build: <version> <size of screen_char> <size of document_options>\n
+ *	Options: <MD5 of the options>\n
+ *	Content: <MD5 of the cache entry>\n
+ *	\n
+ *
+ * followed by the document itself in the binary format written by
+ * put_document(). That format depends on the build, hence the Build line.
+ *
+ * The process specific cache_id cannot tell whether the file is still
+ * valid in later sessions, so the content of the cache entry is digested
+ * instead. That works also for documents with no ETag, like local files. */
+
+#define DISK_DOCUMENT_MAGIC	"ELinks formatted document 1"
+
+/* The document trees of options which are not in struct document_options
+ * but are looked up while formatting. */
+static const unsigned char *disk_document_option_trees[] = {
+	"document.browse",
+	"document.codepage",
+	"document.colors",
+	"document.css",
+	"document.html",
+	"document.plain",
+	NULL,
+};
+
+/* The select menus of form controls are stored as the calls of
+ * new_menu_item() that build them again. */
+enum disk_menu_op {
+	DISK_MENU_ITEM,
+	DISK_MENU_SUBMENU,
+	DISK_MENU_UP,
+	DISK_MENU_END,
+};
+
+
+static int
+get_disk_document_enable(struct cache_entry *cached,
+			 struct document_options *options)
+{
+	return get_opt_bool("document.cache.format.disk", NULL)
+		&& get_disk_cache_enable()
+		&& !options->no_cache
+		&& !cached->incomplete
+		&& !cached->uri->post
+		&& !cached->no_store
+		&& cached->cache_mode != CACHE_MODE_NEVER;
+}
+
+static void
+digest_option_tree(MD5_CTX *context, LIST_OF(struct option) *tree)
+{
+	struct option *option;
+	struct string value;
+
+	foreach (option, *tree) {
+		MD5_Update(context, option->name, strlen(option->name) + 1);
+
+		if (option->type == OPT_TREE) {
+			digest_option_tree(context, option->value.tree);
+			continue;
+		}
+
+		if (option->type == OPT_ALIAS
+		    || !option_types[option->type].write
+		    || !init_string(&value))
+			continue;
+
+		option_types[option->type].write(option, &value);
+		MD5_Update(context, value.source, value.length + 1);
+		done_string(&value);
+	}
+}
+
+/* Everything compare_opt() looks at except the size of the box, which is
+ * only compared if the formatted document says so. */
+static void
+digest_document_options(struct document_options *options,
+			 md5_digest_bin_T digest)
+{
+	MD5_CTX context;
+	int i;
+
+	MD5_Init(&context);
+	MD5_Update(&context, (unsigned char *) options,
+		   offsetof(struct document_options, framename));
+
+	if (options->framename) {
+		unsigned char *name = options->framename;
+
+		for (; *name; name++) {
+			unsigned char c = c_tolower(*name);
+
+			MD5_Update(&context, &c, 1);
+		}
+	}
+
+	MD5_Update(&context, (unsigned char *) &options->box.x,
+		   sizeof(options->box.x));
+	MD5_Update(&context, (unsigned char *) &options->box.y,
+		   sizeof(options->box.y));
+
+	for (i = 0; disk_document_option_trees[i]; i++) {
+		struct option *tree;
+
+		tree = get_opt_rec_real(config_options,
+					disk_document_option_trees[i]);
+		if (tree && tree->type == OPT_TREE)
+			digest_option_tree(&context, tree->value.tree);
+	}
+
+	MD5_Final(digest, &context);
+}
+
+/* Digest what the document is formatted from. The digest of the last
+ * entry is remembered since the cache_id changes with every change of
+ * the content. */
+static void
+digest_cache_entry(struct cache_entry *cached, md5_digest_bin_T digest)
+{
+	static unsigned int last_cache_id;
+	static md5_digest_bin_T last_digest;
+	struct fragment *fragment;
+	MD5_CTX context;
+
+	if (last_cache_id && last_cache_id == cached->cache_id) {
+		memcpy(digest, last_digest, sizeof(last_digest));
+		return;
+	}
+
+	MD5_Init(&context);
+	if (cached->head)
+		MD5_Update(&context, cached->head, strlen(cached->head));
+	MD5_Update(&context, (unsigned char *) "", 1);
+	if (cached->content_type)
+		MD5_Update(&context, cached->content_type,
+			   strlen(cached->content_type));
+	MD5_Update(&context, (unsigned char *) "", 1);
+	foreach_cache_fragment (fragment, cached)
+		MD5_Update(&context, fragment->data, fragment->length);
+	MD5_Final(digest, &context);
+
+	last_cache_id = cached->cache_id;
+	memcpy(last_digest, digest, sizeof(last_digest));
+}
+
+static void
+add_digest_to_string(struct string *string, md5_digest_bin_T digest)
+{
+	int i;
+
+	for (i = 0; i < MD5_DIGEST_LENGTH; i++) {
+		add_char_to_string(string, hx(digest[i] >> 4));
+		add_char_to_string(string, hx(digest[i] & 0xF));
+	}
+}
+
+/* Get the name of the file and the header it has to start with. */
+static int
+get_disk_document_header(struct cache_entry *cached,
+			 struct document_options *options,
+			 unsigned char *name, struct string *header)
+{
+	md5_digest_bin_T options_digest, content_digest, name_digest;
+	MD5_CTX context;
+
+	if (!init_string(header)) return 0;
+
+	digest_document_options(options, options_digest);
+	digest_cache_entry(cached, content_digest);
+
+	add_format_to_string(header, "%s\n", DISK_DOCUMENT_MAGIC);
+	add_format_to_string(header, "URI: %s\n", struri(cached->uri));
+	add_format_to_string(header, "Build: %s %d %d\n", VERSION_STRING,
+			     (int) sizeof(struct screen_char),
+			     (int) sizeof(struct document_options));
+	add_to_string(header, "Options: ");
+	add_digest_to_string(header, options_digest);
+	add_to_string(header, "\nContent: ");
+	add_digest_to_string(header, content_digest);
+	add_to_string(header, "\n\n");
+
+	MD5_Init(&context);
+	MD5_Update(&context, struri(cached->uri), strlen(struri(cached->uri)) + 1);
+	MD5_Update(&context, options_digest, sizeof(options_digest));
+	MD5_Final(name_digest, &context);
+	get_disk_cache_digest_name(name_digest, name);
+
+	return 1;
+}
+
+
+#define put_int(string, value) \
+	do { \
+		int value_ = (value); \
+ \
+		add_bytes_to_string(string, (unsigned char *) &value_, \
+				    sizeof(value_)); \
+	} while (0)
+
+static void
+put_bytes(struct string *string, void *data, int length)
+{
+	if (length > 0)
+		add_bytes_to_string(string, (unsigned char *) data, length);
+}
+
+static void
+put_str(struct string *string, unsigned char *str)
+{
+	int length = str ? strlen(str) : -1;
+
+	put_int(string, length);
+	if (str) put_bytes(string, str, length);
+}
+
+static void
+put_menu(struct string *string, struct menu_item *menu)
+{
+	struct menu_item *item;
+
+	foreach_menu_item (item, menu) {
+		if (item->func == do_select_submenu) {
+			put_int(string, DISK_MENU_SUBMENU);
+			put_str(string, item->text);
+			put_menu(string, item->data);
+			put_int(string, DISK_MENU_UP);
+			continue;
+		}
+
+		put_int(string, DISK_MENU_ITEM);
+		put_str(string, item->text);
+		put_int(string, (long) item->data);
+		put_int(string, !!(item->flags & MENU_FULLNAME));
+	}
+}
+
+static void
+put_form_control(struct string *string, struct form_control *fc)
+{
+	int i;
+
+	put_int(string, fc->g_ctrl_num);
+	put_int(string, fc->position);
+	put_int(string, fc->type);
+	put_int(string, fc->mode);
+	put_str(string, fc->id);
+	put_str(string, fc->name);
+	put_str(string, fc->alt);
+	put_str(string, fc->default_value);
+	put_int(string, fc->default_state);
+	put_int(string, fc->size);
+	put_int(string, fc->cols);
+	put_int(string, fc->rows);
+	put_int(string, fc->wrap);
+	put_int(string, fc->maxlength);
+
+	put_int(string, fc->values ? fc->nvalues : 0);
+	for (i = 0; fc->values && i < fc->nvalues; i++) {
+		put_str(string, fc->values[i]);
+		put_str(string, fc->labels ? fc->labels[i] : NULL);
+	}
+
+	put_int(string, !!fc->menu);
+	if (fc->menu) {
+		put_menu(string, fc->menu);
+		put_int(string, DISK_MENU_END);
+	}
+}
+
+static int
+get_form_control_index(struct document *document, struct form_control *fc)
+{
+	struct form *form;
+	int index = 0;
+
+	foreach (form, document->forms) {
+		struct form_control *item;
+
+		foreach (item, form->items) {
+			if (item == fc) return index;
+			index++;
+		}
+	}
+
+	return -1;
+}
+
+static void
+put_link(struct string *string, struct document *document, struct link *link)
+{
+	struct script_event_hook *evhook;
+
+	put_int(string, link->type);
+	put_bytes(string, &link->accesskey, sizeof(link->accesskey));
+	put_str(string, link->where);
+	put_str(string, link->target);
+	put_str(string, link->where_img);
+	put_str(string, link->title);
+	put_int(string, link->npoints);
+	put_bytes(string, link->points, link->npoints * sizeof(*link->points));
+	put_int(string, link->number);
+	put_bytes(string, &link->color, sizeof(link->color));
+
+	put_int(string, link->event_hooks ? list_size(link->event_hooks) : 0);
+	if (link->event_hooks) {
+		foreach (evhook, *link->event_hooks) {
+			put_int(string, evhook->type);
+			put_str(string, evhook->src);
+		}
+	}
+
+	if (link_is_form(link)) {
+		put_int(string, get_form_control_index(document,
+						       link->data.form_control));
+	} else {
+		put_str(string, link->data.name);
+	}
+}
+
+static void
+put_document(struct string *string, struct document *document)
+{
+	struct form *form;
+	struct tag *tag;
+	struct node *node;
+	int i;
+
+	put_int(string, document->options.needs_width);
+	put_int(string, document->options.needs_height);
+	put_int(string, document->options.box.width);
+	put_int(string, document->options.box.height);
+
+	put_int(string, document->width);
+	put_int(string, document->cp);
+	put_int(string, document->cp_status);
+	put_bytes(string, &document->color.background,
+		  sizeof(document->color.background));
+	put_str(string, document->title);
+
+	put_int(string, document->height);
+	for (i = 0; i < document->height; i++) {
+		struct line *line = &document->data[i];
+
+		put_int(string, line->length);
+		put_bytes(string, line->chars, line->length * sizeof(*line->chars));
+	}
+
+	put_int(string, list_size(&document->tags));
+	foreach (tag, document->tags) {
+		put_int(string, tag->x);
+		put_int(string, tag->y);
+		put_str(string, tag->name);
+	}
+
+	/* The nodes tell what to index for searching. The index itself is
+	 * built from them when first needed. */
+	put_int(string, list_size(&document->nodes));
+	foreach (node, document->nodes)
+		put_bytes(string, &node->box, sizeof(node->box));
+
+	put_int(string, list_size(&document->forms));
+	foreach (form, document->forms) {
+		struct form_control *fc;
+
+		put_int(string, form->form_num);
+		put_int(string, form->form_end);
+		put_str(string, form->action);
+		put_str(string, form->name);
+		put_str(string, form->onsubmit);
+		put_str(string, form->target);
+		put_int(string, form->method);
+
+		put_int(string, list_size(&form->items));
+		foreach (fc, form->items)
+			put_form_control(string, fc);
+	}
+
+	put_int(string, document->nlinks);
+	for (i = 0; i < document->nlinks; i++)
+		put_link(string, document, &document->links[i]);
+}
+
+/* Whether everything that matters for displaying @document is kept by
+ * put_document(). The frames, refreshes and scripts need more than what is
+ * rendered, and the CSS imports are other cache entries.  The lines of
+ * indexed plain text documents are mostly not rendered at all, and
+ * indexing them again is cheap anyway. */
+static int
+is_disk_document_complete(struct document *document)
+{
+	return !document->checkpoint
+		&& !document->plain_index
+		&& !document->frame_desc
+		&& !document->refresh
+#ifdef CONFIG_CSS
+		&& !document->css_imports.size
+#endif
+#ifdef CONFIG_ECMASCRIPT
+		&& list_empty(document->onload_snippets)
+		&& !document->ecmascript_imports.size
+#endif
+		;
+}
+
+static int
+write_disk_document(FILE *file, void *data)
+{
+	struct string *string = data;
+
+	fwrite(string->source, 1, string->length, file);
+
+	return ferror(file) ? -1 : 0;
+}
+
+void
+save_disk_document(struct document *document)
+{
+	unsigned char name[DISK_CACHE_NAME_LENGTH + 1];
+	struct cache_entry *cached = document->cached;
+	struct string string;
+
+	if (!get_disk_document_enable(cached, &document->options)
+	    || cached->cache_id != document->cache_id
+	    || !is_disk_document_complete(document)
+	    || !get_disk_document_header(cached, &document->options, name,
+					 &string))
+		return;
+
+	put_document(&string, document);
+
+	save_disk_cache_file(name, string.length, write_disk_document, &string);
+	done_string(&string);
+}
+
+
+/* Reads the binary part of the file. Reading past the end or running out of
+ * memory sets @error and everything read afterwards is zero or NULL. */
+struct disk_document_reader {
+	unsigned char *pos;
+	unsigned char *end;
+	int error;
+};
+
+static void
+get_bytes(struct disk_document_reader *reader, void *data, int length)
+{
+	if (reader->error || length < 0 || length > reader->end - reader->pos) {
+		reader->error = 1;
+		memset(data, 0, length > 0 ? length : 0);
+		return;
+	}
+
+	memcpy(data, reader->pos, length);
+	reader->pos += length;
+}
+
+static int
+get_int(struct disk_document_reader *reader)
+{
+	int value;
+
+	get_bytes(reader, &value, sizeof(value));
+
+	return value;
+}
+
+/* Read the number of the following records which take at least @size bytes
+ * each, so garbage files cannot make us allocate much. */
+static int
+get_count(struct disk_document_reader *reader, int size)
+{
+	int count = get_int(reader);
+
+	if (count < 0 || count > (reader->end - reader->pos) / size) {
+		reader->error = 1;
+		return 0;
+	}
+
+	return count;
+}
+
+static unsigned char *
+get_str(struct disk_document_reader *reader)
+{
+	int length = get_int(reader);
+	unsigned char *str;
+
+	if (reader->error || length == -1) return NULL;
+
+	if (length < 0 || length > reader->end - reader->pos) {
+		reader->error = 1;
+		return NULL;
+	}
+
+	str = memacpy(reader->pos, length);
+	if (!str) reader->error = 1;
+	reader->pos += length;
+
+	return str;
+}
+
+/* Read an array of @count items of @size bytes. */
+static void *
+get_array(struct disk_document_reader *reader, int count, int size)
+{
+	void *array;
+
+	if (reader->error || count <= 0) return NULL;
+
+	if (count > (reader->end - reader->pos) / size) {
+		reader->error = 1;
+		return NULL;
+	}
+
+	array = mem_alloc(count * size);
+	if (!array) {
+		reader->error = 1;
+		return NULL;
+	}
+
+	get_bytes(reader, array, count * size);
+
+	return array;
+}
+
+static struct menu_item *
+get_menu(struct disk_document_reader *reader)
+{
+	struct list_menu menu;
+	int depth = 0;
+
+	init_menu(&menu);
+
+	while (!reader->error) {
+		enum disk_menu_op op = get_int(reader);
+		unsigned char *text;
+		int data, fullname;
+
+		switch (op) {
+		case DISK_MENU_ITEM:
+			text = get_str(reader);
+			data = get_int(reader);
+			fullname = get_int(reader);
+			if (!text || data < 0) {
+				mem_free_if(text);
+				reader->error = 1;
+				break;
+			}
+			new_menu_item(&menu, text, data, fullname);
+			break;
+
+		case DISK_MENU_SUBMENU:
+			text = get_str(reader);
+			if (!text) {
+				reader->error = 1;
+				break;
+			}
+			new_menu_item(&menu, text, -1, 0);
+			depth++;
+			break;
+
+		case DISK_MENU_UP:
+			if (!depth--) {
+				reader->error = 1;
+				break;
+			}
+			new_menu_item(&menu, NULL, 0, 0);
+			break;
+
+		case DISK_MENU_END:
+			if (depth) {
+				reader->error = 1;
+				break;
+			}
+			return detach_menu(&menu);
+
+		default:
+			reader->error = 1;
+		}
+	}
+
+	destroy_menu(&menu);
+	return NULL;
+}
+
+static struct form_control *
+get_form_control(struct disk_document_reader *reader, struct form *form)
+{
+	struct form_control *fc = mem_calloc(1, sizeof(*fc));
+	int nvalues, i;
+
+	if (!fc) {
+		reader->error = 1;
+		return NULL;
+	}
+
+	fc->form = form;
+	add_to_list_end(form->items, fc);
+
+	fc->g_ctrl_num = get_int(reader);
+	fc->position = get_int(reader);
+	fc->type = get_int(reader);
+	fc->mode = get_int(reader);
+	fc->id = get_str(reader);
+	fc->name = get_str(reader);
+	fc->alt = get_str(reader);
+	fc->default_value = get_str(reader);
+	fc->default_state = get_int(reader);
+	fc->size = get_int(reader);
+	fc->cols = get_int(reader);
+	fc->rows = get_int(reader);
+	fc->wrap = get_int(reader);
+	fc->maxlength = get_int(reader);
+
+	if (fc->type < FC_TEXT || fc->type > FC_HIDDEN)
+		reader->error = 1;
+
+	nvalues = get_count(reader, 2 * sizeof(int));
+	if (nvalues) {
+		fc->values = mem_calloc(nvalues, sizeof(*fc->values));
+		fc->labels = mem_calloc(nvalues, sizeof(*fc->labels));
+		if (!fc->values || !fc->labels) {
+			reader->error = 1;
+			return fc;
+		}
+		fc->nvalues = nvalues;
+	}
+
+	for (i = 0; i < nvalues && !reader->error; i++) {
+		fc->values[i] = get_str(reader);
+		fc->labels[i] = get_str(reader);
+	}
+
+	if (get_int(reader))
+		fc->menu = get_menu(reader);
+
+	return fc;
+}
+
+static void
+get_link(struct disk_document_reader *reader, struct link *link,
+	 struct form_control **controls, int ncontrols)
+{
+	int count;
+
+	link->type = get_int(reader);
+	if (link->type < LINK_HYPERTEXT || link->type > LINK_AREA) {
+		/* Do not let done_link_members() free garbage. */
+		link->type = LINK_HYPERTEXT;
+		reader->error = 1;
+		return;
+	}
+
+	get_bytes(reader, &link->accesskey, sizeof(link->accesskey));
+	link->where = get_str(reader);
+	link->target = get_str(reader);
+	link->where_img = get_str(reader);
+	link->title = get_str(reader);
+	link->npoints = get_count(reader, sizeof(*link->points));
+	link->points = get_array(reader, link->npoints, sizeof(*link->points));
+	if (!link->points) link->npoints = 0;
+	link->number = get_int(reader);
+	get_bytes(reader, &link->color, sizeof(link->color));
+
+	count = get_count(reader, 2 * sizeof(int));
+	if (count) {
+		link->event_hooks = mem_alloc(sizeof(*link->event_hooks));
+		if (!link->event_hooks) {
+			reader->error = 1;
+			return;
+		}
+		init_list(*link->event_hooks);
+	}
+
+	for (; count > 0 && !reader->error; count--) {
+		struct script_event_hook *evhook = mem_calloc(1, sizeof(*evhook));
+
+		if (!evhook) {
+			reader->error = 1;
+			return;
+		}
+
+		evhook->type = get_int(reader);
+		evhook->src = get_str(reader);
+		add_to_list_end(*link->event_hooks, evhook);
+	}
+
+	if (link_is_form(link)) {
+		int index = get_int(reader);
+
+		if (index >= 0 && index < ncontrols)
+			link->data.form_control = controls[index];
+		else
+			reader->error = 1;
+	} else {
+		link->data.name = get_str(reader);
+	}
+}
+
+static void
+get_document(struct disk_document_reader *reader, struct document *document)
+{
+	struct form_control **controls = NULL;
+	int ncontrols = 0;
+	int count, i;
+
+	document->width = get_int(reader);
+	document->cp = get_int(reader);
+	document->cp_status = get_int(reader);
+	get_bytes(reader, &document->color.background,
+		  sizeof(document->color.background));
+	document->title = get_str(reader);
+
+	count = get_count(reader, sizeof(int));
+	if (count) {
+		document->data = mem_calloc(count, sizeof(*document->data));
+		if (!document->data) {
+			reader->error = 1;
+			return;
+		}
+		document->height = count;
+	}
+
+	for (i = 0; i < document->height && !reader->error; i++) {
+		struct line *line = &document->data[i];
+
+		line->length = get_count(reader, sizeof(*line->chars));
+		line->chars = get_array(reader, line->length, sizeof(*line->chars));
+		if (!line->chars) line->length = 0;
+	}
+
+	count = get_count(reader, 3 * sizeof(int));
+	for (; count > 0 && !reader->error; count--) {
+		int x = get_int(reader);
+		int y = get_int(reader);
+		unsigned char *name = get_str(reader);
+		struct tag *tag;
+
+		if (!name) {
+			reader->error = 1;
+			break;
+		}
+
+		tag = mem_alloc(sizeof(*tag) + strlen(name));
+		if (!tag) {
+			mem_free(name);
+			reader->error = 1;
+			break;
+		}
+
+		tag->x = x;
+		tag->y = y;
+		strcpy(tag->name, name);
+		mem_free(name);
+		add_to_list_end(document->tags, tag);
+	}
+
+	count = get_count(reader, sizeof(struct box));
+	for (; count > 0 && !reader->error; count--) {
+		struct node *node = mem_alloc(sizeof(*node));
+
+		if (!node) {
+			reader->error = 1;
+			break;
+		}
+
+		get_bytes(reader, &node->box, sizeof(node->box));
+		add_to_list_end(document->nodes, node);
+	}
+
+	count = get_count(reader, 8 * sizeof(int));
+	for (; count > 0 && !reader->error; count--) {
+		struct form *form = init_form();
+		int items;
+
+		if (!form) {
+			reader->error = 1;
+			break;
+		}
+
+		add_to_list_end(document->forms, form);
+		form->form_num = get_int(reader);
+		form->form_end = get_int(reader);
+		form->action = get_str(reader);
+		form->name = get_str(reader);
+		form->onsubmit = get_str(reader);
+		form->target = get_str(reader);
+		form->method = get_int(reader);
+
+		/* The links refer to the controls by their index. */
+		items = get_count(reader, 16 * sizeof(int));
+		if (items) {
+			struct form_control **new_controls;
+
+			new_controls = mem_realloc(controls, (ncontrols + items)
+						   * sizeof(*controls));
+			if (!new_controls) {
+				reader->error = 1;
+				break;
+			}
+			controls = new_controls;
+		}
+
+		for (; items > 0 && !reader->error; items--) {
+			struct form_control *fc = get_form_control(reader, form);
+
+			if (fc) controls[ncontrols++] = fc;
+		}
+	}
+
+	count = get_count(reader, 9 * sizeof(int));
+	if (count) {
+		document->links = mem_calloc(count, sizeof(*document->links));
+		if (!document->links) reader->error = 1;
+		else document->nlinks = count;
+	}
+
+	for (i = 0; i < document->nlinks && !reader->error; i++)
+		get_link(reader, &document->links[i], controls, ncontrols);
+
+	mem_free_if(controls);
+}
+
+static int
+read_disk_document_file(int fd, unsigned char *buffer, int length)
+{
+	int done = 0;
+
+	while (done < length) {
+		ssize_t n = read(fd, buffer + done, length - done);
+
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return -1;
+		done += n;
+	}
+
+	return 0;
+}
+
+struct document *
+load_disk_document(struct cache_entry *cached, struct document_options *options)
+{
+	unsigned char name[DISK_CACHE_NAME_LENGTH + 1];
+	struct disk_document_reader reader;
+	struct document *document = NULL;
+	unsigned char *buffer = NULL;
+	struct string header;
+	int needs_width, needs_height, width, height;
+	struct stat st;
+	int fd, invalid = 1;
+
+	if (!get_disk_document_enable(cached, options)
+	    || !get_disk_document_header(cached, options, name, &header))
+		return NULL;
+
+	fd = open_disk_cache_file(name);
+	if (fd < 0) {
+		done_string(&header);
+		return NULL;
+	}
+
+	if (fstat(fd, &st) || st.st_size < header.length
+	    || st.st_size > INT_MAX)
+		goto out;
+
+	buffer = mem_alloc(st.st_size);
+	if (!buffer) {
+		invalid = 0;
+		goto out;
+	}
+
+	if (read_disk_document_file(fd, buffer, st.st_size) < 0)
+		goto out;
+
+	/* The file was saved for a different content of the cache entry
+	 * or by another build. */
+	if (memcmp(buffer, header.source, header.length))
+		goto out;
+
+	reader.pos = buffer + header.length;
+	reader.end = buffer + st.st_size;
+	reader.error = 0;
+
+	needs_width = get_int(&reader);
+	needs_height = get_int(&reader);
+	width = get_int(&reader);
+	height = get_int(&reader);
+	if (reader.error) goto out;
+
+	/* The rest of the options is checked by the digest. */
+	invalid = 0;
+	if ((needs_width && width != options->box.width)
+	    || (needs_height && height != options->box.height))
+		goto out;
+
+	document = init_document(cached, options);
+	if (!document) goto out;
+
+	document->options.needs_width = !!needs_width;
+	document->options.needs_height = !!needs_height;
+
+	get_document(&reader, document);
+	if (reader.error || reader.pos != reader.end) {
+		object_unlock(document);
+		done_document(document);
+		document = NULL;
+		invalid = 1;
+		goto out;
+	}
+
+	sort_links(document);
+
+out:
+	close(fd);
+	release_disk_cache_file(name, invalid);
+	mem_free_if(buffer);
+	done_string(&header);
+
+	return document;
+}
@@ -0,0 +1,16 @@
+#ifndef EL__DOCUMENT_DISK_H
+#define EL__DOCUMENT_DISK_H
+
+struct cache_entry;
+struct document;
+struct document_options;
+
+/* Save the formatted @document in the disk cache if it is worth it. */
+void save_disk_document(struct document *document);
+
+/* Look for a copy of @cached formatted with @options in the disk cache.
+ * Returns the locked document, ready to be displayed, or NULL. */
+struct document *load_disk_document(struct cache_entry *cached,
+				    struct document_options *options);
+
+#endif
@@ -54,6 +54,7 @@
 #include "document/html/parser/parse.h"
 #include "document/html/renderer.h"
 #include "document/options.h"
+#include "document/plain/renderer.h"
 #include "document/refresh.h"
 #include "main/module.h"
 #include "main/object.h"
@@ -66,9 +67,97 @@
 #include "util/memory.h"
 #include "util/string.h"
 #include "viewer/text/link.h"
+#include "viewer/text/search.h"
 
 static INIT_LIST_OF(struct document, format_cache);
 
+/* The @format_cache list only keeps the LRU order. The documents are
+ * looked up by their URI, which is compared by identity, in a hash index
+ * whose chains keep the documents in the same relative order as the list,
+ * so the most recently used one is still found first. */
+static struct {
+	struct document **buckets;
+	unsigned int width;	/* The index has 1 << width buckets. */
+} format_cache_index;
+static int format_cache_count;
+
+#define FORMAT_CACHE_INDEX_MIN_WIDTH 4
+
+static inline struct document **
+get_format_cache_bucket(struct uri *uri)
+{
+	unsigned long h = (unsigned long) uri;
+
+	/* The low bits are the same for all the allocated URIs. */
+	h = (h >> 4) ^ (h >> 12);
+
+	return &format_cache_index.buckets[h & ((1 << format_cache_index.width) - 1)];
+}
+
+static void
+add_to_format_cache_index(struct document *document)
+{
+	struct document **bucket = get_format_cache_bucket(document->uri);
+
+	document->index_next = *bucket;
+	*bucket = document;
+}
+
+static void
+del_from_format_cache_index(struct document *document)
+{
+	struct document **pos = get_format_cache_bucket(document->uri);
+
+	for (; *pos; pos = &(*pos)->index_next) {
+		if (*pos != document) continue;
+
+		*pos = document->index_next;
+		document->index_next = NULL;
+		return;
+	}
+
+	INTERNAL("document %s missing from the format cache index",
+		 struri(document->uri));
+}
+
+/* Make sure the index has at least as many buckets as there are documents.
+ * If memory is short the old buckets are kept and only the chains get
+ * longer. Returns zero if there is no index at all. */
+static int
+grow_format_cache_index(int entries)
+{
+	unsigned int width = FORMAT_CACHE_INDEX_MIN_WIDTH;
+	struct document **buckets;
+	struct document *document;
+
+	if (format_cache_index.buckets && entries <= (1 << format_cache_index.width))
+		return 1;
+
+	while (entries > (1 << width)) width++;
+
+	buckets = mem_calloc(1 << width, sizeof(*buckets));
+	if (!buckets) return !!format_cache_index.buckets;
+
+	mem_free_if(format_cache_index.buckets);
+	format_cache_index.buckets = buckets;
+	format_cache_index.width = width;
+
+	/* Rehash from the least recently used document so that the chains
+	 * end up in the LRU order again. */
+	foreachback (document, format_cache)
+		add_to_format_cache_index(document);
+
+	return 1;
+}
+
+static void
+move_to_top_of_format_cache(struct document *document)
+{
+	move_to_top_of_list(format_cache, document);
+	del_from_format_cache_index(document);
+	add_to_format_cache_index(document);
+}
+
 #ifdef HAVE_INET_NTOP
 /* DNS callback. */
 static void
@@ -112,8 +201,11 @@ get_ip(struct document *document)
 struct document *
 init_document(struct cache_entry *cached, struct document_options *options)
 {
-	struct document *document = mem_calloc(1, sizeof(*document));
+	struct document *document;
 
+	if (!grow_format_cache_index(format_cache_count + 1)) return NULL;
+
+	document = mem_calloc(1, sizeof(*document));
 	if (!document) return NULL;
 
 	document->uri = get_uri_reference(cached->uri);
@@ -142,6 +234,8 @@ init_document(struct cache_entry *cached, struct document_options *options)
 	copy_opt(&document->options, options);
 
 	add_to_list(format_cache, document);
+	add_to_format_cache_index(document);
+	format_cache_count++;
 
 	return document;
 }
@@ -194,8 +288,14 @@ done_document(struct document *document)
 	if_assert_failed return;
 
 	assert(document->cached);
+	done_html_checkpoint(document);
+	done_plain_index(document);
 	object_unlock(document->cached);
 
+	/* The URI is the key in the index. */
+	del_from_format_cache_index(document);
+	format_cache_count--;
+
 	if (document->uri) done_uri(document->uri);
 	if (document->querydns) kill_dns_request(&document->querydns);
 	mem_free_if(document->ip);
@@ -241,6 +341,7 @@ done_document(struct document *document)
 	free_list(document->tags);
 	free_list(document->nodes);
 
+	done_search_matches(document);
 	mem_free_if(document->search);
 	mem_free_if(document->slines1);
 	mem_free_if(document->slines2);
@@ -260,7 +361,7 @@ release_document(struct document *document)
 	kill_timer(&document->timeout);
 #endif
 	object_unlock(document);
-	move_to_top_of_list(format_cache, document);
+	move_to_top_of_format_cache(document);
 }
 
 int
@@ -327,7 +428,12 @@ get_cached_document(struct cache_entry *cached, struct document_options *options
 {
 	struct document *document, *next;
 
-	foreachsafe (document, next, format_cache) {
+	if (!format_cache_index.buckets) return NULL;
+
+	for (document = *get_format_cache_bucket(cached->uri); document;
+	     document = next) {
+		next = document->index_next;
+
 		if (!compare_uri(document->uri, cached->uri, 0)
 		    || compare_opt(&document->options, options))
 			continue;
@@ -335,17 +441,70 @@ get_cached_document(struct cache_entry *cached, struct document_options *options
 		if (options->no_cache
 		    || cached->cache_id != document->cache_id
 		    || !check_document_css_magic(document)) {
+			/* Keep it for get_partial_document(). */
+			if (document->checkpoint && !options->no_cache)
+				continue;
+
 			if (!is_object_used(document)) {
 				done_document(document);
 			}
 			continue;
 		}
 
+		/* The data may have all arrived since the rendering stopped
+		 * short of the end.  get_partial_document() finishes it. */
+		if (document->checkpoint && !cached->incomplete)
+			continue;
+
 		/* Reactivate */
-		move_to_top_of_list(format_cache, document);
+		move_to_top_of_format_cache(document);
+
+		object_lock(document);
+
+		return document;
+	}
+
+	return NULL;
+}
+
+struct document *
+get_partial_document(struct cache_entry *cached, struct document_options *options)
+{
+	struct document *document, *next;
+
+	if (options->no_cache || !format_cache_index.buckets) return NULL;
+
+	for (document = *get_format_cache_bucket(cached->uri); document;
+	     document = next) {
+		next = document->index_next;
+
+		if (!document->checkpoint
+		    || !compare_uri(document->uri, cached->uri, 0)
+		    || compare_opt(&document->options, options))
+			continue;
+
+		/* The rendering goes on in place, so no other view may be
+		 * showing the document. */
+		if (is_object_used(document)) continue;
 
+		if (!check_document_css_magic(document)
+		    || !check_html_checkpoint(document, cached)) {
+			done_document(document);
+			continue;
+		}
+
+		move_to_top_of_format_cache(document);
 		object_lock(document);
 
+		document->cache_id = cached->cache_id;
+
+		/* The search index is built again for the new content. */
+		done_search_matches(document);
+		mem_free_set(&document->search, NULL);
+		mem_free_set(&document->slines1, NULL);
+		mem_free_set(&document->slines2, NULL);
+		document->nsearch = 0;
+
 		return document;
 	}
 
@@ -390,12 +549,20 @@ shrink_format_cache(int whole)
 
 	assertm(format_cache_entries >= 0, "format_cache_entries underflow");
 	if_assert_failed format_cache_entries = 0;
+
+	if (list_empty(format_cache)) {
+		mem_free_set(&format_cache_index.buckets, NULL);
+		format_cache_index.width = 0;
+	}
+
+	/* The table layouts are kept for formatting the documents again. */
+	if (whole) free_table_cache();
 }
 
 int
 get_format_cache_size(void)
 {
-	return list_size(&format_cache);
+	return format_cache_count;
 }
 
 int
@@ -15,8 +15,11 @@ struct document_refresh;
 struct form_control;
 struct frame_desc;
 struct frameset_desc;
+struct html_checkpoint;
 struct module;
+struct plain_index;
 struct screen_char;
+struct search_matches;
 
 /** Nodes are used for marking areas of text on the document canvas as
  * searchable. */
@@ -180,6 +183,9 @@ struct search {
 struct document {
 	OBJECT_HEAD(struct document);
 
+	/** The next document in the same bucket of the format cache index. */
+	struct document *index_next;
+
 	struct document_options options;
 
 	LIST_OF(struct form) forms;
@@ -225,6 +231,16 @@ struct document {
 	struct frameset_desc *frame_desc; /**< @todo RENAME ME */
 	struct document_refresh *refresh;
 
+	/** The state of the HTML renderer if the document was rendered
+	 * before all of #cached arrived and the rendering can go on
+	 * from there. */
+	struct html_checkpoint *checkpoint;
+
+	/** Where the lines of a large plain text document are in #cached,
+	 * so that only the lines in view have to be rendered.
+	 * @see render_plain_lines() */
+	struct plain_index *plain_index;
+
 	struct line *data;
 
 	struct link *links;
@@ -237,6 +253,9 @@ struct document {
 	struct search *search;
 	struct search **slines1;
 	struct search **slines2;
+	/** Where the last searched word is in #search.
+	 * @see viewer/text/search.c */
+	struct search_matches *search_matches;
 
 #ifdef CONFIG_UTF8
 	unsigned char buf[7];
@@ -288,6 +307,11 @@ void update_cached_document_options(struct session *ses);
 
 struct document *get_cached_document(struct cache_entry *cached, struct document_options *options);
 
+/** Looks for a document which was rendered from a part of @a cached and
+ * can be rendered further with the rest.
+ * @returns the locked document or NULL. */
+struct document *get_partial_document(struct cache_entry *cached, struct document_options *options);
+
 /** Release a reference to the document.
  * @relates document */
 void release_document(struct document *document);
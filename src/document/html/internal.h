@@ -4,6 +4,7 @@
 
 #include "document/css/stylesheet.h"
 #include "document/html/parser.h"
+#include "util/hash.h"
 #include "util/lists.h"
 
 struct document_options;
@@ -42,6 +43,18 @@ struct html_context {
 	 * from <style>-tags and external stylesheets if enabled is merged
 	 * added to it. */
 	struct css_stylesheet css_styles;
+
+	/* Identifies the stylesheets merged into css_styles so far, so that
+	 * the renderer does not reuse table layouts computed with others. */
+	hash_value_T css_id;
+
+	/* The styles computed for the latest elements, which the next
+	 * ones can share.  See get_css_selector_for_element(). */
+	LIST_OF(struct css_shared_style) css_shared_styles;
+	int css_shared_styles_count;
+
+	/* The last html_element.css_context given to an element. */
+	unsigned int css_contexts;
 #endif
 
 	/* These are global per-document base values, alterable by the <base>
@@ -86,6 +99,11 @@ struct html_context {
 	/* For parser/forms.c: */
 	unsigned char *startf;
 
+	/* For html/renderer.c: when set, parse_html() may suspend at the
+	 * first suitable place at or after this position.  See
+	 * render_html_document(). */
+	unsigned char *checkpoint;
+
 	/* For:
 	 * html/parser/parse.c
 	 * html/parser.c
@@ -18,6 +18,7 @@
 
 #include "bfu/listmenu.h"
 #include "bfu/menu.h"
+#include "cache/cache.h"
 #include "document/css/apply.h"
 #include "document/css/css.h"
 #include "document/css/stylesheet.h"
@@ -192,6 +193,7 @@ import_css_stylesheet(struct css_stylesheet *css, struct uri *base_uri,
 		      const unsigned char *unterminated_url, int len)
 {
 	struct html_context *html_context = css->import_data;
+	struct cache_entry *cached;
 	unsigned char *url;
 	unsigned char *import_url;
 	struct uri *uri;
@@ -225,6 +227,12 @@ import_css_stylesheet(struct css_stylesheet *css, struct uri *base_uri,
 	/* ... and then attempt to import from the cache. */
 	import_css(css, uri);
 
+	/* The imported data change as they are loaded. */
+	cached = get_redirected_cache_entry(uri);
+	html_context->css_id = html_context->css_id * 31
+			       + hash_data(struri(uri), strlen(struri(uri)))
+			       + (cached ? cached->cache_id : 0);
+
 	done_uri(uri);
 }
 #endif
@@ -761,6 +769,7 @@ init_html_parser(struct uri *uri, struct document_options *options,
 #ifdef CONFIG_CSS
 	html_context->css_styles.import = import_css_stylesheet;
 	init_css_selector_set(&html_context->css_styles.selectors);
+	init_list(html_context->css_shared_styles);
 #endif
 
 	init_list(html_context->stack);
@@ -826,8 +835,7 @@ init_html_parser(struct uri *uri, struct document_options *options,
 	html_context->css_styles.import_data = html_context;
 
 	if (options->css_enable)
-		mirror_css_stylesheet(&default_stylesheet,
-				      &html_context->css_styles);
+		html_context->css_styles.layer = &default_stylesheet;
 #endif
 
 	return html_context;
@@ -839,6 +847,7 @@ done_html_parser(struct html_context *html_context)
 #ifdef CONFIG_CSS
 	if (html_context->options->css_enable)
 		done_css_stylesheet(&html_context->css_styles);
+	done_shared_css_styles(html_context);
 #endif
 
 	mem_free(html_context->base_target);
@@ -155,6 +155,12 @@ struct html_element {
 
 	/* For the needs of CSS engine. A wannabe bitmask. */
 	enum html_element_pseudo_class pseudo_class;
+
+#ifdef CONFIG_CSS
+	/* Elements with the same style context get the same style from the
+	 * stylesheet.  See get_css_selector_for_element(). */
+	unsigned int css_context;
+#endif
 };
 
 #define is_inline_element(e) ((e)->linebreak == 0)
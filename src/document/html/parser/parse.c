@@ -36,216 +36,6 @@
 #include "document/html/internal.h"
 
 
-#define end_of_tag(c) ((c) == '>' || (c) == '<')
-
-static inline int
-atchr(register unsigned char c)
-{
-	return (c < 127 && (c > '>' || (c > ' ' && c != '=' && !end_of_tag(c))));
-}
-
-/* This function eats one html element. */
-/* - e is pointer to the begining of the element (*e must be '<')
- * - eof is pointer to the end of scanned area
- * - parsed element name is stored in name, it's length is namelen
- * - first attribute is stored in attr
- * - end points to first character behind the html element */
-/* It returns -1 when it failed (returned values in pointers are invalid) and
- * 0 for success. */
-int
-parse_element(register unsigned char *e, unsigned char *eof,
-	      unsigned char **name, int *namelen,
-	      unsigned char **attr, unsigned char **end)
-{
-#define next_char() if (++e == eof) return -1;
-
-	assert(e && eof);
-	if (e >= eof || *e != '<') return -1;
-
-	next_char();
-	if (name) *name = e;
-
-	if (*e == '/') next_char();
-	if (!isident(*e)) return -1;
-
-	while (isident(*e)) next_char();
-
-	if (!isspace(*e) && !end_of_tag(*e) && *e != '/' && *e != ':' && *e != '=')
-		return -1;
-
-	if (name && namelen) *namelen = e - *name;
-
-	while (isspace(*e) || *e == '/' || *e == ':') next_char();
-
-	/* Skip bad attribute */
-	while (!atchr(*e) && !end_of_tag(*e) && !isspace(*e)) next_char();
-
-	if (attr) *attr = e;
-
-next_attr:
-	while (isspace(*e)) next_char();
-
-	/* Skip bad attribute */
-	while (!atchr(*e) && !end_of_tag(*e) && !isspace(*e)) next_char();
-
-	if (end_of_tag(*e)) goto end;
-
-	while (atchr(*e)) next_char();
-	while (isspace(*e)) next_char();
-
-	if (*e != '=') {
-		if (end_of_tag(*e)) goto end;
-		goto next_attr;
-	}
-	next_char();
-
-	while (isspace(*e)) next_char();
-
-	if (isquote(*e)) {
-		unsigned char quote = *e;
-
-/* quoted_value: */
-		next_char();
-		while (*e != quote) next_char();
-		next_char();
-		/* The following apparently handles the case of <foo
-		 * id="a""b">, however that is very rare and probably not
-		 * conforming. More frequent (and mishandling it more fatal) is
-		 * probably the typo of <foo id="a""> - we can handle it as
-		 * long as this is commented out. --pasky */
-		/* if (*e == quote) goto quoted_value; */
-	} else {
-		while (!isspace(*e) && !end_of_tag(*e)) next_char();
-	}
-
-	while (isspace(*e)) next_char();
-
-	if (!end_of_tag(*e)) goto next_attr;
-
-end:
-	if (end) *end = e + (*e == '>');
-
-	return 0;
-}
-
-
-#define realloc_chrs(x, l) mem_align_alloc(x, l, (l) + 1, 0xFF)
-
-#define add_chr(s, l, c)						\
-	do {								\
-		if (!realloc_chrs(&(s), l)) return NULL;		\
-		(s)[(l)++] = (c);					\
-	} while (0)
-
-unsigned char *
-get_attr_value(register unsigned char *e, unsigned char *name,
-	       int cp, enum html_attr_flags flags)
-{
-	unsigned char *n;
-	unsigned char *name_start;
-	unsigned char *attr = NULL;
-	int attrlen = 0;
-	int found;
-
-next_attr:
-	skip_space(e);
-	if (end_of_tag(*e) || !atchr(*e)) goto parse_error;
-	n = name;
-	name_start = e;
-
-	while (atchr(*n) && atchr(*e) && c_toupper(*e) == c_toupper(*n)) e++, n++;
-	found = !*n && !atchr(*e);
-
-	if (found && (flags & HTML_ATTR_TEST)) return name_start;
-
-	while (atchr(*e)) e++;
-	skip_space(e);
-	if (*e != '=') {
-		if (found) goto found_endattr;
-		goto next_attr;
-	}
-	e++;
-	skip_space(e);
-
-	if (found) {
-		if (!isquote(*e)) {
-			while (!isspace(*e) && !end_of_tag(*e)) {
-				if (!*e) goto parse_error;
-				add_chr(attr, attrlen, *e);
-				e++;
-			}
-		} else {
-			unsigned char quote = *e;
-
-/* parse_quoted_value: */
-			while (*(++e) != quote) {
-				if (!*e) goto parse_error;
-				if (flags & HTML_ATTR_LITERAL_NL)
-					add_chr(attr, attrlen, *e);
-				else if (*e == ASCII_CR) continue;
-				else if (*e != ASCII_TAB && *e != ASCII_LF)
-					add_chr(attr, attrlen, *e);
-				else if (!(flags & HTML_ATTR_EAT_NL))
-					add_chr(attr, attrlen, ' ');
-			}
-			e++;
-			/* The following apparently handles the case of <foo
-			 * id="a""b">, however that is very rare and probably
-			 * not conforming. More frequent (and mishandling it
-			 * more fatal) is probably the typo of <foo id="a""> -
-			 * we can handle it as long as this is commented out.
-			 * --pasky */
-#if 0
-			if (*e == quote) {
-				add_chr(attr, attrlen, *e);
-				goto parse_quoted_value;
-			}
-#endif
-		}
-
-found_endattr:
-		add_chr(attr, attrlen, '\0');
-		attrlen--;
-
-		if (/* Unused: !(flags & HTML_ATTR_NO_CONV) && */
-		    memchr(attr, '&', attrlen)) {
-			unsigned char *saved_attr = attr;
-
-			attr = convert_string(NULL, saved_attr, attrlen, cp,
-			                      CSM_QUERY, NULL, NULL, NULL);
-			mem_free(saved_attr);
-		}
-
-		set_mem_comment(attr, name, strlen(name));
-		return attr;
-
-	} else {
-		if (!isquote(*e)) {
-			while (!isspace(*e) && !end_of_tag(*e)) {
-				if (!*e) goto parse_error;
-				e++;
-			}
-		} else {
-			unsigned char quote = *e;
-
-			do {
-				while (*(++e) != quote)
-					if (!*e) goto parse_error;
-				e++;
-			} while (/* See above. *e == quote */ 0);
-		}
-	}
-
-	goto next_attr;
-
-parse_error:
-	mem_free_if(attr);
-	return NULL;
-}
-
-#undef add_chr
-
-
 /* Extract numerical value of attribute @name.
  * It will return a positive integer value on success,
  * or -1 on error. */
@@ -359,35 +149,6 @@ get_width(unsigned char *a, unsigned char *name, int limited,
 }
 
 
-unsigned char *
-skip_comment(unsigned char *html, unsigned char *eof)
-{
-	if (html + 4 <= eof && html[2] == '-' && html[3] == '-') {
-		html += 4;
-		while (html < eof) {
-			if (html + 2 <= eof && html[0] == '-' && html[1] == '-') {
-				html += 2;
-				while (html < eof && *html == '-') html++;
-				while (html < eof && isspace(*html)) html++;
-				if (html >= eof) return eof;
-				if (*html == '>') return html + 1;
-				continue;
-			}
-			html++;
-		}
-
-	} else {
-		html += 2;
-		while (html < eof) {
-			if (html[0] == '>') return html + 1;
-			html++;
-		}
-	}
-
-	return eof;
-}
-
-
 
 
 enum element_type {
@@ -633,25 +394,28 @@ count_newline_entities(const unsigned char *html, const unsigned char *eof,
 	return html;
 }
 
-void
-parse_html(unsigned char *html, unsigned char *eof,
-	   struct part *part, unsigned char *head,
-	   struct html_context *html_context)
+/* Whether parse_html_loop() may stop before @html and leave the rest for
+ * resume_html().  That is only possible at the top level, outside of the
+ * raw text elements, and when the renderer has nothing pending. */
+static int
+can_suspend_html(unsigned char *html, struct html_context *html_context)
+{
+	return html_context->checkpoint
+	       && html >= html_context->checkpoint
+	       && !html_context->table_level
+	       && !html_context->was_xmp
+	       && !html_context->was_style
+	       && html_context->special_f(html_context, SP_CHECKPOINT);
+}
+
+/* Returns @eof, or the position where the parsing was suspended. */
+static unsigned char *
+parse_html_loop(unsigned char *html, unsigned char *eof,
+		struct part *part, struct html_context *html_context)
 {
 	unsigned char *base_pos = html;
 	int noupdate = 0;
 
-	html_context->putsp = HTML_SPACE_SUPPRESS;
-	html_context->line_breax = html_context->table_level ? 2 : 1;
-	html_context->position = 0;
-	html_context->was_br = 0;
-	html_context->was_li = 0;
-	html_context->was_body = 0;
-/*	html_context->was_body_background = 0; */
-	html_context->part = part;
-	html_context->eoff = eof;
-	if (head) process_head(html_context, head);
-
 main_loop:
 	while (html < eof) {
 		unsigned char *name, *attr, *end;
@@ -662,6 +426,9 @@ main_loop:
 			html_context->part = part;
 			html_context->eoff = eof;
 			base_pos = html;
+
+			if (can_suspend_html(html, html_context))
+				return html;
 		} else {
 			noupdate = 0;
 		}
@@ -771,7 +538,9 @@ next_break:
 		}
 
 		if (*html != '<' || parse_element(html, eof, &name, &namelen, &attr, &end)) {
-			html++;
+			/* The text up to the next interesting char would only
+			 * go around the loop one char at a time. */
+			html = skip_html_text(html + 1, eof);
 			noupdate = 1;
 			continue;
 		}
@@ -797,6 +566,13 @@ ng:
 	}
 
 	if (noupdate) put_chrs(html_context, base_pos, html - base_pos);
+
+	return eof;
+}
+
+static void
+finish_html(struct part *part, struct html_context *html_context)
+{
 	ln_break(html_context, 1);
 	/* Restore the part in case the html_context was trashed in the last
 	 * iteration so that when destroying the stack in the caller we still
@@ -807,6 +583,42 @@ ng:
 	html_context->was_br = 0;
 }
 
+/* Parse the HTML from @html to @eof into @part.  If html_context->checkpoint
+ * is set, the parsing may stop at the first suitable place at or after it;
+ * the position is then returned and resume_html() takes over from there.
+ * Otherwise @eof is returned. */
+unsigned char *
+parse_html(unsigned char *html, unsigned char *eof,
+	   struct part *part, unsigned char *head,
+	   struct html_context *html_context)
+{
+	html_context->putsp = HTML_SPACE_SUPPRESS;
+	html_context->line_breax = html_context->table_level ? 2 : 1;
+	html_context->position = 0;
+	html_context->was_br = 0;
+	html_context->was_li = 0;
+	html_context->was_body = 0;
+/*	html_context->was_body_background = 0; */
+	html_context->part = part;
+	html_context->eoff = eof;
+	if (head) process_head(html_context, head);
+
+	return resume_html(html, eof, part, html_context);
+}
+
+/* Go on parsing from @html where parse_html() or resume_html() stopped. The
+ * source before @html must not have changed since. */
+unsigned char *
+resume_html(unsigned char *html, unsigned char *eof,
+	    struct part *part, struct html_context *html_context)
+{
+	html = parse_html_loop(html, eof, part, html_context);
+	if (html < eof) return html;
+
+	finish_html(part, html_context);
+	return eof;
+}
+
 /* Perform the processing of the element that should take place when its open
  * tag is encountered.  Viewing the document as a tree of elements, this
  * routine runs as a callback for pre-order traversal. */
@@ -874,10 +686,21 @@ start_element(struct element_info *ei,
 		int support = supports_html_media_attr(media);
 		mem_free_if(media);
 
-		if (support)
+		if (support) {
+			/* The CSS scanner stops at the first end tag. */
+			unsigned char *end = html;
+
+			while ((end = memchr(end, '<', eof - end))
+			       && end + 1 < eof && end[1] != '/')
+				end++;
+			if (!end || end + 1 >= eof) end = eof;
+
 			css_parse_stylesheet(&html_context->css_styles,
 					     html_context->base_href,
 					     html, eof);
+			html_context->css_id = html_context->css_id * 31
+						+ hash_data(html, end - html);
+		}
 	}
 #endif
 
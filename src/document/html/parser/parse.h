@@ -48,7 +48,8 @@ unsigned char *get_attr_value(register unsigned char *e, unsigned char *name, in
 
 /* Interface for both the renderer and the table handling */
 
-void parse_html(unsigned char *html, unsigned char *eof, struct part *part, unsigned char *head, struct html_context *html_context);
+unsigned char *parse_html(unsigned char *html, unsigned char *eof, struct part *part, unsigned char *head, struct html_context *html_context);
+unsigned char *resume_html(unsigned char *html, unsigned char *eof, struct part *part, struct html_context *html_context);
 
 
 /* Interface for element handlers */
@@ -65,6 +66,14 @@ int get_width(unsigned char *, unsigned char *, int, struct html_context *);
 
 unsigned char *skip_comment(unsigned char *, unsigned char *);
 
+/* Returns the first char from @html on that is whitespace, a control char,
+ * '<' or '&', or @eof if there is none.  Single spaces followed by other
+ * text are skipped as well.  The text before it needs no parsing. */
+unsigned char *skip_html_text(unsigned char *html, unsigned char *eof);
+
+/* Returns the first '<' from @html on, or @eof if there is none. */
+unsigned char *find_html_tag(unsigned char *html, unsigned char *eof);
+
 
 void scan_http_equiv(unsigned char *s, unsigned char *eof, struct string *head, struct string *title, int cp);
 
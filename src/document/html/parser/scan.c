@@ -0,0 +1,340 @@
+/* HTML tokenizer: elements, attributes, comments and text */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "elinks.h"
+
+#include "document/html/parser/parse.h"
+#include "intl/charsets.h"
+#include "util/conv.h"
+#include "util/error.h"
+#include "util/memdebug.h"
+#include "util/memory.h"
+#include "util/string.h"
+
+
+#define end_of_tag(c) ((c) == '>' || (c) == '<')
+
+static inline int
+atchr(register unsigned char c)
+{
+	return (c < 127 && (c > '>' || (c > ' ' && c != '=' && !end_of_tag(c))));
+}
+
+/* This function eats one html element. */
+/* - e is pointer to the begining of the element (*e must be '<')
+ * - eof is pointer to the end of scanned area
+ * - parsed element name is stored in name, it's length is namelen
+ * - first attribute is stored in attr
+ * - end points to first character behind the html element */
+/* It returns -1 when it failed (returned values in pointers are invalid) and
+ * 0 for success. */
+int
+parse_element(register unsigned char *e, unsigned char *eof,
+	      unsigned char **name, int *namelen,
+	      unsigned char **attr, unsigned char **end)
+{
+#define next_char() if (++e == eof) return -1;
+
+	assert(e && eof);
+	if (e >= eof || *e != '<') return -1;
+
+	next_char();
+	if (name) *name = e;
+
+	if (*e == '/') next_char();
+	if (!isident(*e)) return -1;
+
+	while (isident(*e)) next_char();
+
+	if (!isspace(*e) && !end_of_tag(*e) && *e != '/' && *e != ':' && *e != '=')
+		return -1;
+
+	if (name && namelen) *namelen = e - *name;
+
+	while (isspace(*e) || *e == '/' || *e == ':') next_char();
+
+	/* Skip bad attribute */
+	while (!atchr(*e) && !end_of_tag(*e) && !isspace(*e)) next_char();
+
+	if (attr) *attr = e;
+
+next_attr:
+	while (isspace(*e)) next_char();
+
+	/* Skip bad attribute */
+	while (!atchr(*e) && !end_of_tag(*e) && !isspace(*e)) next_char();
+
+	if (end_of_tag(*e)) goto end;
+
+	while (atchr(*e)) next_char();
+	while (isspace(*e)) next_char();
+
+	if (*e != '=') {
+		if (end_of_tag(*e)) goto end;
+		goto next_attr;
+	}
+	next_char();
+
+	while (isspace(*e)) next_char();
+
+	if (isquote(*e)) {
+		unsigned char quote = *e;
+
+/* quoted_value: */
+		next_char();
+		e = memchr(e, quote, eof - e);
+		if (!e) return -1;
+		next_char();
+		/* The following apparently handles the case of <foo
+		 * id="a""b">, however that is very rare and probably not
+		 * conforming. More frequent (and mishandling it more fatal) is
+		 * probably the typo of <foo id="a""> - we can handle it as
+		 * long as this is commented out. --pasky */
+		/* if (*e == quote) goto quoted_value; */
+	} else {
+		while (!isspace(*e) && !end_of_tag(*e)) next_char();
+	}
+
+	while (isspace(*e)) next_char();
+
+	if (!end_of_tag(*e)) goto next_attr;
+
+end:
+	if (end) *end = e + (*e == '>');
+
+	return 0;
+}
+
+
+#define realloc_chrs(x, l) mem_align_alloc(x, l, (l) + 1, 0xFF)
+
+#define add_chr(s, l, c)						\
+	do {								\
+		if (!realloc_chrs(&(s), l)) return NULL;		\
+		(s)[(l)++] = (c);					\
+	} while (0)
+
+unsigned char *
+get_attr_value(register unsigned char *e, unsigned char *name,
+	       int cp, enum html_attr_flags flags)
+{
+	unsigned char *n;
+	unsigned char *name_start;
+	unsigned char *attr = NULL;
+	int attrlen = 0;
+	int found;
+
+next_attr:
+	skip_space(e);
+	if (end_of_tag(*e) || !atchr(*e)) goto parse_error;
+	n = name;
+	name_start = e;
+
+	while (atchr(*n) && atchr(*e) && c_toupper(*e) == c_toupper(*n)) e++, n++;
+	found = !*n && !atchr(*e);
+
+	if (found && (flags & HTML_ATTR_TEST)) return name_start;
+
+	while (atchr(*e)) e++;
+	skip_space(e);
+	if (*e != '=') {
+		if (found) goto found_endattr;
+		goto next_attr;
+	}
+	e++;
+	skip_space(e);
+
+	if (found) {
+		if (!isquote(*e)) {
+			while (!isspace(*e) && !end_of_tag(*e)) {
+				if (!*e) goto parse_error;
+				add_chr(attr, attrlen, *e);
+				e++;
+			}
+		} else {
+			unsigned char quote = *e;
+			unsigned char *value_end = strchr(e + 1, quote);
+
+			if (!value_end) goto parse_error;
+
+			/* Allocate the whole value and the '\0' at once. */
+			if (!mem_align_alloc(&attr, 0, value_end - e, 0xFF))
+				return NULL;
+
+/* parse_quoted_value: */
+			while (++e != value_end) {
+				if (flags & HTML_ATTR_LITERAL_NL)
+					attr[attrlen++] = *e;
+				else if (*e == ASCII_CR) continue;
+				else if (*e != ASCII_TAB && *e != ASCII_LF)
+					attr[attrlen++] = *e;
+				else if (!(flags & HTML_ATTR_EAT_NL))
+					attr[attrlen++] = ' ';
+			}
+			e++;
+			/* The following apparently handles the case of <foo
+			 * id="a""b">, however that is very rare and probably
+			 * not conforming. More frequent (and mishandling it
+			 * more fatal) is probably the typo of <foo id="a""> -
+			 * we can handle it as long as this is commented out.
+			 * --pasky */
+#if 0
+			if (*e == quote) {
+				add_chr(attr, attrlen, *e);
+				goto parse_quoted_value;
+			}
+#endif
+		}
+
+found_endattr:
+		add_chr(attr, attrlen, '\0');
+		attrlen--;
+
+		if (/* Unused: !(flags & HTML_ATTR_NO_CONV) && */
+		    memchr(attr, '&', attrlen)) {
+			unsigned char *saved_attr = attr;
+
+			attr = convert_string(NULL, saved_attr, attrlen, cp,
+			                      CSM_QUERY, NULL, NULL, NULL);
+			mem_free(saved_attr);
+		}
+
+		set_mem_comment(attr, name, strlen(name));
+		return attr;
+
+	} else {
+		if (!isquote(*e)) {
+			while (!isspace(*e) && !end_of_tag(*e)) {
+				if (!*e) goto parse_error;
+				e++;
+			}
+		} else {
+			unsigned char quote = *e;
+
+			do {
+				e = strchr(e + 1, quote);
+				if (!e) goto parse_error;
+				e++;
+			} while (/* See above. *e == quote */ 0);
+		}
+	}
+
+	goto next_attr;
+
+parse_error:
+	mem_free_if(attr);
+	return NULL;
+}
+
+#undef add_chr
+
+
+unsigned char *
+skip_comment(unsigned char *html, unsigned char *eof)
+{
+	if (html + 4 <= eof && html[2] == '-' && html[3] == '-') {
+		html += 4;
+		while (html < eof) {
+			html = memchr(html, '-', eof - html);
+			if (!html) return eof;
+
+			if (html + 2 <= eof && html[1] == '-') {
+				html += 2;
+				while (html < eof && *html == '-') html++;
+				while (html < eof && isspace(*html)) html++;
+				if (html >= eof) return eof;
+				if (*html == '>') return html + 1;
+				continue;
+			}
+			html++;
+		}
+
+	} else {
+		html += 2;
+		if (html < eof) {
+			html = memchr(html, '>', eof - html);
+			if (html) return html + 1;
+		}
+	}
+
+	return eof;
+}
+
+/* The text scanning looks at a machine word of bytes at a time, and
+ * only at the bytes of the words that have interesting bytes in them. */
+typedef unsigned long html_word_T;
+
+#define HTML_WORD_ONES	((html_word_T) -1 / 0xFF)
+#define HTML_WORD_HIGHS	(HTML_WORD_ONES * 0x80)
+
+/* The high bits of the bytes of @w which are less than @n, which must be
+ * at most 0x80.  Bytes above such a byte may be marked wrongly. */
+#define html_word_has_less(w, n) \
+	(((w) - HTML_WORD_ONES * (n)) & ~(w) & HTML_WORD_HIGHS)
+
+/* The high bits of the bytes of @w which are @c, likewise. */
+#define html_word_has(w, c) html_word_has_less((w) ^ (HTML_WORD_ONES * (c)), 1)
+
+/* Bytes from 0x80 on are passed to isspace(), which depends on the locale. */
+#define is_html_text_end(c) \
+	((c) <= ' ' || (c) == '<' || (c) == '&' || ((c) >= 0x80 && isspace(c)))
+
+/* A space between two chars of text needs no parsing either. */
+#define is_html_text_space(html, eof) \
+	(*(html) == ' ' && (html) + 1 < (eof) && !is_html_text_end((html)[1]))
+
+unsigned char *
+skip_html_text(unsigned char *html, unsigned char *eof)
+{
+	while (html < eof) {
+		/* Many runs of text are short, so look at the first bytes
+		 * one by one... */
+		unsigned char *end = eof - html > sizeof(html_word_T)
+				     ? html + sizeof(html_word_T) : eof;
+
+		for (; html < end; html++)
+			if (is_html_text_end(*html)
+			    && !is_html_text_space(html, eof))
+				return html;
+
+		/* ... and only then at whole words.  A word with spaces
+		 * next to each other or at its end is left to the loop
+		 * above, whichever way the bytes are ordered in it. */
+		while (eof - html >= sizeof(html_word_T)) {
+			html_word_T word, spaces;
+
+			memcpy(&word, html, sizeof(word));
+			if ((word & HTML_WORD_HIGHS)
+			    || html_word_has_less(word, ' ')
+			    || html_word_has(word, '<')
+			    || html_word_has(word, '&'))
+				break;
+
+			spaces = html_word_has(word, ' ');
+			if ((spaces & (spaces >> 8))
+			    || html[sizeof(word) - 1] == ' ')
+				break;
+
+			html += sizeof(word);
+		}
+	}
+
+	return eof;
+}
+
+unsigned char *
+find_html_tag(unsigned char *html, unsigned char *eof)
+{
+	if (html < eof) {
+		html = memchr(html, '<', eof - html);
+		if (html) return html;
+	}
+
+	return eof;
+}
@@ -11,6 +11,7 @@
 
 #include "elinks.h"
 
+#include "document/css/apply.h"
 #include "document/document.h"
 #include "document/html/parser/stack.h"
 #include "document/html/parser/parse.h"
@@ -110,6 +111,7 @@ kill_html_stack_item(struct html_context *html_context, struct html_element *e)
 #ifdef CONFIG_CSS
 	mem_free_if(e->attr.id);
 	mem_free_if(e->attr.class_);
+	forget_shared_css_styles(html_context, e);
 #endif
 
 	mem_free_if(e->attr.onclick);
@@ -153,6 +155,7 @@ html_stack_dup(struct html_context *html_context, enum html_element_mortality_ty
 
 #ifdef CONFIG_CSS
 	e->attr.id = e->attr.class_ = NULL;
+	e->css_context = ++html_context->css_contexts;
 #endif
 	/* We don't want to propagate these. */
 	/* XXX: For sure? --pasky */
@@ -578,7 +578,7 @@ see:
 		add_table_bad_html_start(table, html);
 	}
 
-	while (html < eof && *html != '<') html++;
+	html = find_html_tag(html, eof);
 
 	if (html >= eof) {
 		if (in_cell) CELL(table, col, row)->end = html;
@@ -69,9 +69,17 @@ struct link_state_info {
 	struct form_control *form;
 };
 
+/* The cells of tables are formatted several times to find out how wide they
+ * want to be.  The results are cached by the content of the cell rather than
+ * its location in memory, so that they can be reused when the document is
+ * rendered again, e.g. after more data arrived or the terminal was resized. */
 struct table_cache_entry_key {
-	unsigned char *start;
-	unsigned char *end;
+	hash_value_T source;	/* Hash of the source of the cell */
+	int length;		/* Length of the source of the cell */
+	int offset;		/* Where the cell starts in the document */
+	hash_value_T context;	/* The document, its options and styles */
+	unsigned int style;	/* The inherited text attributes */
+	int table_level;
 	int align;
 	int margin;
 	int width;
@@ -84,6 +92,9 @@ struct table_cache_entry {
 
 	struct table_cache_entry_key key;
 	struct part part;
+
+	/* How long it took to format the cell. */
+	timeval_T duration;
 };
 
 /* Max. entries in table cache used for nested tables. */
@@ -93,6 +104,10 @@ struct table_cache_entry {
 static int table_cache_entries;
 static struct hash *table_cache;
 
+static long table_cache_hits;
+static long table_cache_misses;
+static timeval_T table_cache_saved;
+
 
 struct renderer_context {
 	int last_link_to_move;
@@ -113,6 +128,9 @@ struct renderer_context {
 	/* Used for setting cache info from HTTP-EQUIV meta tags. */
 	struct cache_entry *cached;
 
+	/* The document and its options, for the table cache. */
+	hash_value_T table_cache_context;
+
 	int g_ctrl_num;
 	int subscript;	/* Count stacked subscripts */
 	int supscript;	/* Count stacked supscripts */
@@ -2331,6 +2349,16 @@ html_special(struct html_context *html_context, enum html_special_type c, ...)
 			}
 #endif
 			break;
+		case SP_CHECKPOINT:
+			/* Suspend only between lines and links, and not in
+			 * a frameset. */
+			ret_val = (void *) (long) (document
+				&& !document->frame_desc
+				&& part->cx == -1
+				&& !renderer_context.link_state_info.link
+				&& !renderer_context.link_state_info.image
+				&& !renderer_context.link_state_info.form);
+			break;
 		case SP_SCRIPT:
 #ifdef CONFIG_ECMASCRIPT
 			if (document) {
@@ -2364,55 +2392,63 @@ free_table_cache(void)
 	}
 }
 
-struct part *
-format_html_part(struct html_context *html_context,
-		 unsigned char *start, unsigned char *end,
-		 int align, int margin, int width, struct document *document,
-		 int x, int y, unsigned char *head,
-		 int link_num)
+int
+get_table_cache_entry_count(void)
 {
-	struct part *part;
-	void *html_state;
-	struct tag *saved_last_tag_to_move = renderer_context.last_tag_to_move;
-	int saved_empty_format = renderer_context.empty_format;
-	int saved_margin = html_context->margin;
-	int saved_last_link_to_move = renderer_context.last_link_to_move;
+	return table_cache_entries;
+}
 
-	/* Hash creation if needed. */
-	if (!table_cache) {
-		table_cache = init_hash8();
-	} else if (!document) {
-		/* Search for cached entry. */
-		struct table_cache_entry_key key;
-		struct hash_item *item;
+long
+get_table_cache_hits(void)
+{
+	return table_cache_hits;
+}
 
-		/* Clear key to prevent potential alignment problem
-		 * when keys are compared. */
-		memset(&key, 0, sizeof(key));
-
-		key.start = start;
-		key.end = end;
-		key.align = align;
-		key.margin = margin;
-		key.width = width;
-		key.x = x;
-		key.link_num = link_num;
-
-		item = get_hash_item(table_cache,
-				     (unsigned char *) &key,
-				     sizeof(key));
-		if (item) { /* We found it in cache, so just copy and return. */
-			part = mem_alloc(sizeof(*part));
-			if (part)  {
-				copy_struct(part, &((struct table_cache_entry *)
-						    item->value)->part);
-				return part;
-			}
-		}
-	}
+long
+get_table_cache_misses(void)
+{
+	return table_cache_misses;
+}
 
-	assertm(y >= 0, "format_html_part: y == %d", y);
-	if_assert_failed return NULL;
+milliseconds_T
+get_table_cache_saved_time(void)
+{
+	return timeval_to_milliseconds(&table_cache_saved);
+}
+
+static void
+init_table_cache_key(struct html_context *html_context,
+		     struct table_cache_entry_key *key,
+		     unsigned char *start, unsigned char *end,
+		     int align, int margin, int width, int x, int link_num)
+{
+	/* Clear key to prevent potential alignment problem
+	 * when keys are compared. */
+	memset(key, 0, sizeof(*key));
+
+	key->source = hash_data(start, end - start);
+	key->length = end - start;
+	key->offset = start - html_context->startf;
+	key->context = renderer_context.table_cache_context;
+#ifdef CONFIG_CSS
+	key->context += html_context->css_id;
+#endif
+	key->style = format.style.attr;
+	key->table_level = html_context->table_level;
+	key->align = align;
+	key->margin = margin;
+	key->width = width;
+	key->x = x;
+	key->link_num = link_num;
+}
+
+/* Set up the renderer and the parser for formatting a new part. */
+static struct part *
+start_html_part(struct html_context *html_context, int align, int margin,
+		int width, struct document *document, int x, int y,
+		int link_num, void **html_state)
+{
+	struct part *part;
 
 	if (document) {
 		struct node *node = mem_alloc(sizeof(*node));
@@ -2440,7 +2476,7 @@ format_html_part(struct html_context *html_context,
 	renderer_context.nobreak = 1;
 
 	part = mem_calloc(1, sizeof(*part));
-	if (!part) goto ret;
+	if (!part) return NULL;
 
 	part->document = document;
 	part->box.x = x;
@@ -2449,10 +2485,16 @@ format_html_part(struct html_context *html_context,
 	part->cy = 0;
 	part->link_num = link_num;
 
-	html_state = init_html_parser_state(html_context, ELEMENT_IMMORTAL, align, margin, width);
+	*html_state = init_html_parser_state(html_context, ELEMENT_IMMORTAL, align, margin, width);
 
-	parse_html(start, end, part, head, html_context);
+	return part;
+}
 
+/* Clean up after the whole source of @part has been parsed. */
+static void
+end_html_part(struct html_context *html_context, struct part *part, int y,
+	      void *html_state)
+{
 	done_html_parser_state(html_context, html_state);
 
 	int_lower_bound(&part->max_width, part->box.width);
@@ -2465,11 +2507,75 @@ format_html_part(struct html_context *html_context,
 	mem_free_if(part->char_width);
 #endif
 
-	if (document) {
-		struct node *node = document->nodes.next;
+	if (part->document) {
+		struct node *node = part->document->nodes.next;
 
 		node->box.height = y - node->box.y + part->box.height;
 	}
+}
+
+struct part *
+format_html_part(struct html_context *html_context,
+		 unsigned char *start, unsigned char *end,
+		 int align, int margin, int width, struct document *document,
+		 int x, int y, unsigned char *head,
+		 int link_num)
+{
+	struct part *part;
+	void *html_state;
+	struct tag *saved_last_tag_to_move = renderer_context.last_tag_to_move;
+	int saved_empty_format = renderer_context.empty_format;
+	int saved_margin = html_context->margin;
+	int saved_last_link_to_move = renderer_context.last_link_to_move;
+	struct table_cache_entry_key key;
+	/* Text is not parsed the same way within <xmp> and <style>. */
+	int use_table_cache = html_context->table_level && !document
+			      && !html_context->was_xmp
+			      && !html_context->was_style;
+	struct uri *saved_base_href = html_context->base_href;
+#ifdef CONFIG_CSS
+	hash_value_T saved_css_id = html_context->css_id;
+#endif
+	timeval_T start_time;
+
+	if (use_table_cache) {
+		/* Search for cached entry. */
+		struct hash_item *item = NULL;
+
+		init_table_cache_key(html_context, &key, start, end, align,
+				     margin, width, x, link_num);
+
+		if (table_cache)
+			item = get_hash_item(table_cache,
+					     (unsigned char *) &key,
+					     sizeof(key));
+		if (item) { /* We found it in cache, so just copy and return. */
+			struct table_cache_entry *tce = item->value;
+
+			part = mem_alloc(sizeof(*part));
+			if (part)  {
+				copy_struct(part, &tce->part);
+				table_cache_hits++;
+				timeval_add_interval(&table_cache_saved,
+						     &tce->duration);
+				return part;
+			}
+		}
+
+		table_cache_misses++;
+		timeval_now(&start_time);
+	}
+
+	assertm(y >= 0, "format_html_part: y == %d", y);
+	if_assert_failed return NULL;
+
+	part = start_html_part(html_context, align, margin, width, document,
+			       x, y, link_num, &html_state);
+	if (!part) goto ret;
+
+	parse_html(start, end, part, head, html_context);
+
+	end_html_part(html_context, part, y, html_state);
 
 ret:
 	renderer_context.last_link_to_move = saved_last_link_to_move;
@@ -2478,23 +2584,30 @@ ret:
 
 	html_context->margin = saved_margin;
 
-	if (html_context->table_level > 1 && !document
-	    && table_cache
-	    && table_cache_entries < MAX_TABLE_CACHE_ENTRIES) {
+	/* Do not cache cells which changed the state of the parser, the
+	 * change would be lost when the cell is not parsed again. */
+	if (use_table_cache && part
+#ifdef CONFIG_CSS
+	    && html_context->css_id == saved_css_id
+#endif
+	    && html_context->base_href == saved_base_href
+	    && !html_context->was_xmp && !html_context->was_style) {
 		/* Create a new entry. */
-		/* Clear memory to prevent bad key comparaison due to alignment
-		 * of key fields. */
-		struct table_cache_entry *tce = mem_calloc(1, sizeof(*tce));
+		struct table_cache_entry *tce = NULL;
 
+		/* Make room by starting over. */
+		if (table_cache_entries >= MAX_TABLE_CACHE_ENTRIES)
+			free_table_cache();
+		if (!table_cache) table_cache = init_hash8();
+
+		if (table_cache) tce = mem_alloc(sizeof(*tce));
 		if (tce) {
-			tce->key.start = start;
-			tce->key.end = end;
-			tce->key.align = align;
-			tce->key.margin = margin;
-			tce->key.width = width;
-			tce->key.x = x;
-			tce->key.link_num = link_num;
+			timeval_T now;
+
+			copy_struct(&tce->key, &key);
 			copy_struct(&tce->part, part);
+			timeval_sub(&tce->duration, &start_time,
+				    timeval_now(&now));
 
 			if (!add_hash_item(table_cache,
 					   (unsigned char *) &tce->key,
@@ -2509,61 +2622,169 @@ ret:
 	return part;
 }
 
-void
-render_html_document(struct cache_entry *cached, struct document *document,
-		     struct string *buffer)
-{
+/** The state of the renderer kept in document.checkpoint while the document
+ * is still loading.  The next rendering then goes on parsing the newly
+ * arrived data instead of formatting the whole source again. */
+struct html_checkpoint {
 	struct html_context *html_context;
 	struct part *part;
-	unsigned char *start;
-	unsigned char *end;
-	struct string title;
+	void *html_state;
+	struct renderer_context renderer_context;
 	struct string head;
 
-	assert(cached && document);
-	if_assert_failed return;
+	/* A copy of the source parsed so far.  The parser keeps pointers
+	 * into it, so it cannot be the cache fragment, which moves as the
+	 * data arrives. */
+	struct string source;
 
-	if (!init_string(&head)) return;
+	/* Where the parsing stopped in @source. */
+	int offset;
 
-	if (cached->head) add_to_string(&head, cached->head);
+	/* The lines above this one are final and counted in the width. */
+	int height;
 
-	start = buffer->source;
-	end = buffer->source + buffer->length;
+	/* The height of the node of the whole document as the parsing left
+	 * it.  Meanwhile the node covers the lines rendered so far. */
+	int node_height;
+};
 
-	html_context = init_html_parser(cached->uri, &document->options,
-	                                start, end, &head, &title,
-	                                put_chars_conv, line_break,
-	                                html_special);
-	if (!html_context) return;
+/* Whether to render @buffer so that the rendering can be resumed once more
+ * data arrives.  Small documents are fast enough to format again. */
+static int
+want_html_checkpoint(struct cache_entry *cached, struct string *buffer)
+{
+	struct fragment *fragment;
 
-	renderer_context.g_ctrl_num = 0;
-	renderer_context.cached = cached;
-	renderer_context.convert_table = get_convert_table(head.source,
-							   document->options.cp,
-							   document->options.assume_cp,
-							   &document->cp,
-							   &document->cp_status,
-							   document->options.hard_assume);
+	if (!cached->incomplete
+	    || buffer->length < HTML_INCREMENTAL_MIN_SIZE
+	    || !get_opt_bool("document.html.incremental", NULL))
+		return 0;
+
+	/* Decoded documents cannot be compared with the cache when
+	 * resuming. */
+	fragment = get_cache_fragment(cached);
+	return fragment && fragment->data == buffer->source;
+}
+
+/* Where the parsing may stop so that the data near the end, which may be
+ * cut in the middle of a construct, is left for the next time. */
+static inline unsigned char *
+get_html_checkpoint(unsigned char *start, unsigned char *end)
+{
+	return end - start > HTML_CHECKPOINT_MARGIN
+	       ? end - HTML_CHECKPOINT_MARGIN : end;
+}
+
+int
+check_html_checkpoint(struct document *document, struct cache_entry *cached)
+{
+	struct html_checkpoint *checkpoint = document->checkpoint;
+	struct fragment *fragment;
+
+	if (!checkpoint || document->cached != cached)
+		return 0;
+
+	fragment = get_cache_fragment(cached);
+	return fragment
+	       && fragment->length >= checkpoint->source.length
+	       && !memcmp(fragment->data, checkpoint->source.source,
+			  checkpoint->source.length);
+}
+
+void
+done_html_checkpoint(struct document *document)
+{
+	struct html_checkpoint *checkpoint = document->checkpoint;
+	struct part *part;
+
+	if (!checkpoint) return;
+
+	document->checkpoint = NULL;
+	part = checkpoint->part;
+
+	done_html_parser_state(checkpoint->html_context, checkpoint->html_state);
+	done_html_parser(checkpoint->html_context);
+
+	mem_free_if(part->spaces);
 #ifdef CONFIG_UTF8
-	html_context->options->utf8 = is_cp_utf8(document->options.cp);
-#endif /* CONFIG_UTF8 */
-	html_context->doc_cp = document->cp;
+	mem_free_if(part->char_width);
+#endif
+	mem_free(part);
 
-	if (title.length) {
-		/* CSM_DEFAULT because init_html_parser() did not
-		 * decode entities in the title.  */
-		document->title = convert_string(renderer_context.convert_table,
-						 title.source, title.length,
-						 document->options.cp,
-						 CSM_DEFAULT, NULL, NULL, NULL);
+	done_string(&checkpoint->head);
+	done_string(&checkpoint->source);
+	mem_free(checkpoint);
+}
+
+/* Make the pointers into the source which the parser keeps point to its new
+ * location. */
+static void
+move_html_source(struct html_context *html_context, unsigned char *old,
+		 unsigned char *new_, int length)
+{
+	struct html_element *element;
+
+#define move_pointer(ptr) \
+	do { \
+		if ((ptr) >= old && (ptr) <= old + length) \
+			(ptr) = new_ + ((ptr) - old); \
+	} while (0)
+
+	foreach (element, html_context->stack) {
+		if (element->name) move_pointer(element->name);
+		if (element->options) move_pointer(element->options);
 	}
-	done_string(&title);
 
-	part = format_html_part(html_context, start, end, par_format.align,
-			        par_format.leftmargin,
-				document->options.box.width, document,
-			        0, 0, head.source, 1);
+	move_pointer(html_context->startf);
+	move_pointer(html_context->eoff);
+
+#undef move_pointer
+}
+
+/* Save the state when the parsing stopped at @stop and make the document
+ * look as if its source ended there. */
+static void
+suspend_html_document(struct document *document,
+		      struct html_checkpoint *checkpoint, unsigned char *stop)
+{
+	struct html_context *html_context = checkpoint->html_context;
+	int y;
+
+	checkpoint->offset = stop - checkpoint->source.source;
+	copy_struct(&checkpoint->renderer_context, &renderer_context);
+
+	if (!list_empty(document->nodes)) {
+		/* The node of the whole document was added first. */
+		struct node *node = document->nodes.prev;
 
+		checkpoint->node_height = node->box.height;
+		node->box.height = checkpoint->part->box.height;
+	}
+
+	/* The renderer allocates the lines again when it gets there, and
+	 * expects them to be cleared. */
+	while (document->height > checkpoint->height
+	       && !document->data[document->height - 1].length) {
+		mem_free_if(document->data[--document->height].chars);
+		memset(&document->data[document->height], 0,
+		       sizeof(*document->data));
+	}
+
+	for (y = checkpoint->height; y < document->height; y++)
+		int_lower_bound(&document->width, document->data[y].length);
+	checkpoint->height = document->height;
+
+	document->options.needs_width = 1;
+	document->color.background = html_bottom->parattr.color.background;
+	document->checkpoint = checkpoint;
+}
+
+/* Finish @document after all of its source was parsed into @part. */
+static void
+finish_html_document(struct html_context *html_context,
+		     struct document *document, struct part *part,
+		     struct string *head)
+{
 	/* Drop empty allocated lines at end of document if any
 	 * and adjust document height. */
 	while (document->height && !document->data[document->height - 1].length)
@@ -2610,8 +2831,180 @@ render_html_document(struct cache_entry *cached, struct document *document,
 
 	/* @part was residing in html_context so it has to stay alive until
 	 * done_html_parser(). */
-	done_string(&head);
+	done_string(head);
 	mem_free_if(part);
+}
+
+/* Go on rendering @document from where the last rendering stopped. */
+static void
+resume_html_document(struct cache_entry *cached, struct document *document,
+		     struct string *buffer)
+{
+	struct html_checkpoint *checkpoint = document->checkpoint;
+	struct html_context *html_context = checkpoint->html_context;
+	unsigned char *source = checkpoint->source.source;
+	int length = checkpoint->source.length;
+	unsigned char *start, *end, *stop;
+
+	/* check_html_checkpoint() made sure that data was only appended. */
+	if (buffer->length > length
+	    && add_bytes_to_string(&checkpoint->source, buffer->source + length,
+				   buffer->length - length)
+	    && checkpoint->source.source != source)
+		move_html_source(html_context, source,
+				 checkpoint->source.source, length);
+
+	start = checkpoint->source.source + checkpoint->offset;
+	end = checkpoint->source.source + checkpoint->source.length;
+
+	if (cached->incomplete) {
+		html_context->checkpoint = get_html_checkpoint(start, end);
+		/* Not enough new data to bother. */
+		if (html_context->checkpoint == end) return;
+	} else {
+		html_context->checkpoint = NULL;
+	}
+
+	if (!list_empty(document->nodes)) {
+		struct node *node = document->nodes.prev;
+
+		node->box.height = checkpoint->node_height;
+	}
+
+	copy_struct(&renderer_context, &checkpoint->renderer_context);
+	/* sort_links() may have dropped some links meanwhile. */
+	int_upper_bound(&renderer_context.last_link_to_move, document->nlinks);
+
+	stop = resume_html(start, end, checkpoint->part, html_context);
+	if (stop < end) {
+		suspend_html_document(document, checkpoint, stop);
+		return;
+	}
+
+	document->checkpoint = NULL;
+	end_html_part(html_context, checkpoint->part, 0, checkpoint->html_state);
+	finish_html_document(html_context, document, checkpoint->part,
+			     &checkpoint->head);
+	done_string(&checkpoint->source);
+	mem_free(checkpoint);
+}
+
+void
+render_html_document(struct cache_entry *cached, struct document *document,
+		     struct string *buffer)
+{
+	struct html_context *html_context;
+	struct html_checkpoint *checkpoint = NULL;
+	struct part *part;
+	unsigned char *start;
+	unsigned char *end;
+	struct string title;
+	struct string head;
+
+	assert(cached && document);
+	if_assert_failed return;
+
+	if (document->checkpoint) {
+		resume_html_document(cached, document, buffer);
+		return;
+	}
+
+	if (!init_string(&head)) return;
+
+	if (cached->head) add_to_string(&head, cached->head);
+
+	start = buffer->source;
+	end = buffer->source + buffer->length;
+
+	if (want_html_checkpoint(cached, buffer)) {
+		checkpoint = mem_calloc(1, sizeof(*checkpoint));
+		if (checkpoint
+		    && (!init_string(&checkpoint->source)
+			|| !add_bytes_to_string(&checkpoint->source,
+						buffer->source, buffer->length))) {
+			done_string(&checkpoint->source);
+			mem_free_set(&checkpoint, NULL);
+		}
+
+		if (checkpoint) {
+			start = checkpoint->source.source;
+			end = start + checkpoint->source.length;
+		}
+	}
+
+	html_context = init_html_parser(cached->uri, &document->options,
+	                                start, end, &head, &title,
+	                                put_chars_conv, line_break,
+	                                html_special);
+	if (!html_context) {
+		if (checkpoint) {
+			done_string(&checkpoint->source);
+			mem_free(checkpoint);
+		}
+		return;
+	}
+
+	renderer_context.g_ctrl_num = 0;
+	renderer_context.cached = cached;
+	renderer_context.table_cache_context
+		= hash_data(struri(cached->uri), strlen(struri(cached->uri)))
+		+ hash_data((unsigned char *) &document->options,
+			    offsetof(struct document_options, framename));
+	renderer_context.convert_table = get_convert_table(head.source,
+							   document->options.cp,
+							   document->options.assume_cp,
+							   &document->cp,
+							   &document->cp_status,
+							   document->options.hard_assume);
+#ifdef CONFIG_UTF8
+	html_context->options->utf8 = is_cp_utf8(document->options.cp);
+#endif /* CONFIG_UTF8 */
+	html_context->doc_cp = document->cp;
+
+	if (title.length) {
+		/* CSM_DEFAULT because init_html_parser() did not
+		 * decode entities in the title.  */
+		document->title = convert_string(renderer_context.convert_table,
+						 title.source, title.length,
+						 document->options.cp,
+						 CSM_DEFAULT, NULL, NULL, NULL);
+	}
+	done_string(&title);
+
+	if (checkpoint) {
+		/* Like format_html_part() but the parsing may stop early,
+		 * leaving the rest for resume_html_document(). */
+		void *html_state;
+
+		part = start_html_part(html_context, par_format.align,
+				       par_format.leftmargin,
+				       document->options.box.width, document,
+				       0, 0, 1, &html_state);
+		if (part) {
+			unsigned char *stop;
+
+			html_context->checkpoint = get_html_checkpoint(start, end);
+			stop = parse_html(start, end, part, head.source, html_context);
+
+			if (stop < end) {
+				checkpoint->html_context = html_context;
+				checkpoint->part = part;
+				checkpoint->html_state = html_state;
+				copy_struct(&checkpoint->head, &head);
+				suspend_html_document(document, checkpoint, stop);
+				return;
+			}
+
+			end_html_part(html_context, part, 0, html_state);
+		}
+	} else {
+		part = format_html_part(html_context, start, end, par_format.align,
+				        par_format.leftmargin,
+					document->options.box.width, document,
+				        0, 0, head.source, 1);
+	}
+
+	finish_html_document(html_context, document, part, &head);
 
 #if 0 /* debug purpose */
 	{
@@ -2630,4 +3023,9 @@ render_html_document(struct cache_entry *cached, struct document *document,
 		fclose(f);
 	}
 #endif
+
+	if (checkpoint) {
+		done_string(&checkpoint->source);
+		mem_free(checkpoint);
+	}
 }
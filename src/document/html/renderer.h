@@ -12,6 +12,11 @@ struct string;
 
 void render_html_document(struct cache_entry *cached, struct document *document, struct string *buffer);
 
+/* Whether the rendering of @document stopped while @cached was loading can
+ * go on with the data which arrived since. */
+int check_html_checkpoint(struct document *document, struct cache_entry *cached);
+void done_html_checkpoint(struct document *document);
+
 
 /* Interface with parser.c */
 
@@ -30,6 +35,7 @@ enum html_special_type {
 	SP_STYLESHEET,
 	SP_COLOR_LINK_LINES,
 	SP_SCRIPT,
+	SP_CHECKPOINT,
 };
 
 
@@ -66,6 +72,12 @@ void draw_frame_vchars(struct part *, int, int, int, unsigned char data, color_T
 
 void free_table_cache(void);
 
+/* Statistics of the cache of table cell layouts. */
+int get_table_cache_entry_count(void);
+long get_table_cache_hits(void);
+long get_table_cache_misses(void);
+milliseconds_T get_table_cache_saved_time(void);
+
 struct part *format_html_part(struct html_context *html_context, unsigned char *, unsigned char *, int, int, int, struct document *, int, int, unsigned char *, int);
 
 int dec2qwerty(int num, unsigned char *link_sym, const unsigned char *key, int base);
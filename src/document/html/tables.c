@@ -1354,5 +1354,4 @@ ret2:
 
 ret0:
 	html_context->table_level--;
-	if (!html_context->table_level) free_table_cache();
 }
@@ -0,0 +1,247 @@
+/* Benchmark going through the text, comments and elements of HTML */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "elinks.h"
+
+#include "document/html/parser/parse.h"
+#include "util/conv.h"
+#include "util/memory.h"
+#include "util/string.h"
+#include "util/test.h"
+
+
+/* What parse_html() did between the interesting chars before the text and
+ * comments were scanned more than a byte at a time.  Both walks use the
+ * same parse_element(). */
+static unsigned char *
+old_skip_comment(unsigned char *html, unsigned char *eof)
+{
+	if (html + 4 <= eof && html[2] == '-' && html[3] == '-') {
+		html += 4;
+		while (html < eof) {
+			if (html + 2 <= eof && html[0] == '-' && html[1] == '-') {
+				html += 2;
+				while (html < eof && *html == '-') html++;
+				while (html < eof && isspace(*html)) html++;
+				if (html >= eof) return eof;
+				if (*html == '>') return html + 1;
+				continue;
+			}
+			html++;
+		}
+
+	} else {
+		html += 2;
+		while (html < eof) {
+			if (html[0] == '>') return html + 1;
+			html++;
+		}
+	}
+
+	return eof;
+}
+
+/* The main loop of parse_html() without the output and the element
+ * handlers, going through the text one char at a time as it used to or a
+ * run of text at a time.  Both return the number of elements and comments
+ * found and put the number of chars of text in @text. */
+#define define_walk(walk, skip_text, skip_comment)			\
+static int								\
+walk(unsigned char *html, unsigned char *eof, int *text)		\
+{									\
+	unsigned char *base_pos = html;					\
+	int noupdate = 0;						\
+	int tags = 0;							\
+									\
+	while (html < eof) {						\
+		unsigned char *name, *attr, *end;			\
+		int namelen;						\
+									\
+		if (!noupdate) {					\
+			*text += html - base_pos;			\
+			base_pos = html;				\
+		} else {						\
+			noupdate = 0;					\
+		}							\
+									\
+		if (isspace(*html)) {					\
+			html++;						\
+			if (html < eof && !isspace(*html))		\
+				noupdate = 1;				\
+			continue;					\
+		}							\
+									\
+		if (*html < ' ') {					\
+			html++;						\
+			continue;					\
+		}							\
+									\
+		if (html + 2 <= eof && html[0] == '<'			\
+		    && (html[1] == '!' || html[1] == '?')) {		\
+			*text += html - base_pos;			\
+			base_pos = html = skip_comment(html, eof);	\
+			tags++;						\
+			continue;					\
+		}							\
+									\
+		if (*html != '<'					\
+		    || parse_element(html, eof, &name, &namelen, &attr, &end)) { \
+			html = skip_text;				\
+			noupdate = 1;					\
+			continue;					\
+		}							\
+									\
+		*text += html - base_pos;				\
+		base_pos = html = end;					\
+		tags++;							\
+	}								\
+									\
+	*text += html - base_pos;					\
+	return tags;							\
+}
+
+define_walk(walk_old, html + 1, old_skip_comment)
+define_walk(walk_new, skip_html_text(html + 1, eof), skip_comment)
+
+/* A page of paragraphs, links and comments like the ones of the
+ * documentation and mailing list archives. */
+static void
+make_page(struct string *page, int paragraphs)
+{
+	int i;
+
+	add_to_string(page, "<html><head><title>Benchmark</title></head><body>\n");
+
+	for (i = 0; i < paragraphs; i++) {
+		add_format_to_string(page, "<!-- paragraph %d -->\n<p class=\"text\">", i);
+		add_to_string(page, "The quick brown fox jumps over the lazy dog, "
+				    "and then it runs back into the forest again.\n");
+		add_format_to_string(page, "<a href=\"http://www.example.org/"
+					   "archives/2009/message%d.html\" "
+					   "title=\"Message number %d of the "
+					   "archives\">Next message</a>", i, i);
+		add_to_string(page, " &amp; some more text.</p>\n");
+	}
+
+	add_to_string(page, "</body></html>\n");
+}
+
+static double
+seconds(clock_t start)
+{
+	return (double) (clock() - start) / CLOCKS_PER_SEC;
+}
+
+/* Walk @page both ways @rounds times, check that the walks agree and print
+ * the per page times in microseconds, which are added to @old_total and
+ * @new_total. */
+static void
+bench_page(const char *name, struct string *page, int rounds,
+	   double *old_total, double *new_total)
+{
+	unsigned char *eof = page->source + page->length;
+	int old_tags = 0, new_tags = 0;
+	int old_text = 0, new_text = 0;
+	clock_t start;
+	double o, n;
+	int r;
+
+	start = clock();
+	for (r = 0; r < rounds; r++)
+		old_tags += walk_old(page->source, eof, &old_text);
+	o = seconds(start) * 1e6 / rounds;
+
+	start = clock();
+	for (r = 0; r < rounds; r++)
+		new_tags += walk_new(page->source, eof, &new_text);
+	n = seconds(start) * 1e6 / rounds;
+
+	if (old_tags != new_tags || old_text != new_text)
+		die("%s: %d elements and comments and %d chars of text "
+		    "found but %d and %d expected", name,
+		    new_tags / rounds, new_text / rounds,
+		    old_tags / rounds, old_text / rounds);
+
+	printf("%-24s %8d %8d %12.1f %12.1f %7.2fx\n", name, page->length,
+	       old_tags / rounds, o, n, n > 0 ? o / n : 0.0);
+
+	*old_total += o;
+	*new_total += n;
+}
+
+static void
+read_page(struct string *page, const char *filename)
+{
+	FILE *file = fopen(filename, "rb");
+	unsigned char buf[4096];
+	size_t len;
+
+	if (!file) die("cannot open %s", filename);
+	while ((len = fread(buf, 1, sizeof(buf), file)) > 0)
+		add_bytes_to_string(page, buf, len);
+	fclose(file);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int rounds = 200;
+	struct string page;
+	double old_total = 0, new_total = 0;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		char *arg = argv[i];
+
+		if (strncmp(arg, "--", 2))
+			break;
+
+		arg += 2;
+
+		if (get_test_opt(&arg, "rounds", &i, argc, argv, "a number")) {
+			rounds = atoi(arg);
+			if (rounds <= 0) die("--rounds expects a positive number");
+
+		} else {
+			die("usage: %s [--rounds N] [FILE...]", argv[0]);
+		}
+	}
+
+	printf("%-24s %8s %8s %12s %12s %8s\n", "page", "bytes", "elements",
+	       "chars (us)", "runs (us)", "speedup");
+
+	/* Go through each of the given pages, or through a made up page if
+	 * there are none. */
+	if (i == argc) {
+		if (!init_string(&page)) die("out of memory");
+		make_page(&page, 2000);
+		bench_page("(made up)", &page, rounds, &old_total, &new_total);
+		done_string(&page);
+		return 0;
+	}
+
+	for (; i < argc; i++) {
+		const char *name = strrchr(argv[i], '/');
+
+		if (!init_string(&page)) die("out of memory");
+		read_page(&page, argv[i]);
+		bench_page(name ? name + 1 : argv[i], &page, rounds,
+			   &old_total, &new_total);
+		done_string(&page);
+	}
+
+	printf("%-24s %8s %8s %12.1f %12.1f %7.2fx\n", "total", "", "",
+	       old_total, new_total,
+	       new_total > 0 ? old_total / new_total : 0.0);
+
+	return 0;
+}
@@ -0,0 +1,427 @@
+/* Test the HTML tokenizer against the byte at a time loops it replaced */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "elinks.h"
+
+#include "document/html/parser/parse.h"
+#include "intl/charsets.h"
+#include "util/conv.h"
+#include "util/memory.h"
+#include "util/string.h"
+
+#define ROUNDS 20000
+#define MAX_LENGTH 80
+
+static int count_fail = 0;
+
+#define check(cond, msg, round, offset) \
+	do { \
+		if (!(cond)) { \
+			fprintf(stderr, "Test failed: %s (round %d, offset %d)\n", \
+				msg, round, offset); \
+			count_fail++; \
+		} \
+	} while (0)
+
+
+/* The scanning as parse_html() used to do it.  These are what the text,
+ * comment, element and attribute scanners must still agree with. */
+
+#define end_of_tag(c) ((c) == '>' || (c) == '<')
+
+static inline int
+atchr(register unsigned char c)
+{
+	return (c < 127 && (c > '>' || (c > ' ' && c != '=' && !end_of_tag(c))));
+}
+
+/* The chars for which parse_html() goes around its loop only to find that
+ * they are text, the space only when the next char is such a char. */
+#define is_plain_text(c) \
+	((c) != '<' && (c) != '&' && (c) > ' ' && !isspace(c))
+
+static unsigned char *
+old_skip_html_text(unsigned char *html, unsigned char *eof)
+{
+	while (html < eof) {
+		if (*html == ' ' && html + 1 < eof && is_plain_text(html[1])) {
+			html++;
+			continue;
+		}
+
+		if (!is_plain_text(*html))
+			break;
+		html++;
+	}
+
+	return html;
+}
+
+static unsigned char *
+old_find_html_tag(unsigned char *html, unsigned char *eof)
+{
+	while (html < eof && *html != '<')
+		html++;
+
+	return html;
+}
+
+static unsigned char *
+old_skip_comment(unsigned char *html, unsigned char *eof)
+{
+	if (html + 4 <= eof && html[2] == '-' && html[3] == '-') {
+		html += 4;
+		while (html < eof) {
+			if (html + 2 <= eof && html[0] == '-' && html[1] == '-') {
+				html += 2;
+				while (html < eof && *html == '-') html++;
+				while (html < eof && isspace(*html)) html++;
+				if (html >= eof) return eof;
+				if (*html == '>') return html + 1;
+				continue;
+			}
+			html++;
+		}
+
+	} else {
+		html += 2;
+		while (html < eof) {
+			if (html[0] == '>') return html + 1;
+			html++;
+		}
+	}
+
+	return eof;
+}
+
+static int
+old_parse_element(register unsigned char *e, unsigned char *eof,
+		  unsigned char **name, int *namelen,
+		  unsigned char **attr, unsigned char **end)
+{
+#define next_char() if (++e == eof) return -1;
+
+	if (e >= eof || *e != '<') return -1;
+
+	next_char();
+	if (name) *name = e;
+
+	if (*e == '/') next_char();
+	if (!isident(*e)) return -1;
+
+	while (isident(*e)) next_char();
+
+	if (!isspace(*e) && !end_of_tag(*e) && *e != '/' && *e != ':' && *e != '=')
+		return -1;
+
+	if (name && namelen) *namelen = e - *name;
+
+	while (isspace(*e) || *e == '/' || *e == ':') next_char();
+
+	while (!atchr(*e) && !end_of_tag(*e) && !isspace(*e)) next_char();
+
+	if (attr) *attr = e;
+
+next_attr:
+	while (isspace(*e)) next_char();
+
+	while (!atchr(*e) && !end_of_tag(*e) && !isspace(*e)) next_char();
+
+	if (end_of_tag(*e)) goto end;
+
+	while (atchr(*e)) next_char();
+	while (isspace(*e)) next_char();
+
+	if (*e != '=') {
+		if (end_of_tag(*e)) goto end;
+		goto next_attr;
+	}
+	next_char();
+
+	while (isspace(*e)) next_char();
+
+	if (isquote(*e)) {
+		unsigned char quote = *e;
+
+		next_char();
+		while (*e != quote) next_char();
+		next_char();
+	} else {
+		while (!isspace(*e) && !end_of_tag(*e)) next_char();
+	}
+
+	while (isspace(*e)) next_char();
+
+	if (!end_of_tag(*e)) goto next_attr;
+
+end:
+	if (end) *end = e + (*e == '>');
+
+	return 0;
+#undef next_char
+}
+
+#define add_chr(s, l, c)						\
+	do {								\
+		if (!mem_align_alloc(&(s), l, (l) + 1, 0xFF)) return NULL; \
+		(s)[(l)++] = (c);					\
+	} while (0)
+
+static unsigned char *
+old_get_attr_value(register unsigned char *e, unsigned char *name,
+		   int cp, enum html_attr_flags flags)
+{
+	unsigned char *n;
+	unsigned char *name_start;
+	unsigned char *attr = NULL;
+	int attrlen = 0;
+	int found;
+
+next_attr:
+	skip_space(e);
+	if (end_of_tag(*e) || !atchr(*e)) goto parse_error;
+	n = name;
+	name_start = e;
+
+	while (atchr(*n) && atchr(*e) && c_toupper(*e) == c_toupper(*n)) e++, n++;
+	found = !*n && !atchr(*e);
+
+	if (found && (flags & HTML_ATTR_TEST)) return name_start;
+
+	while (atchr(*e)) e++;
+	skip_space(e);
+	if (*e != '=') {
+		if (found) goto found_endattr;
+		goto next_attr;
+	}
+	e++;
+	skip_space(e);
+
+	if (found) {
+		if (!isquote(*e)) {
+			while (!isspace(*e) && !end_of_tag(*e)) {
+				if (!*e) goto parse_error;
+				add_chr(attr, attrlen, *e);
+				e++;
+			}
+		} else {
+			unsigned char quote = *e;
+
+			while (*(++e) != quote) {
+				if (!*e) goto parse_error;
+				if (flags & HTML_ATTR_LITERAL_NL)
+					add_chr(attr, attrlen, *e);
+				else if (*e == ASCII_CR) continue;
+				else if (*e != ASCII_TAB && *e != ASCII_LF)
+					add_chr(attr, attrlen, *e);
+				else if (!(flags & HTML_ATTR_EAT_NL))
+					add_chr(attr, attrlen, ' ');
+			}
+			e++;
+		}
+
+found_endattr:
+		add_chr(attr, attrlen, '\0');
+		attrlen--;
+
+		if (memchr(attr, '&', attrlen)) {
+			unsigned char *saved_attr = attr;
+
+			attr = convert_string(NULL, saved_attr, attrlen, cp,
+			                      CSM_QUERY, NULL, NULL, NULL);
+			mem_free(saved_attr);
+		}
+
+		return attr;
+
+	} else {
+		if (!isquote(*e)) {
+			while (!isspace(*e) && !end_of_tag(*e)) {
+				if (!*e) goto parse_error;
+				e++;
+			}
+		} else {
+			unsigned char quote = *e;
+
+			while (*(++e) != quote)
+				if (!*e) goto parse_error;
+			e++;
+		}
+	}
+
+	goto next_attr;
+
+parse_error:
+	mem_free_if(attr);
+	return NULL;
+}
+
+#undef add_chr
+
+
+/* Random markup, mostly of the chars the scanners look for.  The buffer
+ * is NUL terminated like the source of a document.  Each call uses a
+ * few of the pieces, so that some runs of text are long enough to be
+ * scanned by whole words. */
+static int
+fill_random_html(unsigned char *buf)
+{
+	static const unsigned char *pieces[] = {
+		"<", ">", "<!--", "-->", "--", "-", "<!", "<?", "</", "/",
+		"=", "\"", "'", " ", "\t", "\n", "\r", "&", "&amp;", "&#65;",
+		"a", "href", "HREF", "id", "x", "p", "img", "word",
+		"longerwordlongerword", "\xA0", "\xE9", "\x85", "\x01",
+	};
+	static const int count = sizeof(pieces) / sizeof(*pieces);
+	int length = 0;
+	int used = 1 + rand() % count;
+
+	while (1) {
+		const unsigned char *piece = pieces[rand() % used];
+		int piecelen = strlen(piece);
+
+		if (length + piecelen > MAX_LENGTH)
+			break;
+
+		memcpy(buf + length, piece, piecelen);
+		length += piecelen;
+
+		if (!(rand() % 16))
+			break;
+	}
+
+	buf[length] = '\0';
+
+	return length;
+}
+
+static int
+same_string(unsigned char *a, unsigned char *b)
+{
+	if (!a || !b) return a == b;
+
+	return !strcmp(a, b);
+}
+
+static void
+test_text(int round, unsigned char *buf, int length)
+{
+	int i;
+
+	for (i = 0; i <= length; i++) {
+		unsigned char *eof;
+
+		for (eof = buf + i; eof <= buf + length; eof++) {
+			check(skip_html_text(buf + i, eof)
+			      == old_skip_html_text(buf + i, eof),
+			      "skip_html_text", round, i);
+			check(find_html_tag(buf + i, eof)
+			      == old_find_html_tag(buf + i, eof),
+			      "find_html_tag", round, i);
+		}
+	}
+}
+
+static void
+test_elements(int round, unsigned char *buf, int length)
+{
+	unsigned char *eof = buf + length;
+	int i;
+
+	for (i = 0; i < length; i++) {
+		unsigned char *name = NULL, *attr = NULL, *end = NULL;
+		unsigned char *old_name = NULL, *old_attr = NULL, *old_end = NULL;
+		int namelen = 0, old_namelen = 0;
+		int ret, old_ret;
+
+		if (buf[i] != '<') continue;
+
+		if (i + 2 <= length && (buf[i + 1] == '!' || buf[i + 1] == '?'))
+			check(skip_comment(buf + i, eof)
+			      == old_skip_comment(buf + i, eof),
+			      "skip_comment", round, i);
+
+		ret = parse_element(buf + i, eof, &name, &namelen, &attr, &end);
+		old_ret = old_parse_element(buf + i, eof, &old_name,
+					    &old_namelen, &old_attr, &old_end);
+
+		check(ret == old_ret, "parse_element result", round, i);
+		if (ret || old_ret) continue;
+
+		check(name == old_name && namelen == old_namelen
+		      && attr == old_attr && end == old_end,
+		      "parse_element pointers", round, i);
+	}
+}
+
+static void
+test_attributes(int round, unsigned char *buf, int length, int cp)
+{
+	static unsigned char *names[] = { "a", "href", "id", "x" };
+	static const enum html_attr_flags flags[] = {
+		HTML_ATTR_NONE, HTML_ATTR_TEST, HTML_ATTR_EAT_NL,
+		HTML_ATTR_LITERAL_NL,
+	};
+	int i, n, f;
+
+	for (i = 0; i < length; i++) {
+		for (n = 0; n < sizeof(names) / sizeof(*names); n++) {
+			for (f = 0; f < sizeof(flags) / sizeof(*flags); f++) {
+				unsigned char *value, *old_value;
+
+				value = get_attr_value(buf + i, names[n], cp,
+						       flags[f]);
+				old_value = old_get_attr_value(buf + i, names[n],
+							       cp, flags[f]);
+
+				if (flags[f] & HTML_ATTR_TEST) {
+					check(value == old_value,
+					      "get_attr_value test", round, i);
+					continue;
+				}
+
+				check(same_string(value, old_value),
+				      "get_attr_value", round, i);
+				mem_free_if(value);
+				mem_free_if(old_value);
+			}
+		}
+	}
+}
+
+int
+main(void)
+{
+	unsigned char buf[MAX_LENGTH + 1];
+	int cp;
+	int round;
+
+	init_charsets_lookup();
+	cp = get_cp_index("ISO-8859-1");
+	srand(25);
+
+	for (round = 0; round < ROUNDS; round++) {
+		int length = fill_random_html(buf);
+
+		test_text(round, buf, length);
+		test_elements(round, buf, length);
+		test_attributes(round, buf, length, cp);
+	}
+
+	free_charsets_lookup();
+
+	if (count_fail) {
+		printf("Summary of HTML scanner tests: %d failed\n", count_fail);
+		return EXIT_FAILURE;
+	}
+
+	printf("Summary of HTML scanner tests: all passed\n");
+	return EXIT_SUCCESS;
+}
@@ -52,10 +52,37 @@ struct plain_renderer {
 	/* The current line number */
 	int lineno;
 
+	/* Where the lines go when they are only indexed, not rendered */
+	struct plain_index *index;
+
 	/* Are we doing line compression */
 	unsigned int compress:1;
 };
 
+/* Where the text of one line of an indexed document is in the source */
+struct plain_line {
+	int offset;
+	int width;
+};
+
+/* The lines of a large document are rendered from the cache entry when
+ * they come into view, so that neither the time nor the memory needed
+ * grows with the part of the document that is never looked at. */
+struct plain_index {
+	struct plain_line *lines;
+
+	/* The length of the source the lines were found in */
+	int length;
+
+	/* The lines from @top up to @bottom are rendered. */
+	int top, bottom;
+};
+
+#define PLAIN_LINES_GRANULARITY	0x3FF
+
+#define realloc_plain_lines(index, size) \
+	mem_align_alloc(&(index)->lines, size, (size) + 1, PLAIN_LINES_GRANULARITY)
+
 #define realloc_document_links(doc, size) \
 	ALIGN_LINK(&(doc)->links, (doc)->nlinks, size)
 
@@ -591,6 +618,27 @@ add_node(struct plain_renderer *renderer, int x, int width, int height)
 	return node;
 }
 
+/* Remembers where the current line of @renderer is in the source instead
+ * of rendering it.  The line will be about @cells wide. */
+static int
+add_plain_line(struct plain_renderer *renderer, unsigned char *line,
+	       int width, int cells)
+{
+	struct plain_index *index = renderer->index;
+	struct plain_line *plain_line;
+
+	if (!realloc_plain_lines(index, renderer->lineno))
+		return 0;
+
+	plain_line = &index->lines[renderer->lineno];
+	plain_line->offset = line - renderer->source;
+	plain_line->width = width;
+
+	int_lower_bound(&renderer->document->width, cells);
+
+	return 1;
+}
+
 static void
 add_document_lines(struct plain_renderer *renderer)
 {
@@ -682,16 +730,24 @@ add_document_lines(struct plain_renderer *renderer)
 
 		assert(width >= 0);
 
-		/* We will touch the supplied source, so better replicate it. */
-		xsource = memacpy(source, width);
-		if (!xsource) continue;
+		if (renderer->index) {
+			if (!add_plain_line(renderer, source, width,
+					    cells + tab_spaces))
+				return;
 
-		added = add_document_line(renderer, xsource, width);
-		mem_free(xsource);
+		} else {
+			/* We will touch the supplied source, so better
+			 * replicate it. */
+			xsource = memacpy(source, width);
+			if (!xsource) continue;
+
+			added = add_document_line(renderer, xsource, width);
+			mem_free(xsource);
 
-		if (added) {
-			/* Add (search) nodes on a line by line basis */
-			add_node(renderer, 0, added, 1);
+			if (added) {
+				/* Add (search) nodes on a line by line basis */
+				add_node(renderer, 0, added, 1);
+			}
 		}
 
 		/* Skip end of line chars too. */
@@ -703,6 +759,26 @@ add_document_lines(struct plain_renderer *renderer)
 	assert(!length);
 }
 
+/* Whether to only index the lines of @buffer and render them later. */
+static int
+want_plain_index(struct cache_entry *cached, struct document *document,
+		 struct string *buffer)
+{
+	struct fragment *fragment;
+
+	/* The links are numbered in the order of the lines, and the colors
+	 * of escape sequences go on from one line to the next. */
+	if (buffer->length < PLAIN_INDEX_MIN_SIZE
+	    || document->options.plain_display_links
+	    || memchr(buffer->source, 27, buffer->length))
+		return 0;
+
+	/* The lines are rendered from the cache entry, so decoded
+	 * documents have to be rendered at once. */
+	fragment = get_cache_fragment(cached);
+	return fragment && fragment->data == buffer->source;
+}
+
 void
 render_plain_document(struct cache_entry *cached, struct document *document,
 		      struct string *buffer)
@@ -736,5 +812,103 @@ render_plain_document(struct cache_entry *cached, struct document *document,
 	/* Setup the style */
 	init_template(&renderer.template_, &document->options);
 
+	renderer.index = NULL;
+	if (want_plain_index(cached, document, buffer))
+		renderer.index = mem_calloc(1, sizeof(*renderer.index));
+
 	add_document_lines(&renderer);
+
+	if (renderer.index) {
+		document->plain_index = renderer.index;
+		document->plain_index->length = buffer->length;
+
+		if (renderer.lineno > 0
+		    && realloc_lines(document, renderer.lineno - 1)) {
+			/* One search node for the whole document, since
+			 * get_srch() renders the lines as it goes. */
+			renderer.lineno = 0;
+			add_node(&renderer, 0, document->width,
+				 document->height);
+		}
+	}
+}
+
+void
+render_plain_lines(struct document *document, int y, int height)
+{
+	struct plain_index *index = document->plain_index;
+	struct cache_entry *cached = document->cached;
+	struct plain_renderer renderer;
+	struct fragment *fragment;
+	int top, bottom;
+
+	if (!index) return;
+
+	int_bounds(&y, 0, document->height);
+	int_upper_bound(&height, document->height - y);
+	if (y >= index->top && y + height <= index->bottom)
+		return;
+
+	/* The lines are rendered from the source they were found in, so
+	 * leave them be once the cache entry has changed. The document
+	 * is rendered again for the new source anyway. */
+	fragment = get_cache_fragment(cached);
+	if (!fragment || cached->cache_id != document->cache_id
+	    || fragment->length < index->length)
+		return;
+
+	top = int_max(y - PLAIN_INDEX_MARGIN, 0);
+	bottom = int_min(y + height + PLAIN_INDEX_MARGIN, document->height);
+
+	for (y = index->top; y < index->bottom; y++) {
+		struct line *line = &document->data[y];
+
+		if (y >= top && y < bottom) continue;
+
+		mem_free_set(&line->chars, NULL);
+		line->length = 0;
+	}
+
+	renderer.document = document;
+	renderer.source = fragment->data;
+	renderer.length = index->length;
+	renderer.convert_table = get_translation_table(document->cp,
+						       document->options.cp);
+	renderer.index = index;
+
+	for (y = top; y < bottom; y++) {
+		struct plain_line *line = &index->lines[y];
+		unsigned char *xsource;
+		int added;
+
+		if (y >= index->top && y < index->bottom) continue;
+
+		xsource = memacpy(&renderer.source[line->offset], line->width);
+		if (!xsource) continue;
+
+		/* The lines are rendered in any order, so each one starts
+		 * with the default style. */
+		init_template(&renderer.template_, &document->options);
+		renderer.lineno = y;
+
+		added = add_document_line(&renderer, xsource, line->width);
+		mem_free(xsource);
+
+		int_lower_bound(&document->width, added);
+	}
+
+	index->top = top;
+	index->bottom = bottom;
+}
+
+void
+done_plain_index(struct document *document)
+{
+	struct plain_index *index = document->plain_index;
+
+	if (!index) return;
+
+	document->plain_index = NULL;
+	mem_free_if(index->lines);
+	mem_free(index);
 }
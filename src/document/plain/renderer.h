@@ -8,4 +8,9 @@ struct string;
 
 void render_plain_document(struct cache_entry *cached, struct document *document, struct string *buffer);
 
+/* Renders the lines from @y up to @y + @height of a document which has a
+ * plain_index, and forgets the rendered lines far from them. */
+void render_plain_lines(struct document *document, int y, int height);
+void done_plain_index(struct document *document);
+
 #endif
@@ -14,6 +14,7 @@
 
 #include "cache/cache.h"
 #include "config/options.h"
+#include "document/disk.h"
 #include "document/document.h"
 #include "document/dom/renderer.h"
 #include "document/html/frames.h"
@@ -345,10 +346,12 @@ render_document(struct view_state *vs, struct document_view *doc_view,
 	}
 
 	document = get_cached_document(cached, options);
+	if (!document) document = load_disk_document(cached, options);
 	if (document) {
 		doc_view->document = document;
 	} else {
-		document = init_document(cached, options);
+		document = get_partial_document(cached, options);
+		if (!document) document = init_document(cached, options);
 		if (!document) return;
 		doc_view->document = document;
 
@@ -384,6 +387,7 @@ render_document(struct view_state *vs, struct document_view *doc_view,
 #ifdef CONFIG_CSS
 		document->css_magic = get_document_css_magic(document);
 #endif
+		save_disk_document(document);
 	}
 #ifdef CONFIG_ECMASCRIPT
 	if (!vs->ecmascript_fragile)
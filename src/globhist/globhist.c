@@ -26,6 +26,9 @@
 #include "main/module.h"
 #include "main/object.h"
 #include "main/select.h"
+#include "network/dns.h"
+#include "protocol/protocol.h"
+#include "protocol/uri.h"
 #include "util/conv.h"
 #include "util/file.h"
 #include "util/hash.h"
@@ -403,6 +406,95 @@ write_global_history(void)
 	if (!secure_close(ssi)) global_history.dirty = 0;
 }
 
+struct prefetch_host {
+	unsigned char *host;	/* Points into the URL of a history item. */
+	int hostlen;
+	int count;
+};
+
+/* Look up the hosts which appear most often in the global history in the
+ * background, see the connection.prefetch_hosts option. */
+static void
+prefetch_global_history_hosts(void)
+{
+	int max_hosts = get_opt_int("connection.prefetch_hosts", NULL);
+	struct global_history_item *history_item;
+	struct prefetch_host **top;
+	struct hash_item *item;
+	struct hash *hosts;
+	int i, tops = 0;
+
+	if (max_hosts <= 0
+	    || get_cmd_opt_bool("dump")
+	    || get_cmd_opt_bool("source"))
+		return;
+
+	hosts = init_hash8();
+	if (!hosts) return;
+
+	foreach (history_item, global_history.entries) {
+		struct prefetch_host *host;
+		struct uri uri;
+
+		if (parse_uri(&uri, history_item->url) != URI_ERRNO_OK
+		    || !uri.hostlen || uri.protocol == PROTOCOL_FILE)
+			continue;
+
+		item = get_hash_item(hosts, uri.host, uri.hostlen);
+		if (item) {
+			host = item->value;
+			host->count++;
+			continue;
+		}
+
+		host = mem_alloc(sizeof(*host));
+		if (!host) break;
+
+		host->host = uri.host;
+		host->hostlen = uri.hostlen;
+		host->count = 1;
+
+		if (!add_hash_item(hosts, uri.host, uri.hostlen, host)) {
+			mem_free(host);
+			break;
+		}
+	}
+
+	top = mem_calloc(max_hosts, sizeof(*top));
+	if (top) {
+		/* Insert each host into @top, which is kept sorted with
+		 * the most frequent host first. */
+		foreach_hash_item (item, *hosts, i) {
+			struct prefetch_host *host = item->value;
+			int pos = tops;
+
+			for (; pos > 0 && top[pos - 1]->count < host->count; pos--)
+				if (pos < max_hosts)
+					top[pos] = top[pos - 1];
+
+			if (pos >= max_hosts) continue;
+
+			top[pos] = host;
+			if (tops < max_hosts) tops++;
+		}
+
+		for (i = 0; i < tops; i++) {
+			unsigned char *name = memacpy(top[i]->host,
+						      top[i]->hostlen);
+
+			if (!name) continue;
+			prefetch_dns_host(name);
+			mem_free(name);
+		}
+
+		mem_free(top);
+	}
+
+	foreach_hash_item (item, *hosts, i)
+		mem_free(item->value);
+	free_hash(&hosts);
+}
+
 static void
 free_global_history(void)
 {
@@ -434,6 +526,7 @@ static void
 init_global_history(struct module *module)
 {
 	read_global_history();
+	prefetch_global_history_hosts();
 }
 
 static void
@@ -183,6 +183,7 @@ init(void)
 		}
 
 		init_b = 1;
+		init_dns();
 		init_modules(builtin_modules);
 	}
 
@@ -285,10 +286,12 @@ terminate_all_subsystems(void)
 		trigger_event_name("quit");
 #endif
 		free_history_lists();
+		done_dns();
 		done_modules(builtin_modules);
 		done_saved_session_info();
 	}
 
+	save_cache_to_disk();
 	shrink_memory(1);
 	free_charsets_lookup();
 	free_colors_lookup();
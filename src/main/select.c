@@ -5,6 +5,9 @@
 #endif
 
 #include <errno.h>
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
 #include <signal.h>
 #include <string.h> /* FreeBSD FD_ZERO() macro calls bzero() */
 #ifdef HAVE_SYS_SIGNAL_H
@@ -46,20 +49,116 @@
 #define FD_SETSIZE 1024
 #endif
 
+#ifdef CONFIG_OS_WIN32
+/* CreatePipe produces big numbers for handles */
+#undef FD_SETSIZE
+#define FD_SETSIZE 4096
+#endif
+
+/* The platforms with their own select() overrides must keep using it. */
+#if !defined(CONFIG_OS_WIN32) && !defined(CONFIG_OS_BEOS)
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_EPOLL_CREATE)
+#define USE_EPOLL
+#include <sys/epoll.h>
+#endif
+#if defined(HAVE_POLL_H) && defined(HAVE_POLL)
+#define USE_POLL
+#include <poll.h>
+#endif
+#endif
+
+/* Events which a descriptor is either waiting for (@thread.events) or has
+ * pending for dispatch (@thread.revents). */
+enum select_event {
+	SELECT_EVENT_READ  = 1,
+	SELECT_EVENT_WRITE = 2,
+	SELECT_EVENT_ERROR = 4,
+};
+
 struct thread {
 	select_handler_T read_func;
 	select_handler_T write_func;
 	select_handler_T error_func;
 	void *data;
+
+	/* Mask of enum select_event the backend is watching. */
+	unsigned int events:3;
+	/* Mask of enum select_event reported by the last wait and not yet
+	 * dispatched. set_handlers() clears the bits whose handler goes
+	 * away so that a reused descriptor never sees stale events. */
+	unsigned int revents:3;
+	/* The epoll backend refused this descriptor (regular files) so it
+	 * is treated as always ready, just like select() does. */
+	unsigned int always_ready:1;
+
+	/* Index into the @pollfds array of the poll backend. */
+	int poll_index;
 };
 
-#ifdef CONFIG_OS_WIN32
-/* CreatePipe produces big numbers for handles */
-#undef FD_SETSIZE
-#define FD_SETSIZE 4096
-#endif
+/* Indexed by the file descriptor; grows on demand in set_handlers(). */
+static struct thread *threads;
+static int threads_size;
+
+static int handles_count;
+
+/* Descriptors with pending events, filled by the backend wait function. */
+static int *ready_fds;
+static int ready_fds_size;
+static int ready_count;
+
+/* The interface every event notification mechanism has to provide. */
+struct select_backend {
+	const char *name;
+
+	/* Returns zero if the backend is unusable on this system. */
+	int (*init)(void);
+
+	/* Start watching @fd for @events instead of @thread.events. Returns
+	 * zero if the descriptor cannot be watched. */
+	int (*update)(int fd, int events);
+
+	/* Wait at most @timeout (NULL means forever) and queue the ready
+	 * descriptors using add_ready_fd(). Returns -1 with errno set on
+	 * failure. */
+	int (*wait)(timeval_T *timeout);
+};
+
+static struct select_backend *backend;
+
+int
+get_file_handles_count(void)
+{
+	return handles_count;
+}
+
+static void
+add_ready_fd(int fd, int revents)
+{
+	revents &= threads[fd].events;
+	if (!revents) return;
+
+	if (!threads[fd].revents) {
+		if (ready_count >= ready_fds_size) {
+			if (!mem_align_alloc(&ready_fds, ready_fds_size,
+					     ready_count + 1, 0x3F))
+				return;
+			ready_fds_size = ALIGN_MEMORY_SIZE(ready_count + 1, 0x3F);
+		}
+		ready_fds[ready_count++] = fd;
+	}
+
+	threads[fd].revents |= revents;
+}
+
+static milliseconds_T
+timeout_to_milliseconds(timeval_T *timeout)
+{
+	/* Round up so that the loop does not spin until a timer expires. */
+	return timeout->sec * 1000 + (timeout->usec + 999) / 1000;
+}
+
 
-static struct thread threads[FD_SETSIZE];
+/* The select() backend. It is always available and bounded by FD_SETSIZE. */
 
 static fd_set w_read;
 static fd_set w_write;
@@ -71,17 +170,327 @@ static fd_set x_error;
 
 static int w_max;
 
-int
-get_file_handles_count(void)
+static int
+select_backend_init(void)
+{
+	FD_ZERO(&w_read);
+	FD_ZERO(&w_write);
+	FD_ZERO(&w_error);
+	w_max = 0;
+	return 1;
+}
+
+static int
+select_backend_update(int fd, int events)
+{
+#ifndef CONFIG_OS_WIN32
+	assertm(fd < FD_SETSIZE,
+		"set_handlers: handle %d >= FD_SETSIZE %d",
+		fd, FD_SETSIZE);
+	if_assert_failed return 0;
+#endif
+
+	if (events & SELECT_EVENT_READ) FD_SET(fd, &w_read);
+	else FD_CLR(fd, &w_read);
+
+	if (events & SELECT_EVENT_WRITE) FD_SET(fd, &w_write);
+	else FD_CLR(fd, &w_write);
+
+	if (events & SELECT_EVENT_ERROR) FD_SET(fd, &w_error);
+	else FD_CLR(fd, &w_error);
+
+	if (events) {
+		if (fd >= w_max) w_max = fd + 1;
+	} else if (fd == w_max - 1) {
+		int i;
+
+		for (i = fd - 1; i >= 0; i--)
+			if (FD_ISSET(i, &w_read)
+			    || FD_ISSET(i, &w_write)
+			    || FD_ISSET(i, &w_error))
+				break;
+		w_max = i + 1;
+	}
+
+	return 1;
+}
+
+static int
+select_backend_wait(timeval_T *timeout)
+{
+	int n, i;
+
+	memcpy(&x_read, &w_read, sizeof(fd_set));
+	memcpy(&x_write, &w_write, sizeof(fd_set));
+	memcpy(&x_error, &w_error, sizeof(fd_set));
+
+	n = select(w_max, &x_read, &x_write, &x_error,
+		   (struct timeval *) timeout);
+	if (n <= 0) return n;
+
+	for (i = 0; n > 0 && i < w_max; i++) {
+		int revents = 0;
+
+		if (FD_ISSET(i, &x_read)) revents |= SELECT_EVENT_READ;
+		if (FD_ISSET(i, &x_write)) revents |= SELECT_EVENT_WRITE;
+		if (FD_ISSET(i, &x_error)) revents |= SELECT_EVENT_ERROR;
+		if (!revents) continue;
+
+		add_ready_fd(i, revents);
+		n--;
+	}
+
+	return 0;
+}
+
+static struct select_backend select_backend = {
+	"select",
+	select_backend_init,
+	select_backend_update,
+	select_backend_wait,
+};
+
+
+#ifdef USE_POLL
+/* The poll() backend. Watched descriptors are kept densely packed in
+ * @pollfds so that waiting costs O(watched) instead of O(max fd). */
+
+static struct pollfd *pollfds;
+static int pollfds_size;
+static int pollfds_count;
+
+static int
+poll_backend_init(void)
+{
+	pollfds_count = 0;
+	return 1;
+}
+
+static int
+poll_backend_update(int fd, int events)
 {
-	int i = 0, j;
-
-	for (j = 0; j < FD_SETSIZE; j++)
-		if (threads[j].read_func
-		    || threads[j].write_func
-		    || threads[j].error_func)
-			i++;
-	return i;
+	int index = threads[fd].poll_index;
+	short pevents = 0;
+
+	if (events & SELECT_EVENT_READ) pevents |= POLLIN;
+	if (events & SELECT_EVENT_WRITE) pevents |= POLLOUT;
+	if (events & SELECT_EVENT_ERROR) pevents |= POLLPRI;
+
+	if (!threads[fd].events) {
+		if (!events) return 1;
+		if (pollfds_count >= pollfds_size) {
+			if (!mem_align_alloc(&pollfds, pollfds_size,
+					     pollfds_count + 1, 0x3F))
+				return 0;
+			pollfds_size = ALIGN_MEMORY_SIZE(pollfds_count + 1, 0x3F);
+		}
+		index = pollfds_count++;
+		threads[fd].poll_index = index;
+		pollfds[index].fd = fd;
+
+	} else if (!events) {
+		/* Move the last entry into the hole. */
+		struct pollfd *last = &pollfds[--pollfds_count];
+
+		if (index != pollfds_count) {
+			pollfds[index] = *last;
+			threads[last->fd].poll_index = index;
+		}
+		return 1;
+	}
+
+	pollfds[index].events = pevents;
+	pollfds[index].revents = 0;
+	return 1;
+}
+
+static int
+poll_backend_wait(timeval_T *timeout)
+{
+	int ms = timeout ? timeout_to_milliseconds(timeout) : -1;
+	int n, i;
+
+	n = poll(pollfds, pollfds_count, ms);
+	if (n <= 0) return n;
+
+	for (i = 0; n > 0 && i < pollfds_count; i++) {
+		short pevents = pollfds[i].revents;
+		int revents = 0;
+
+		if (!pevents) continue;
+
+		/* select() reports errors and hangups as readability and
+		 * writability; only out-of-band data is an "exception". */
+		if (pevents & (POLLIN | POLLHUP | POLLERR | POLLNVAL))
+			revents |= SELECT_EVENT_READ;
+		if (pevents & (POLLOUT | POLLHUP | POLLERR | POLLNVAL))
+			revents |= SELECT_EVENT_WRITE;
+		if (pevents & (POLLPRI | POLLNVAL))
+			revents |= SELECT_EVENT_ERROR;
+
+		add_ready_fd(pollfds[i].fd, revents);
+		n--;
+	}
+
+	return 0;
+}
+
+static struct select_backend poll_backend = {
+	"poll",
+	poll_backend_init,
+	poll_backend_update,
+	poll_backend_wait,
+};
+#endif /* USE_POLL */
+
+
+#ifdef USE_EPOLL
+/* The epoll backend. The kernel keeps the interest list so both updating
+ * and waiting only cost O(changed) resp. O(ready). */
+
+static int epoll_fd = -1;
+
+static struct epoll_event *epoll_events;
+static int epoll_events_size;
+
+/* Descriptors epoll refused to watch; see @thread.always_ready. */
+static int always_ready_count;
+
+static int
+epoll_backend_init(void)
+{
+	epoll_fd = epoll_create(64);
+	if (epoll_fd < 0) return 0;
+
+#ifdef FD_CLOEXEC
+	/* Programs we spawn have no use for it. */
+	fcntl(epoll_fd, F_SETFD, FD_CLOEXEC);
+#endif
+	always_ready_count = 0;
+	return 1;
+}
+
+static int
+epoll_backend_update(int fd, int events)
+{
+	struct epoll_event ev;
+	int op;
+
+	if (threads[fd].always_ready) {
+		if (!events) {
+			threads[fd].always_ready = 0;
+			always_ready_count--;
+		}
+		return 1;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.data.fd = fd;
+	if (events & SELECT_EVENT_READ) ev.events |= EPOLLIN;
+	if (events & SELECT_EVENT_WRITE) ev.events |= EPOLLOUT;
+	if (events & SELECT_EVENT_ERROR) ev.events |= EPOLLPRI;
+
+	if (!events) {
+		/* The descriptor may already be closed, which removes it
+		 * from the interest list on its own. */
+		if (threads[fd].events)
+			epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, &ev);
+		return 1;
+	}
+
+	op = threads[fd].events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+	if (!epoll_ctl(epoll_fd, op, fd, &ev))
+		return 1;
+
+	/* The descriptor was closed and reused behind our back or is
+	 * watched already; retry with the other operation. */
+	if (errno == ENOENT || errno == EEXIST) {
+		op = (op == EPOLL_CTL_ADD) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+		if (!epoll_ctl(epoll_fd, op, fd, &ev))
+			return 1;
+	}
+
+	if (errno == EPERM) {
+		threads[fd].always_ready = 1;
+		always_ready_count++;
+		return 1;
+	}
+
+	return 0;
+}
+
+static int
+epoll_backend_wait(timeval_T *timeout)
+{
+	int ms = timeout ? timeout_to_milliseconds(timeout) : -1;
+	int n, i;
+
+	if (handles_count >= epoll_events_size) {
+		if (!mem_align_alloc(&epoll_events, epoll_events_size,
+				     handles_count + 1, 0x3F))
+			return -1;
+		epoll_events_size = ALIGN_MEMORY_SIZE(handles_count + 1, 0x3F);
+	}
+
+	if (always_ready_count) ms = 0;
+
+	n = epoll_wait(epoll_fd, epoll_events, epoll_events_size, ms);
+	if (n < 0) return n;
+
+	for (i = 0; i < n; i++) {
+		unsigned int pevents = epoll_events[i].events;
+		int revents = 0;
+
+		if (pevents & (EPOLLIN | EPOLLHUP | EPOLLERR))
+			revents |= SELECT_EVENT_READ;
+		if (pevents & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+			revents |= SELECT_EVENT_WRITE;
+		if (pevents & EPOLLPRI)
+			revents |= SELECT_EVENT_ERROR;
+
+		add_ready_fd(epoll_events[i].data.fd, revents);
+	}
+
+	if (always_ready_count) {
+		for (i = 0; i < threads_size; i++)
+			if (threads[i].always_ready)
+				add_ready_fd(i, SELECT_EVENT_READ
+					        | SELECT_EVENT_WRITE);
+	}
+
+	return 0;
+}
+
+static struct select_backend epoll_backend = {
+	"epoll",
+	epoll_backend_init,
+	epoll_backend_update,
+	epoll_backend_wait,
+};
+#endif /* USE_EPOLL */
+
+
+/* Ordered by preference. */
+static struct select_backend *select_backends[] = {
+#ifdef USE_EPOLL
+	&epoll_backend,
+#endif
+#ifdef USE_POLL
+	&poll_backend,
+#endif
+	&select_backend,
+	NULL
+};
+
+static void
+init_select_backend(void)
+{
+	int i;
+
+	for (i = 0; select_backends[i]; i++) {
+		backend = select_backends[i];
+		if (backend->init()) break;
+	}
 }
 
 struct bottom_half {
@@ -129,11 +538,12 @@ select_handler_T
 get_handler(int fd, enum select_handler_type tp)
 {
 #ifndef CONFIG_OS_WIN32
-	assertm(fd >= 0 && fd < FD_SETSIZE,
-		"get_handler: handle %d >= FD_SETSIZE %d",
-		fd, FD_SETSIZE);
+	assertm(fd >= 0, "get_handler: invalid handle %d", fd);
 	if_assert_failed return NULL;
 #endif
+	/* Descriptors beyond the table never had handlers. */
+	if (fd >= threads_size) return NULL;
+
 	switch (tp) {
 		case SELECT_HANDLER_READ:	return threads[fd].read_func;
 		case SELECT_HANDLER_WRITE:	return threads[fd].write_func;
@@ -149,12 +559,22 @@ void
 set_handlers(int fd, select_handler_T read_func, select_handler_T write_func,
 	     select_handler_T error_func, void *data)
 {
+	int events = 0;
+
 #ifndef CONFIG_OS_WIN32
-	assertm(fd >= 0 && fd < FD_SETSIZE,
-		"set_handlers: handle %d >= FD_SETSIZE %d",
-		fd, FD_SETSIZE);
+	assertm(fd >= 0, "set_handlers: invalid handle %d", fd);
 	if_assert_failed return;
 #endif
+	if (!backend) init_select_backend();
+
+	if (fd >= threads_size) {
+		if (!read_func && !write_func && !error_func)
+			return;
+		if (!mem_align_alloc(&threads, threads_size, fd + 1, 0x3F))
+			return;
+		threads_size = ALIGN_MEMORY_SIZE(fd + 1, 0x3F);
+	}
+
 #ifdef __GNU__
 	/* GNU Hurd pflocal bug <http://savannah.gnu.org/bugs/?22861>:
 	 * If ELinks does a select() where the initial exceptfds set
@@ -170,44 +590,65 @@ set_handlers(int fd, select_handler_T read_func, select_handler_T write_func,
 			error_func = NULL;
 	}
 #endif /* __GNU__ */
+	if (read_func) events |= SELECT_EVENT_READ;
+	if (write_func) events |= SELECT_EVENT_WRITE;
+	if (error_func) events |= SELECT_EVENT_ERROR;
+
+	if (events != threads[fd].events) {
+		if (!backend->update(fd, events))
+			return;
+
+		if (!threads[fd].events) handles_count++;
+		else if (!events) handles_count--;
+		threads[fd].events = events;
+	}
+
 	threads[fd].read_func = read_func;
 	threads[fd].write_func = write_func;
 	threads[fd].error_func = error_func;
 	threads[fd].data = data;
+	threads[fd].revents &= events;
+}
 
-	if (read_func) {
-		FD_SET(fd, &w_read);
-	} else {
-		FD_CLR(fd, &w_read);
-		FD_CLR(fd, &x_read);
-	}
+/* Call the handlers of all descriptors reported ready by the last wait.
+ * The handlers may install or clear handlers of any descriptor, and even
+ * grow @threads, so nothing is cached across the calls. */
+static void
+dispatch_ready_fds(void)
+{
+	int i;
 
-	if (write_func) {
-		FD_SET(fd, &w_write);
-	} else {
-		FD_CLR(fd, &w_write);
-		FD_CLR(fd, &x_write);
-	}
+	for (i = 0; i < ready_count; i++) {
+		int fd = ready_fds[i];
 
-	if (error_func) {
-		FD_SET(fd, &w_error);
-	} else {
-		FD_CLR(fd, &w_error);
-		FD_CLR(fd, &x_error);
-	}
+		if (threads[fd].revents & SELECT_EVENT_READ) {
+			threads[fd].revents &= ~SELECT_EVENT_READ;
+			if (threads[fd].read_func) {
+				threads[fd].read_func(threads[fd].data);
+				check_bottom_halves();
+			}
+		}
 
-	if (read_func || write_func || error_func) {
-		if (fd >= w_max) w_max = fd + 1;
-	} else if (fd == w_max - 1) {
-		int i;
+		if (threads[fd].revents & SELECT_EVENT_WRITE) {
+			threads[fd].revents &= ~SELECT_EVENT_WRITE;
+			if (threads[fd].write_func) {
+				threads[fd].write_func(threads[fd].data);
+				check_bottom_halves();
+			}
+		}
 
-		for (i = fd - 1; i >= 0; i--)
-			if (FD_ISSET(i, &w_read)
-			    || FD_ISSET(i, &w_write)
-			    || FD_ISSET(i, &w_error))
-				break;
-		w_max = i + 1;
+		if (threads[fd].revents & SELECT_EVENT_ERROR) {
+			threads[fd].revents &= ~SELECT_EVENT_ERROR;
+			if (threads[fd].error_func) {
+				threads[fd].error_func(threads[fd].data);
+				check_bottom_halves();
+			}
+		}
+
+		threads[fd].revents = 0;
 	}
+
+	ready_count = 0;
 }
 
 void
@@ -217,10 +658,7 @@ select_loop(void (*init)(void))
 	int select_errors = 0;
 
 	clear_signal_mask_and_handlers();
-	FD_ZERO(&w_read);
-	FD_ZERO(&w_write);
-	FD_ZERO(&w_error);
-	w_max = 0;
+	if (!backend) init_select_backend();
 	timeval_now(&last_time);
 #ifdef SIGPIPE
 	signal(SIGPIPE, SIG_IGN);
@@ -229,51 +667,32 @@ select_loop(void (*init)(void))
 	check_bottom_halves();
 
 	while (!program.terminate) {
-		struct timeval *timeout = NULL;
-		int n, i, has_timer;
+		timeval_T *timeout = NULL;
+		int n, has_timer;
 		timeval_T t;
 
 		check_signals();
 		check_timers(&last_time);
 		redraw_all_terminals();
 
-		memcpy(&x_read, &w_read, sizeof(fd_set));
-		memcpy(&x_write, &w_write, sizeof(fd_set));
-		memcpy(&x_error, &w_error, sizeof(fd_set));
-
 		if (program.terminate) break;
 
 		has_timer = get_next_timer_time(&t);
-		if (!w_max && !has_timer) break;
+		if (!handles_count && !has_timer) break;
 		critical_section = 1;
 
 		if (check_signals()) {
 			critical_section = 0;
 			continue;
 		}
-#if 0
-		{
-			int i;
-
-			printf("\nR:");
-			for (i = 0; i < 256; i++)
-				if (FD_ISSET(i, &x_read)) printf("%d,", i);
-			printf("\nW:");
-			for (i = 0; i < 256; i++)
-				if (FD_ISSET(i, &x_write)) printf("%d,", i);
-			printf("\nE:");
-			for (i = 0; i < 256; i++)
-				if (FD_ISSET(i, &x_error)) printf("%d,", i);
-			fflush(stdout);
-		}
-#endif
+
 		if (has_timer) {
 			/* Be sure timeout is not negative. */
 			timeval_limit_to_zero_or_one(&t);
-			timeout = (struct timeval *) &t;
+			timeout = &t;
 		}
 
-		n = select(w_max, &x_read, &x_write, &x_error, timeout);
+		n = backend->wait(timeout);
 		if (n < 0) {
 			/* The following calls (especially gettext)
 			 * might change errno.  */
@@ -283,7 +702,7 @@ select_loop(void (*init)(void))
 			uninstall_alarm();
 			if (errno_from_select != EINTR) {
 				ERROR(gettext("The call to %s failed: %d (%s)"),
-				      "select()", errno_from_select, (unsigned char *) strerror(errno_from_select));
+				      backend->name, errno_from_select, (unsigned char *) strerror(errno_from_select));
 				if (++select_errors > 10) /* Infinite loop prevention. */
 					INTERNAL(gettext("%d select() failures."),
 						 select_errors);
@@ -295,45 +714,9 @@ select_loop(void (*init)(void))
 		critical_section = 0;
 		uninstall_alarm();
 		check_signals();
-		/*printf("sel: %d\n", n);*/
 		check_timers(&last_time);
 
-		i = -1;
-		while (n > 0 && ++i < w_max) {
-			int k = 0;
-
-#if 0
-			printf("C %d : %d,%d,%d\n", i, FD_ISSET(i, &w_read),
-			       FD_ISSET(i, &w_write), FD_ISSET(i, &w_error));
-			printf("A %d : %d,%d,%d\n", i, FD_ISSET(i, &x_read),
-			       FD_ISSET(i, &x_write), FD_ISSET(i, &x_error));
-#endif
-			if (FD_ISSET(i, &x_read)) {
-				if (threads[i].read_func) {
-					threads[i].read_func(threads[i].data);
-					check_bottom_halves();
-				}
-				k = 1;
-			}
-
-			if (FD_ISSET(i, &x_write)) {
-				if (threads[i].write_func) {
-					threads[i].write_func(threads[i].data);
-					check_bottom_halves();
-				}
-				k = 1;
-			}
-
-			if (FD_ISSET(i, &x_error)) {
-				if (threads[i].error_func) {
-					threads[i].error_func(threads[i].data);
-					check_bottom_halves();
-				}
-				k = 1;
-			}
-
-			n -= k;
-		}
+		dispatch_ready_fds();
 	}
 }
 
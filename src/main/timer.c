@@ -9,51 +9,128 @@
 #include "main/select.h"
 #include "main/timer.h"
 #include "util/error.h"
-#include "util/lists.h"
 #include "util/memory.h"
 #include "util/time.h"
 
 
 struct timer {
-	LIST_HEAD(struct timer);
-
-	timeval_T interval;
+	/* The absolute time at which the timer expires. */
+	timeval_T deadline;
 	void (*func)(void *);
 	void *data;
+
+	/* Position of the timer in @timers. */
+	int index;
 };
 
-/* @timers.next points to the timer with the smallest interval,
- * @timers.next->next to the second smallest, and so on.  */
-static INIT_LIST_OF(struct timer, timers);
+/* The pending timers as a binary min-heap ordered by @deadline, so
+ * @timers[0] is always the timer that expires first.  Installing and
+ * killing a timer is O(log n) and checking the timers only looks at
+ * the ones that have expired. */
+static struct timer **timers;
+static int timers_count;
+
+#define TIMERS_GRANULARITY 0x3F
 
 int
 get_timers_count(void)
 {
-	return list_size(&timers);
+	return timers_count;
+}
+
+static inline void
+set_timer_at(int index, struct timer *timer)
+{
+	timers[index] = timer;
+	timer->index = index;
+}
+
+static void
+sift_timer_up(int index)
+{
+	struct timer *timer = timers[index];
+
+	while (index > 0) {
+		int parent = (index - 1) / 2;
+
+		if (timeval_cmp(&timers[parent]->deadline, &timer->deadline) <= 0)
+			break;
+
+		set_timer_at(index, timers[parent]);
+		index = parent;
+	}
 
+	set_timer_at(index, timer);
+}
+
+static void
+sift_timer_down(int index)
+{
+	struct timer *timer = timers[index];
+
+	for (;;) {
+		int child = 2 * index + 1;
+
+		if (child >= timers_count) break;
+
+		if (child + 1 < timers_count
+		    && timeval_cmp(&timers[child + 1]->deadline,
+				   &timers[child]->deadline) < 0)
+			child++;
+
+		if (timeval_cmp(&timer->deadline, &timers[child]->deadline) <= 0)
+			break;
+
+		set_timer_at(index, timers[child]);
+		index = child;
+	}
+
+	set_timer_at(index, timer);
+}
+
+/* Unlink @timer from the heap.  The caller frees it. */
+static void
+del_timer_from_heap(struct timer *timer)
+{
+	int index = timer->index;
+	struct timer *last;
+
+	assertm(index >= 0 && index < timers_count && timers[index] == timer,
+		"bad timer %p", timer);
+	if_assert_failed return;
+
+	last = timers[--timers_count];
+	if (!timers_count) {
+		mem_free_set(&timers, NULL);
+		return;
+	}
+	if (last == timer) return;
+
+	set_timer_at(index, last);
+	if (index > 0
+	    && timeval_cmp(&timers[(index - 1) / 2]->deadline, &last->deadline) > 0)
+		sift_timer_up(index);
+	else
+		sift_timer_down(index);
 }
 
 void
 check_timers(timeval_T *last_time)
 {
 	timeval_T now;
-	timeval_T interval;
 	struct timer *timer;
 
 	timeval_now(&now);
-	timeval_sub(&interval, last_time, &now);
 
-	foreach (timer, timers) {
-		timeval_sub_interval(&timer->interval, &interval);
-	}
-
-	while (!list_empty(timers)) {
-		timer = timers.next;
+	/* Timers installed by the handlers below expire after @now, so
+	 * this loop terminates. */
+	while (timers_count) {
+		timer = timers[0];
 
-		if (timeval_is_positive(&timer->interval))
+		if (timeval_cmp(&timer->deadline, &now) > 0)
 			break;
 
-		del_from_list(timer);
+		del_timer_from_heap(timer);
 		/* At this point, *@timer is to be considered invalid
 		 * outside timers.c; if anything e.g. passes it to
 		 * @kill_timer, that's a bug.  However, @timer->func
@@ -79,24 +156,30 @@ check_timers(timeval_T *last_time)
 void
 install_timer(timer_id_T *id, milliseconds_T delay, void (*func)(void *), void *data)
 {
-	struct timer *new_timer, *timer;
+	struct timer *new_timer;
+	timeval_T interval;
 
 	assert(id && delay > 0);
 
+	*id = TIMER_ID_UNDEF;
+
+	if (!mem_align_alloc(&timers, timers_count, timers_count + 1,
+			     TIMERS_GRANULARITY))
+		return;
+
 	new_timer = mem_alloc(sizeof(*new_timer));
-	*id = (timer_id_T) new_timer; /* TIMER_ID_UNDEF is NULL */
 	if (!new_timer) return;
 
-	timeval_from_milliseconds(&new_timer->interval, delay);
+	timeval_now(&new_timer->deadline);
+	timeval_from_milliseconds(&interval, delay);
+	timeval_add_interval(&new_timer->deadline, &interval);
 	new_timer->func = func;
 	new_timer->data = data;
 
-	foreach (timer, timers) {
-		if (timeval_cmp(&timer->interval, &new_timer->interval) >= 0)
-			break;
-	}
+	set_timer_at(timers_count++, new_timer);
+	sift_timer_up(new_timer->index);
 
-	add_at_pos(timer->prev, new_timer);
+	*id = (timer_id_T) new_timer; /* TIMER_ID_UNDEF is NULL */
 }
 
 void
@@ -108,7 +191,7 @@ kill_timer(timer_id_T *id)
 	if (*id == TIMER_ID_UNDEF) return;
 
 	timer = *id;
-	del_from_list(timer);
+	del_timer_from_heap(timer);
 	mem_free(timer);
 
 	*id = TIMER_ID_UNDEF;
@@ -117,10 +200,11 @@ kill_timer(timer_id_T *id)
 int
 get_next_timer_time(timeval_T *t)
 {
-	if (!list_empty(timers)) {
-		timeval_copy(t, &((struct timer *) &timers)->next->interval);
-		return 1;
-	}
+	timeval_T now;
 
-	return 0;
+	if (!timers_count) return 0;
+
+	timeval_now(&now);
+	timeval_sub(t, &now, &timers[0]->deadline);
+	return 1;
 }
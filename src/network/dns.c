@@ -4,6 +4,7 @@
 #include "config.h"
 #endif
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
@@ -27,26 +28,58 @@
 #ifdef HAVE_ARPA_INET_H
 #include <arpa/inet.h>
 #endif
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+#include <signal.h>
 
 #include "elinks.h"
 
+#include "config/home.h"
 #include "config/options.h"
 #include "main/select.h"
 #include "network/dns.h"
 #include "osdep/osdep.h"
 #include "protocol/uri.h"
+#include "util/conv.h"
 #include "util/error.h"
+#include "util/hash.h"
 #include "util/memory.h"
+#include "util/secsave.h"
 #include "util/time.h"
 
 
+/* On Unix, asynchronous lookups are handed to a small pool of resolver
+ * threads instead of forking a process for each of them.  This needs a
+ * reentrant resolver, so the threads always use getaddrinfo(). */
+#if defined(CONFIG_OS_UNIX) && !defined(NO_ASYNC_LOOKUP) \
+    && defined(HAVE_PTHREAD_H) && defined(HAVE_LIBPTHREAD) \
+    && (defined(CONFIG_IPV6) || defined(HAVE_GETADDRINFO))
+#define USE_DNS_THREADS
+#endif
+
+#if defined(CONFIG_IPV6) || defined(USE_DNS_THREADS)
+#define USE_GETADDRINFO
+#endif
+
+/* Longest host name that is cached; RFC 1035 does not allow more. */
+#define DNS_HOST_MAXLEN 255
+
+#define DNS_CACHE_FILENAME		"dnscache"
+
+/* How many addresses of a host are saved between sessions. */
+#define DNS_SNAPSHOT_MAX_ADDRS		16
+
 struct dnsentry {
 	LIST_HEAD(struct dnsentry);
 
+	struct hash_item *item;		/* Our item in @dns_cache_hash. */
+	/* Entries for failed lookups have no addresses. */
 	struct sockaddr_storage *addr;	/* Pointer to array of addresses. */
 	int addrno;			/* Adress array length. */
-	timeval_T creation_time;	/* Creation time; let us do timeouts. */
-	unsigned char name[1];		/* Associated host; XXX: Must be last. */
+	timeval_T expire;		/* When the entry gets too old. */
+	unsigned char name[1];		/* Associated host in lowercase;
+					 * XXX: Must be last. */
 };
 
 struct dnsquery {
@@ -65,7 +98,9 @@ struct dnsquery {
 	 * this pointer to NULL. */
 	struct dnsquery **queryref;	/* Reference to callers DNS member. */
 
-#ifndef NO_ASYNC_LOOKUP
+#ifdef USE_DNS_THREADS
+	struct dns_job *job;		/* The job in the resolver pool. */
+#elif !defined(NO_ASYNC_LOOKUP)
 	int h;				/* One end of the async thread pipe. */
 #endif
 	unsigned char name[1];		/* Associated host; XXX: Must be last. */
@@ -76,7 +111,14 @@ struct dnsquery {
 static struct dnsquery *dns_queue = NULL;
 #endif
 
+/* The cache entries ordered from the most recently used one.  They are
+ * looked up through @dns_cache_hash. */
 static INIT_LIST_OF(struct dnsentry, dns_cache);
+static struct hash *dns_cache_hash;
+static int dns_cache_entries;
+
+static long dns_cache_hits;
+static long dns_cache_misses;
 
 static void done_dns_lookup(struct dnsquery *query, enum dns_result res);
 
@@ -86,52 +128,119 @@ static void done_dns_lookup(struct dnsquery *query, enum dns_result res);
 static struct dnsentry *
 find_in_dns_cache(unsigned char *name)
 {
+	unsigned char key[DNS_HOST_MAXLEN];
+	int namelen = strlen(name);
+	struct hash_item *item;
 	struct dnsentry *dnsentry;
 
-	foreach (dnsentry, dns_cache)
-		if (!c_strcasecmp(dnsentry->name, name)) {
-			move_to_top_of_list(dns_cache, dnsentry);
-			return dnsentry;
-		}
+	if (!dns_cache_hash || !namelen || namelen > DNS_HOST_MAXLEN)
+		return NULL;
 
-	return NULL;
+	memcpy(key, name, namelen);
+	convert_to_lowercase_locale_indep(key, namelen);
+
+	item = get_hash_item(dns_cache_hash, key, namelen);
+	if (!item) return NULL;
+
+	dnsentry = item->value;
+	move_to_top_of_list(dns_cache, dnsentry);
+	return dnsentry;
+}
+
+static int
+dns_cache_entry_expired(struct dnsentry *dnsentry)
+{
+	timeval_T now;
+
+	timeval_now(&now);
+	return timeval_cmp(&now, &dnsentry->expire) >= 0;
 }
 
 static void
+del_dns_cache_entry(struct dnsentry *dnsentry)
+{
+	del_hash_item(dns_cache_hash, dnsentry->item);
+	del_from_list(dnsentry);
+	dns_cache_entries--;
+	mem_free_if(dnsentry->addr);
+	mem_free(dnsentry);
+}
+
+/* Remember the result of looking up @name.  Failed lookups are passed
+ * with zero @addrno and kept only for a short while. */
+static struct dnsentry *
 add_to_dns_cache(unsigned char *name, struct sockaddr_storage *addr, int addrno)
 {
 	int namelen = strlen(name);
 	struct dnsentry *dnsentry;
-	int size;
+	timeval_T timeout;
 
-	assert(addrno > 0);
+	if (!namelen || namelen > DNS_HOST_MAXLEN) return NULL;
+
+	if (!dns_cache_hash) {
+		dns_cache_hash = init_hash8();
+		if (!dns_cache_hash) return NULL;
+	}
 
 	dnsentry = mem_calloc(1, sizeof(*dnsentry) + namelen);
-	if (!dnsentry) return;
+	if (!dnsentry) return NULL;
 
-	size = addrno * sizeof(*dnsentry->addr);
-	dnsentry->addr = mem_alloc(size);
-	if (!dnsentry->addr) {
-		mem_free(dnsentry);
-		return;
+	if (addrno > 0) {
+		int size = addrno * sizeof(*dnsentry->addr);
+
+		dnsentry->addr = mem_alloc(size);
+		if (!dnsentry->addr) {
+			mem_free(dnsentry);
+			return NULL;
+		}
+
+		memcpy(dnsentry->addr, addr, size);
+		dnsentry->addrno = addrno;
 	}
 
 	/* calloc() sets NUL char for us. */
 	memcpy(dnsentry->name, name, namelen);
-	memcpy(dnsentry->addr, addr, size);;
+	convert_to_lowercase_locale_indep(dnsentry->name, namelen);
 
-	dnsentry->addrno = addrno;
+	dnsentry->item = add_hash_item(dns_cache_hash, dnsentry->name,
+				       namelen, dnsentry);
+	if (!dnsentry->item) {
+		mem_free_if(dnsentry->addr);
+		mem_free(dnsentry);
+		return NULL;
+	}
+
+	timeval_from_seconds(&timeout, addrno > 0 ? DNS_CACHE_TIMEOUT
+						  : DNS_CACHE_NEGATIVE_TIMEOUT);
+	timeval_now(&dnsentry->expire);
+	timeval_add_interval(&dnsentry->expire, &timeout);
 
-	timeval_now(&dnsentry->creation_time);
 	add_to_list(dns_cache, dnsentry);
+	dns_cache_entries++;
+
+	/* Drop the least recently used entries. */
+	while (dns_cache_entries > DNS_CACHE_MAX_ENTRIES)
+		del_dns_cache_entry(dns_cache.prev);
+
+	return dnsentry;
 }
 
-static void
-del_dns_cache_entry(struct dnsentry *dnsentry)
+int
+get_dns_cache_entry_count(void)
 {
-	del_from_list(dnsentry);
-	mem_free_if(dnsentry->addr);
-	mem_free(dnsentry);
+	return dns_cache_entries;
+}
+
+long
+get_dns_cache_hits(void)
+{
+	return dns_cache_hits;
+}
+
+long
+get_dns_cache_misses(void)
+{
+	return dns_cache_misses;
 }
 
 
@@ -141,7 +250,7 @@ enum dns_result
 do_real_lookup(unsigned char *name, struct sockaddr_storage **addrs, int *addrno,
 	       int in_thread)
 {
-#ifdef CONFIG_IPV6
+#ifdef USE_GETADDRINFO
 	struct addrinfo hint, *ai, *ai_cur;
 #else
 	struct hostent *hostent = NULL;
@@ -151,13 +260,17 @@ do_real_lookup(unsigned char *name, struct sockaddr_storage **addrs, int *addrno
 	if (!name || !addrs || !addrno)
 		return DNS_ERROR;
 
-#ifdef CONFIG_IPV6
+#ifdef USE_GETADDRINFO
 	/* I had a strong preference for the following, but the glibc is really
 	 * obsolete so I had to rather use much more complicated getaddrinfo().
 	 * But we duplicate the code terribly here :|. */
 	/* hostent = getipnodebyname(name, AF_INET6, AI_ALL | AI_ADDRCONFIG, NULL); */
 	memset(&hint, 0, sizeof(hint));
+#ifdef CONFIG_IPV6
 	hint.ai_family = AF_UNSPEC;
+#else
+	hint.ai_family = AF_INET;
+#endif
 	hint.ai_socktype = SOCK_STREAM;
 	if (getaddrinfo(name, NULL, &hint, &ai) != 0) return DNS_ERROR;
 
@@ -180,7 +293,7 @@ do_real_lookup(unsigned char *name, struct sockaddr_storage **addrs, int *addrno
 	}
 #endif
 
-#ifdef CONFIG_IPV6
+#ifdef USE_GETADDRINFO
 	for (i = 0, ai_cur = ai; ai_cur; i++, ai_cur = ai_cur->ai_next);
 #else
 	for (i = 0; hostent->h_addr_list[i] != NULL; i++);
@@ -191,10 +304,15 @@ do_real_lookup(unsigned char *name, struct sockaddr_storage **addrs, int *addrno
 	 * -- Mikulas).  So we don't if in_thread != 0. */
 	*addrs = in_thread ? calloc(i, sizeof(**addrs))
 			   : mem_calloc(i, sizeof(**addrs));
-	if (!*addrs) return DNS_ERROR;
+	if (!*addrs) {
+#ifdef USE_GETADDRINFO
+		freeaddrinfo(ai);
+#endif
+		return DNS_ERROR;
+	}
 	*addrno = i;
 
-#ifdef CONFIG_IPV6
+#ifdef USE_GETADDRINFO
 	for (i = 0, ai_cur = ai; ai_cur; i++, ai_cur = ai_cur->ai_next) {
 		/* Don't use struct sockaddr_in6 here: because we
 		 * called getaddrinfo with AF_UNSPEC, the address
@@ -240,7 +358,319 @@ do_real_lookup(unsigned char *name, struct sockaddr_storage **addrs, int *addrno
 
 /* Asynchronous DNS lookup management: */
 
-#ifndef NO_ASYNC_LOOKUP
+#ifdef USE_DNS_THREADS
+
+/* How many lookups may run at the same time. */
+#define DNS_THREADS_MAX 4
+
+struct dns_job {
+	struct dns_job *next;
+
+	/* The query waiting for the result or NULL if it has been killed.
+	 * Only the main thread looks at this. */
+	struct dnsquery *query;
+
+	/* Filled in by the resolver thread.  @addr comes from plain
+	 * calloc(), see do_real_lookup(). */
+	enum dns_result result;
+	struct sockaddr_storage *addr;
+	int addrno;
+
+	unsigned char name[1];		/* Associated host; XXX: Must be last. */
+};
+
+/* Protects everything below down to @dns_running. */
+static pthread_mutex_t dns_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dns_pool_cond = PTHREAD_COND_INITIALIZER;
+
+/* Jobs waiting for a resolver thread and jobs waiting to be reported
+ * back to their queries, both in FIFO order. */
+static struct dns_job *dns_pending, **dns_pending_tail = &dns_pending;
+static struct dns_job *dns_finished, **dns_finished_tail = &dns_finished;
+static int dns_pending_count;
+
+static int dns_threads;
+static int dns_idle_threads;
+
+/* The job each resolver thread is looking up, indexed by the number
+ * given to start_dns_thread(). */
+static struct dns_job *dns_running[DNS_THREADS_MAX];
+
+/* The resolver threads wake up the select loop through this pipe when
+ * @dns_finished stops being empty. */
+static int dns_pool_pipe[2] = { -1, -1 };
+
+/* Jobs not yet reported back; the pipe is watched only while there are
+ * some, so that it does not keep the select loop alive. */
+static int dns_jobs_count;
+
+static void *
+dns_thread(void *data)
+{
+	int slot = (long) data;
+
+	pthread_mutex_lock(&dns_pool_lock);
+
+	for (;;) {
+		struct dns_job *job;
+		int wakeup;
+
+		while (!dns_pending) {
+			dns_idle_threads++;
+			pthread_cond_wait(&dns_pool_cond, &dns_pool_lock);
+			dns_idle_threads--;
+		}
+
+		job = dns_pending;
+		dns_pending = job->next;
+		if (!dns_pending) dns_pending_tail = &dns_pending;
+		dns_pending_count--;
+		dns_running[slot] = job;
+
+		pthread_mutex_unlock(&dns_pool_lock);
+
+		/* Left by a thread that did not survive a fork(), see
+		 * reset_dns_pool(). */
+		if (job->addr) {
+			free(job->addr);
+			job->addr = NULL;
+		}
+
+		job->result = do_real_lookup(job->name, &job->addr,
+					     &job->addrno, 1);
+
+		pthread_mutex_lock(&dns_pool_lock);
+
+		dns_running[slot] = NULL;
+		job->next = NULL;
+		wakeup = !dns_finished;
+		*dns_finished_tail = job;
+		dns_finished_tail = &job->next;
+
+		/* The pipe is non-blocking; if it is full, the select
+		 * loop has been woken up already. */
+		if (wakeup) write(dns_pool_pipe[1], "x", 1);
+	}
+
+	return NULL;
+}
+
+static int
+start_dns_thread(int slot)
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+	sigset_t signals, old_signals;
+	int error;
+
+	if (pthread_attr_init(&attr)) return 0;
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	/* Signals are for the main thread only and the new thread
+	 * inherits our mask. */
+	sigfillset(&signals);
+	pthread_sigmask(SIG_SETMASK, &signals, &old_signals);
+	error = pthread_create(&thread, &attr, dns_thread, (void *) (long) slot);
+	pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+	pthread_attr_destroy(&attr);
+
+	return !error;
+}
+
+/* Start threads for the pending jobs no idle thread will take.  Called
+ * with @dns_pool_lock held. */
+static void
+add_dns_threads(void)
+{
+	while (dns_pending_count > dns_idle_threads
+	       && dns_threads < DNS_THREADS_MAX
+	       && start_dns_thread(dns_threads))
+		dns_threads++;
+}
+
+/* pthread_atfork() handlers.  The lock is held across fork() so that
+ * the child sees the queues in a consistent state. */
+static void
+lock_dns_pool(void)
+{
+	pthread_mutex_lock(&dns_pool_lock);
+}
+
+static void
+unlock_dns_pool(void)
+{
+	pthread_mutex_unlock(&dns_pool_lock);
+}
+
+/* Only the thread calling fork() lives on in the child, for example
+ * after destroy_terminal() forks to let the shell have the terminal
+ * back.  Forget the resolver threads and queue the jobs they were
+ * looking up again; done_dns_job() will start new threads for them. */
+static void
+reset_dns_pool(void)
+{
+	int slot;
+
+	pthread_mutex_init(&dns_pool_lock, NULL);
+	pthread_cond_init(&dns_pool_cond, NULL);
+
+	for (slot = 0; slot < dns_threads; slot++) {
+		struct dns_job *job = dns_running[slot];
+
+		if (!job) continue;
+
+		dns_running[slot] = NULL;
+		job->next = dns_pending;
+		if (!dns_pending) dns_pending_tail = &job->next;
+		dns_pending = job;
+		dns_pending_count++;
+	}
+
+	dns_threads = 0;
+	dns_idle_threads = 0;
+
+	if (dns_pending) write(dns_pool_pipe[1], "x", 1);
+}
+
+static void done_dns_job(void *data);
+
+static int
+init_async_dns_lookup(struct dnsquery *dnsquery, int force_async)
+{
+	int namelen = strlen(dnsquery->name);
+	struct dns_job *job;
+
+	dnsquery->job = NULL;
+
+	if (!force_async && !get_opt_bool("connection.async_dns", NULL))
+		return 0;
+
+	if (dns_pool_pipe[0] == -1) {
+		if (c_pipe(dns_pool_pipe) < 0)
+			return 0;
+		if (set_nonblocking_fd(dns_pool_pipe[0]) < 0
+		    || set_nonblocking_fd(dns_pool_pipe[1]) < 0
+		    || pthread_atfork(lock_dns_pool, unlock_dns_pool,
+				      reset_dns_pool)) {
+			close(dns_pool_pipe[0]);
+			close(dns_pool_pipe[1]);
+			dns_pool_pipe[0] = dns_pool_pipe[1] = -1;
+			return 0;
+		}
+	}
+
+	/* The job is released in the main thread but we stick to plain
+	 * calloc() like for its @addr. */
+	job = calloc(1, sizeof(*job) + namelen);
+	if (!job) return 0;
+
+	/* calloc() sets NUL char for us. */
+	memcpy(job->name, dnsquery->name, namelen);
+	job->query = dnsquery;
+
+	pthread_mutex_lock(&dns_pool_lock);
+
+	if (dns_pending_count >= dns_idle_threads
+	    && dns_threads < DNS_THREADS_MAX
+	    && start_dns_thread(dns_threads))
+		dns_threads++;
+
+	if (!dns_threads) {
+		pthread_mutex_unlock(&dns_pool_lock);
+		free(job);
+		return 0;
+	}
+
+	*dns_pending_tail = job;
+	dns_pending_tail = &job->next;
+	dns_pending_count++;
+	pthread_cond_signal(&dns_pool_cond);
+
+	pthread_mutex_unlock(&dns_pool_lock);
+
+	dnsquery->job = job;
+	if (!dns_jobs_count++)
+		set_handlers(dns_pool_pipe[0], done_dns_job, NULL, NULL, NULL);
+
+	return 1;
+}
+
+/* Report the finished jobs back to their queries. */
+static void
+done_dns_job(void *data)
+{
+	struct dns_job *job, *next;
+	unsigned char buf[64];
+
+	while (safe_read(dns_pool_pipe[0], buf, sizeof(buf)) > 0);
+
+	pthread_mutex_lock(&dns_pool_lock);
+	add_dns_threads();
+
+	/* Without any thread, the pending jobs would wait forever. */
+	if (!dns_threads && dns_pending) {
+		for (job = dns_pending; job; job = job->next)
+			job->result = DNS_ERROR;
+
+		*dns_finished_tail = dns_pending;
+		dns_finished_tail = dns_pending_tail;
+		dns_pending = NULL;
+		dns_pending_tail = &dns_pending;
+		dns_pending_count = 0;
+	}
+
+	job = dns_finished;
+	dns_finished = NULL;
+	dns_finished_tail = &dns_finished;
+	pthread_mutex_unlock(&dns_pool_lock);
+
+	/* The callbacks may start and kill other lookups, including
+	 * those further down this list, hence the @job->query check. */
+	for (; job; job = next) {
+		struct dnsquery *query = job->query;
+		enum dns_result result = job->result;
+
+		next = job->next;
+
+		if (!--dns_jobs_count)
+			clear_handlers(dns_pool_pipe[0]);
+
+		if (query) {
+			query->job = NULL;
+
+			if (result == DNS_SUCCESS) {
+				int size = job->addrno * sizeof(*query->addr);
+
+				query->addr = mem_alloc(size);
+				if (query->addr) {
+					memcpy(query->addr, job->addr, size);
+					query->addrno = job->addrno;
+				} else {
+					result = DNS_ERROR;
+				}
+			}
+
+			done_dns_lookup(query, result);
+		}
+
+		free(job->addr);
+		free(job);
+	}
+}
+
+static void
+done_async_dns_lookup(struct dnsquery *dnsquery)
+{
+	if (!dnsquery->job) return;
+
+	/* The resolver thread does not look at @query, the job will be
+	 * freed when it is done. */
+	dnsquery->job->query = NULL;
+	dnsquery->job = NULL;
+}
+
+#elif !defined(NO_ASYNC_LOOKUP)
 static enum dns_result
 write_dns_data(int h, void *data, size_t datalen)
 {
@@ -448,7 +878,7 @@ done_dns_lookup(struct dnsquery *query, enum dns_result result)
 	if (dnsentry) {
 		/* If the query failed, use the existing DNS cache entry even if
 		 * it is too old. */
-		if (result == DNS_ERROR) {
+		if (result == DNS_ERROR && dnsentry->addrno) {
 			query->done(query->data, dnsentry->addr, dnsentry->addrno);
 			goto done;
 		}
@@ -456,8 +886,10 @@ done_dns_lookup(struct dnsquery *query, enum dns_result result)
 		del_dns_cache_entry(dnsentry);
 	}
 
-	if (result == DNS_SUCCESS)
-		add_to_dns_cache(query->name, query->addr, query->addrno);
+	/* Failed lookups are cached too so that pages full of dead hosts
+	 * do not keep asking for them. */
+	add_to_dns_cache(query->name, query->addr,
+			 result == DNS_SUCCESS ? query->addrno : 0);
 
 	query->done(query->data, query->addr, query->addrno);
 
@@ -508,21 +940,13 @@ find_host(unsigned char *name, void **queryref,
 	 * do a new lookup. However, old cache entries will be used as a
 	 * fallback if the new lookup fails. */
 	dnsentry = find_in_dns_cache(name);
-	if (dnsentry) {
-		timeval_T age, now, max_age;
-
-		assert(dnsentry && dnsentry->addrno > 0);
-
-		timeval_from_seconds(&max_age, DNS_CACHE_TIMEOUT);
-		timeval_now(&now);
-		timeval_sub(&age, &dnsentry->creation_time, &now);
-
-		if (timeval_cmp(&age, &max_age) <= 0) {
-			done(data, dnsentry->addr, dnsentry->addrno);
-			return DNS_SUCCESS;
-		}
+	if (dnsentry && !dns_cache_entry_expired(dnsentry)) {
+		dns_cache_hits++;
+		done(data, dnsentry->addr, dnsentry->addrno);
+		return dnsentry->addrno ? DNS_SUCCESS : DNS_ERROR;
 	}
 
+	dns_cache_misses++;
 	return init_dns_lookup(name, queryref, done, data);
 }
 
@@ -546,19 +970,221 @@ shrink_dns_cache(int whole)
 		foreachsafe (dnsentry, next, dns_cache)
 			del_dns_cache_entry(dnsentry);
 
+		if (dns_cache_hash) free_hash(&dns_cache_hash);
+
 	} else {
-		timeval_T now, max_age;
+		foreachsafe (dnsentry, next, dns_cache)
+			if (dns_cache_entry_expired(dnsentry))
+				del_dns_cache_entry(dnsentry);
+	}
+}
 
-		timeval_from_seconds(&max_age, DNS_CACHE_TIMEOUT);
-		timeval_now(&now);
 
-		foreachsafe (dnsentry, next, dns_cache) {
-			timeval_T age;
+/* Saving the DNS cache between sessions: */
 
-			timeval_sub(&age, &dnsentry->creation_time, &now);
+#if defined(HAVE_INET_NTOP) && defined(HAVE_INET_PTON)
 
-			if (timeval_cmp(&age, &max_age) > 0)
-				del_dns_cache_entry(dnsentry);
+/* The file has one line per host with the host name, the time when the
+ * entry expires and the addresses, separated by tabs.  Only fresh entries
+ * of successful lookups are saved. */
+
+static int
+get_dns_cache_filename(unsigned char **filename)
+{
+	if (!elinks_home
+	    || !get_opt_bool("connection.save_dns_cache", NULL)
+	    || get_cmd_opt_bool("anonymous"))
+		return 0;
+
+	*filename = straconcat(elinks_home, DNS_CACHE_FILENAME,
+			       (unsigned char *) NULL);
+	return !!*filename;
+}
+
+static void *
+get_sockaddr_data(struct sockaddr_storage *addr)
+{
+	switch (addr->ss_family) {
+	case AF_INET:
+		return &((struct sockaddr_in *) addr)->sin_addr;
+#ifdef CONFIG_IPV6
+	case AF_INET6:
+		return &((struct sockaddr_in6 *) addr)->sin6_addr;
+#endif
+	default:
+		return NULL;
+	}
+}
+
+static void
+load_dns_cache(void)
+{
+	unsigned char in_buffer[MAX_STR_LEN];
+	unsigned char *filename;
+	timeval_T now;
+	FILE *f;
+
+	if (!get_dns_cache_filename(&filename)) return;
+
+	f = fopen(filename, "rb");
+	mem_free(filename);
+	if (!f) return;
+
+	timeval_now(&now);
+
+	while (fgets(in_buffer, sizeof(in_buffer), f)) {
+		struct sockaddr_storage addrs[DNS_SNAPSHOT_MAX_ADDRS];
+		unsigned char *name = in_buffer;
+		unsigned char *pos = strchr(name, '\t');
+		struct dnsentry *dnsentry;
+		long expire;
+		int addrno = 0;
+
+		if (!pos) continue;
+		*pos++ = '\0';
+
+		expire = strtol(pos, (char **) &pos, 10);
+		if (expire <= now.sec) continue;
+
+		memset(addrs, 0, sizeof(addrs));
+
+		while (*pos == '\t' && addrno < DNS_SNAPSHOT_MAX_ADDRS) {
+			struct sockaddr_storage *addr = &addrs[addrno];
+			unsigned char *end = ++pos;
+			unsigned char separator;
+
+			while (*end && *end != '\t' && *end != '\n') end++;
+			if (end == pos) break;
+
+			/* inet_pton() wants the string terminated. */
+			separator = *end;
+			*end = '\0';
+
+			addr->ss_family = strchr(pos, ':') ? AF_INET6 : AF_INET;
+			if (get_sockaddr_data(addr)
+			    && inet_pton(addr->ss_family, pos,
+					 get_sockaddr_data(addr)) > 0)
+				addrno++;
+
+			*end = separator;
+			pos = end;
+		}
+
+		if (!addrno || find_in_dns_cache(name)) continue;
+
+		dnsentry = add_to_dns_cache(name, addrs, addrno);
+		if (!dnsentry) continue;
+
+		/* Keep the expiration time from the previous session. */
+		if (expire < dnsentry->expire.sec) {
+			dnsentry->expire.sec = expire;
+			dnsentry->expire.usec = 0;
 		}
 	}
+
+	fclose(f);
+}
+
+static void
+save_dns_cache(void)
+{
+	struct secure_save_info *ssi;
+	struct dnsentry *dnsentry;
+	unsigned char *filename;
+
+	if (!get_dns_cache_filename(&filename)) return;
+
+	ssi = secure_open(filename);
+	mem_free(filename);
+	if (!ssi) return;
+
+	/* Oldest first, so that loading restores the LRU order. */
+	foreachback (dnsentry, dns_cache) {
+		int i;
+
+		if (!dnsentry->addrno || dns_cache_entry_expired(dnsentry))
+			continue;
+
+		secure_fprintf(ssi, "%s\t%ld", dnsentry->name,
+			       dnsentry->expire.sec);
+
+		for (i = 0; i < dnsentry->addrno; i++) {
+			struct sockaddr_storage *addr = &dnsentry->addr[i];
+			void *data = get_sockaddr_data(addr);
+			char buffer[64];
+
+			if (data && inet_ntop(addr->ss_family, data, buffer,
+					      sizeof(buffer)))
+				secure_fprintf(ssi, "\t%s", buffer);
+		}
+
+		if (secure_fprintf(ssi, "\n") < 0)
+			break;
+	}
+
+	secure_close(ssi);
+}
+
+#else
+#define load_dns_cache()	/* Nada. */
+#define save_dns_cache()	/* Nada. */
+#endif
+
+
+/* Prefetching: */
+
+/* A lookup started by prefetch_dns_host() which nobody waits for. */
+struct dns_prefetch {
+	LIST_HEAD(struct dns_prefetch);
+
+	void *query;
+};
+
+static INIT_LIST_OF(struct dns_prefetch, dns_prefetches);
+
+static void
+done_dns_prefetch(void *data, struct sockaddr_storage *addr, int addrno)
+{
+	struct dns_prefetch *prefetch = data;
+
+	/* The result is in the DNS cache now. */
+	del_from_list(prefetch);
+	mem_free(prefetch);
+}
+
+void
+prefetch_dns_host(unsigned char *name)
+{
+	struct dns_prefetch *prefetch;
+
+	/* Synchronous lookups would only delay the startup. */
+	if (!get_opt_bool("connection.async_dns", NULL)) return;
+
+	prefetch = mem_calloc(1, sizeof(*prefetch));
+	if (!prefetch) return;
+
+	add_to_list(dns_prefetches, prefetch);
+
+	/* Cached hosts are done right away and free @prefetch. */
+	find_host(name, &prefetch->query, done_dns_prefetch, prefetch, 0);
+}
+
+void
+init_dns(void)
+{
+	load_dns_cache();
+}
+
+void
+done_dns(void)
+{
+	while (!list_empty(dns_prefetches)) {
+		struct dns_prefetch *prefetch = dns_prefetches.next;
+
+		if (prefetch->query) kill_dns_request(&prefetch->query);
+		del_from_list(prefetch);
+		mem_free(prefetch);
+	}
+
+	save_dns_cache();
 }
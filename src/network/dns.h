@@ -39,4 +39,19 @@ void kill_dns_request(void **queryref);
  * cache entries will be removed. */
 void shrink_dns_cache(int whole);
 
+/* Start looking up @name in the background so that it is in the cache
+ * when it is needed.  Only done with asynchronous DNS. */
+void prefetch_dns_host(unsigned char *name);
+
+/* Load the DNS cache saved by the previous session and save it again when
+ * ELinks exits, see the connection.save_dns_cache option. */
+void init_dns(void);
+void done_dns(void);
+
+/* Statistics for the resources dialog.  Failed lookups have entries too;
+ * a hit is a lookup answered from the cache. */
+int get_dns_cache_entry_count(void);
+long get_dns_cache_hits(void);
+long get_dns_cache_misses(void);
+
 #endif
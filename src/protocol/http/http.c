@@ -948,12 +948,16 @@ http_send_header(struct socket *socket)
 	/* CONNECT: The Authorization header is for the origin server only.  */
 	if (!use_connect) {
 #ifdef CONFIG_GSSAPI
-		if (http_negotiate_output(uri, &header) != 0)
+		if (!http_negotiate_output(uri, &header))
+			http->authorized = 1;
+		else
 #endif
 			entry = find_auth(uri);
 	}
 
 	if (entry) {
+		http->authorized = 1;
+
 		if (entry->digest) {
 			unsigned char *response;
 
@@ -1578,6 +1582,16 @@ again:
 	conn->cached->cgi = conn->cgi;
 	mem_free_set(&conn->cached->head, head);
 
+	/* Whatever the cache control option says, documents loaded with
+	 * credentials or marked as such are only kept in memory. */
+	conn->cached->no_store = http->authorized;
+	if ((d = parse_header(conn->cached->head, "Cache-Control", NULL))) {
+		if (strstr((const char *)d, "no-store")
+		    || strstr((const char *)d, "private"))
+			conn->cached->no_store = 1;
+		mem_free(d);
+	}
+
 	if (!get_opt_bool("document.cache.ignore_cache_control", NULL)) {
 		struct cache_entry *cached = conn->cached;
 
@@ -1784,6 +1798,7 @@ again:
 			if (!http->close || POST_HTTP_1_0(version))
 				http->length = l;
 			conn->est_length = conn->from + l;
+			conn->cached->size_hint = conn->est_length;
 		}
 		mem_free(d);
 	}
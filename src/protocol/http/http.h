@@ -27,6 +27,7 @@ struct http_connection_info {
 	int length;
 	int chunk_remaining;
 	int code;
+	int authorized;	/* The request carried the user's credentials */
 
 	struct http_post post;
 };
@@ -25,6 +25,8 @@
 #define ELINKS_TEMPNAME_PREFIX		"elinks"
 
 #define DNS_CACHE_TIMEOUT		3600	/* in seconds */
+#define DNS_CACHE_NEGATIVE_TIMEOUT	30	/* in seconds */
+#define DNS_CACHE_MAX_ENTRIES		256
 
 #define HTTP_KEEPALIVE_TIMEOUT		60000
 #define FTP_KEEPALIVE_TIMEOUT		600000
@@ -33,11 +35,16 @@
 #define KEEPALIVE_CHECK_TIME		((milliseconds_T) 20000)
 
 #define MAX_REDIRECTS			10
+#define MAX_PARSED_STYLESHEETS		16
+#define MAX_SHARED_CSS_STYLES		16
+#define CSS_SELECTOR_INDEX_MIN		16
+#define CSS_SELECTOR_INDEX_WIDTH	5
 
 #define MEMORY_CACHE_GC_PERCENT		90
 #define MAX_CACHED_OBJECT_PERCENT	25
 
 #define MAX_INPUT_HISTORY_ENTRIES	256
+#define MAX_SEARCH_REGEXES		8
 
 #define SCROLL_ITEMS			2
 
@@ -56,6 +63,8 @@
 #define DISPLAY_TIME_MIN		((milliseconds_T) 200)
 #define DISPLAY_TIME			20
 
+#define TERMINAL_OUTPUT_CHUNK		(4 * 1024)	/* in bytes */
+
 #define HTML_LEFT_MARGIN		3
 #define HTML_MAX_TABLE_LEVEL		10
 #define HTML_MAX_FRAME_DEPTH		5
@@ -68,6 +77,10 @@
 #define HTML_MAX_COLSPAN		32768
 #define HTML_MAX_ROWSPAN		32768
 #define HTML_MAX_CELLS_MEMORY		32*1024*1024
+#define HTML_INCREMENTAL_MIN_SIZE	(64 * 1024)	/* in bytes */
+#define HTML_CHECKPOINT_MARGIN		(4 * 1024)	/* in bytes */
+#define PLAIN_INDEX_MIN_SIZE		(256 * 1024)	/* in bytes */
+#define PLAIN_INDEX_MARGIN		256		/* in lines */
 
 #define MAX_STR_LEN			1024
 
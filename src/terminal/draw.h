@@ -33,7 +33,11 @@ enum screen_char_attr {
 	SCREEN_ATTR_FRAME	= 0x80,
 };
 
-/** One position in the terminal screen's image. */
+/** One position in the terminal screen's image.
+ *
+ * The members are laid out without padding between them, so that
+ * a screen_char takes 12 bytes even with UTF-8 and true color, and
+ * whole lines can be compared with compare_screen_chars(). */
 struct screen_char {
 	/** Contains either character value or frame data.
 	 * - If #attr includes ::SCREEN_ATTR_FRAME, then @c data is
@@ -52,10 +56,9 @@ struct screen_char {
 	/** Attributes are ::screen_char_attr bits. */
 	unsigned char attr;
 
-	union {
+	struct {
 		/** The fore- and background color. */
 		unsigned char color[SCREEN_COLOR_SIZE];
-		unsigned int node_number;
 	} c;
 };
 
@@ -63,6 +66,13 @@ struct screen_char {
 #define copy_screen_chars(to, from, amount) \
 	do { memcpy(to, from, (amount) * sizeof(struct screen_char)); } while (0)
 
+/** Whether @a amount screen chars at @a a and @a b are the same.  This
+ * compares bytes, so chars differing only in the padding at their end
+ * are reported as different.  Use it only to skip work.
+ * @relates screen_char */
+#define compare_screen_chars(a, b, amount) \
+	(!memcmp(a, b, (amount) * sizeof(struct screen_char)))
+
 /** @name Linux frame symbols table.
  * It is magically converted to other terminals when needed.
  * In the screen image, they have attribute SCREEN_ATTR_FRAME;
@@ -17,7 +17,6 @@
 #include "osdep/osdep.h"
 #include "terminal/color.h"
 #include "terminal/draw.h"
-#include "terminal/hardio.h"
 #include "terminal/kbd.h"
 #include "terminal/screen.h"
 #include "terminal/terminal.h"
@@ -235,6 +234,10 @@ struct screen_driver_opt {
 	/** These are directly derived from the terminal options. */
 	unsigned int transparent:1;
 
+	/** Whether moved blocks of lines are scrolled with a scrolling
+	 * region and line insertion/deletion instead of redrawn. */
+	unsigned int scroll:1;
+
 #ifdef CONFIG_UTF8
 	/* Whether the charset of the terminal is UTF-8.  This
 	 * is the same as is_cp_utf8(charsets[0]), except the
@@ -279,6 +282,7 @@ static const struct screen_driver_opt dumb_screen_driver_opt = {
 	/* color256_seqs: */	color256_seqs,
 #endif
 	/* transparent: */	1,
+	/* scroll: */		0,
 #ifdef CONFIG_UTF8
 	/* utf8_cp: */		0,
 #endif /* CONFIG_UTF8 */
@@ -299,6 +303,7 @@ static const struct screen_driver_opt vt100_screen_driver_opt = {
 	/* color256_seqs: */	color256_seqs,
 #endif
 	/* transparent: */	1,
+	/* scroll: */		1,
 #ifdef CONFIG_UTF8
 	/* utf8_cp: */		0,
 #endif /* CONFIG_UTF8 */
@@ -319,6 +324,7 @@ static const struct screen_driver_opt linux_screen_driver_opt = {
 	/* color256_seqs: */	color256_seqs,
 #endif
 	/* transparent: */	1,
+	/* scroll: */		1,
 #ifdef CONFIG_UTF8
 	/* utf8_cp: */		0,
 #endif /* CONFIG_UTF8 */
@@ -339,6 +345,7 @@ static const struct screen_driver_opt koi8_screen_driver_opt = {
 	/* color256_seqs: */	color256_seqs,
 #endif
 	/* transparent: */	1,
+	/* scroll: */		1,
 #ifdef CONFIG_UTF8
 	/* utf8_cp: */		0,
 #endif /* CONFIG_UTF8 */
@@ -359,6 +366,7 @@ static const struct screen_driver_opt freebsd_screen_driver_opt = {
 	/* color256_seqs: */	color256_seqs,
 #endif
 	/* transparent: */	1,
+	/* scroll: */		1,
 #ifdef CONFIG_UTF8
 	/* utf8_cp: */		0,
 #endif /* CONFIG_UTF8 */
@@ -379,6 +387,7 @@ static const struct screen_driver_opt fbterm_screen_driver_opt = {
 	/* color256_seqs: */	fbterm_color256_seqs,
 #endif
 	/* transparent: */	1,
+	/* scroll: */		1,
 #ifdef CONFIG_UTF8
 	/* utf8_cp: */		0,
 #endif /* CONFIG_UTF8 */
@@ -448,6 +457,9 @@ set_screen_driver_opt(struct screen_driver *driver, struct option *term_spec)
 		driver->opt.underline = NULL;
 	}
 
+	if (!get_opt_bool_tree(term_spec, "scroll_regions", NULL))
+		driver->opt.scroll = 0;
+
 	if (utf8_io) {
 		driver->opt.charsets[0] = cp;
 
@@ -1155,6 +1167,13 @@ add_char_true(struct string *screen, struct screen_driver *driver,
 		int is_last_line = (y == ymax);					\
 		int x = 0;						\
 										\
+		/* Skip lines that did not change at all. */			\
+		if (compare_screen_chars(pos, current, xmax + 1)) {		\
+			pos += xmax + 1;					\
+			current += xmax + 1;					\
+			continue;						\
+		}								\
+										\
 		for (; x <= xmax; x++, current++, pos++) {			\
 			/*  Workaround for terminals without
 			 *  "eat_newline_glitch (xn)", e.g., the cons25 family
@@ -1196,6 +1215,171 @@ add_char_true(struct string *screen, struct screen_driver *driver,
 	}									\
 }
 
+/** Adds the term code "\033[<n>@code" to @a screen, or "\033[<n>;<m>@code"
+ * if @a m is not negative. */
+static inline struct string *
+add_term_code_to_string(struct string *screen, int n, int m, unsigned char code)
+{
+#define CODE_NUM_LEN 10
+	unsigned char seq[4 + 2 * CODE_NUM_LEN + 1];
+	unsigned int length = 2;
+
+	seq[0] = '\033';
+	seq[1] = '[';
+
+	if (ulongcat(seq, &length, n, CODE_NUM_LEN, 0) < 0)
+		return screen;
+
+	if (m >= 0) {
+		seq[length++] = ';';
+
+		if (ulongcat(seq, &length, m, CODE_NUM_LEN, 0) < 0)
+			return screen;
+	}
+
+	seq[length++] = code;
+
+	return add_bytes_to_string(screen, seq, length);
+#undef CODE_NUM_LEN
+}
+
+/** Hashes a line of screen chars for add_scroll_to_string().  Lines with
+ * equal hashes are compared with compare_screen_line() before use. */
+static inline unsigned int
+hash_screen_line(struct screen_char *line, int width)
+{
+	unsigned int hash = 0;
+
+	for (; width > 0; width--, line++) {
+		int i;
+
+		hash = hash * 31 + line->data;
+		hash = hash * 31 + line->attr;
+		for (i = 0; i < SCREEN_COLOR_SIZE; i++)
+			hash = hash * 31 + line->c.color[i];
+	}
+
+	return hash;
+}
+
+static inline int
+compare_screen_line(struct screen_char *a, struct screen_char *b, int width)
+{
+	for (; width > 0; width--, a++, b++) {
+		if (a->data != b->data || a->attr != b->attr
+		    || memcmp(a->c.color, b->c.color, SCREEN_COLOR_SIZE))
+			return 0;
+	}
+
+	return 1;
+}
+
+/** Looks for a block of lines that has moved vertically between
+ * screen.last_image and screen.image, typically because a document
+ * was scrolled.  If moving it saves redrawing some lines, the block is
+ * moved on the terminal by deleting or inserting lines in a scrolling
+ * region and screen.last_image is updated to match, so that add_chars()
+ * only has to draw the exposed lines. */
+static void
+add_scroll_to_string(struct string *image, struct terminal *term)
+{
+	struct terminal_screen *screen = term->screen;
+	int width = term->width;
+	/* The last line is never part of the scrolling region since the
+	 * char at its bottom right is not drawn and may be stale. */
+	int top = screen->dirty_from;
+	int lines = int_min(screen->dirty_to, term->height - 2) - top + 1;
+	unsigned int *new_hash, *old_hash;
+	int best_shift = 0, best_end = 0, best_length = 0, best_gain = 0;
+	int shift, y, region_top, region_bottom, count;
+
+	if (lines < 3) return;
+
+	new_hash = mem_alloc(2 * lines * sizeof(*new_hash));
+	if (!new_hash) return;
+	old_hash = new_hash + lines;
+
+	for (y = 0; y < lines; y++) {
+		int pos = (top + y) * width;
+
+		new_hash[y] = hash_screen_line(&screen->image[pos], width);
+		old_hash[y] = hash_screen_line(&screen->last_image[pos], width);
+	}
+
+	/* Line @y of the new image is line @y + @shift of the old one.
+	 * The gain of a run of such lines is the number of them that
+	 * would have to be redrawn otherwise. */
+	for (shift = 1 - lines; shift < lines; shift++) {
+		int length = 0, gain = 0;
+
+		if (!shift) continue;
+
+		for (y = int_max(0, -shift); y < int_min(lines, lines - shift); y++) {
+			if (new_hash[y] != old_hash[y + shift]) {
+				length = gain = 0;
+				continue;
+			}
+
+			length++;
+			if (new_hash[y] != old_hash[y]) gain++;
+
+			if (gain > best_gain) {
+				best_gain = gain;
+				best_length = length;
+				best_end = y;
+				best_shift = shift;
+			}
+		}
+	}
+
+	mem_free(new_hash);
+
+	/* Each exposed line has to be drawn anyway. */
+	count = best_shift < 0 ? -best_shift : best_shift;
+	if (best_gain <= count) return;
+
+	for (y = best_end - best_length + 1; y <= best_end; y++) {
+		int pos = (top + y) * width;
+
+		if (!compare_screen_line(&screen->image[pos],
+					 &screen->last_image[pos + best_shift * width],
+					 width))
+			return;
+	}
+
+	if (best_shift > 0) {
+		region_top = top + best_end - best_length + 1;
+		region_bottom = top + best_end + best_shift;
+	} else {
+		region_top = top + best_end - best_length + 1 + best_shift;
+		region_bottom = top + best_end;
+	}
+
+	add_term_code_to_string(image, region_top + 1, region_bottom + 1, 'r');
+	add_cursor_move_to_string(image, region_top + 1, 1);
+	add_term_code_to_string(image, count, -1, best_shift > 0 ? 'M' : 'L');
+	add_bytes_to_string(image, "\033[r", 3);
+
+	/* Mirror the terminal in screen.last_image.  The exposed lines are
+	 * blank in the current background color, so make sure that they
+	 * get redrawn. */
+	if (best_shift > 0) {
+		memmove(&screen->last_image[region_top * width],
+			&screen->last_image[(region_top + count) * width],
+			(region_bottom - region_top + 1 - count) * width
+			* sizeof(struct screen_char));
+		memset(&screen->last_image[(region_bottom + 1 - count) * width],
+		       0xFF, count * width * sizeof(struct screen_char));
+	} else {
+		memmove(&screen->last_image[(region_top + count) * width],
+			&screen->last_image[region_top * width],
+			(region_bottom - region_top + 1 - count) * width
+			* sizeof(struct screen_char));
+		memset(&screen->last_image[region_top * width],
+		       0xFF, count * width * sizeof(struct screen_char));
+	}
+}
+
 /*! Updating of the terminal screen is done by checking what needs to
  * be updated using the last screen. */
 void
@@ -1209,11 +1393,18 @@ redraw_screen(struct terminal *term)
 	if (!screen || screen->dirty_from > screen->dirty_to) return;
 	if (term->master && is_blocked()) return;
 
+	/* The previous update is still being written.  Everything that
+	 * changes until then is sent at once when it is done. */
+	if (term->output_len) return;
+
 	driver = get_screen_driver(term);
 	if (!driver) return;
 
 	if (!init_string(&image)) return;
 
+	if (driver->opt.scroll)
+		add_scroll_to_string(&image, term);
+
 	switch (driver->opt.color_mode) {
 	default:
 		/* If the desired color mode was not compiled in,
@@ -1267,15 +1458,14 @@ redraw_screen(struct terminal *term)
 						  screen->cx + 1);
 	}
 
-	if (image.length) {
-		if (term->master) want_draw();
-		hard_write(term->fdout, image.source, image.length);
-		if (term->master) done_draw();
-	}
+	queue_terminal_output(term, image.source, image.length);
 
 	done_string(&image);
 
-	copy_screen_chars(screen->last_image, screen->image, term->width * term->height);
+	/* Lines outside the dirty range did not change. */
+	copy_screen_chars(&screen->last_image[screen->dirty_from * term->width],
+			  &screen->image[screen->dirty_from * term->width],
+			  (screen->dirty_to - screen->dirty_from + 1) * term->width);
 	screen->dirty_from = term->height;
 	screen->dirty_to = 0;
 }
@@ -1283,13 +1473,9 @@ redraw_screen(struct terminal *term)
 void
 erase_screen(struct terminal *term)
 {
-	if (term->master) {
-		if (is_blocked()) return;
-		want_draw();
-	}
+	if (term->master && is_blocked()) return;
 
-	hard_write(term->fdout, "\033[2J\033[1;1H", 10);
-	if (term->master) done_draw();
+	queue_terminal_output(term, "\033[2J\033[1;1H", 10);
 }
 
 void
@@ -1298,7 +1484,7 @@ beep_terminal(struct terminal *term)
 #ifdef CONFIG_OS_WIN32
 	MessageBeep(MB_ICONEXCLAMATION);
 #else
-	hard_write(term->fdout, "\a", 1);
+	queue_terminal_output(term, "\a", 1);
 #endif
 }
 
@@ -5,6 +5,7 @@
 #include "config.h"
 #endif
 
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -148,6 +149,143 @@ redraw_all_terminals(void)
 		redraw_screen(term);
 }
 
+/** Writes at most ::TERMINAL_OUTPUT_CHUNK bytes of @a data to
+ * terminal.fdout.  @return how many bytes were written, or -1 if the
+ * terminal cannot be written to.
+ *
+ * can_write() only tells that the terminal has some room, so the fd is
+ * made non-blocking for the write.  It is made blocking again right
+ * after, because the fd of the master terminal is shared with the
+ * parent shell and with the programs run by exec_on_terminal().  */
+static int
+write_terminal_chunk(struct terminal *term, unsigned char *data, int len)
+{
+	ssize_t written;
+	int nonblocking = (set_nonblocking_fd(term->fdout) >= 0);
+
+	if (term->master) want_draw();
+	written = safe_write(term->fdout, data, int_min(len, TERMINAL_OUTPUT_CHUNK));
+	if (term->master) done_draw();
+
+	if (nonblocking) {
+		int error = errno;
+
+		set_blocking_fd(term->fdout);
+		errno = error;
+	}
+
+	if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return 0;
+
+	return written;
+}
+
+/** Runs the terminal functions that waited for terminal.output to be
+ * written.  */
+static void
+dispatch_terminal_specials(struct terminal *term)
+{
+	unsigned char *specials = term->specials;
+	int len = term->specials_len;
+	int i = 0;
+
+	if (!specials) return;
+
+	term->specials = NULL;
+	term->specials_len = 0;
+
+	while (i < len) {
+		dispatch_special(&specials[i]);
+		i += strlen(&specials[i]) + 1;
+	}
+
+	mem_free(specials);
+}
+
+/** A select_handler_T write_func for terminal.fdout.  It is set while
+ * terminal.output is not empty.  redraw_screen() does not draw anything
+ * meanwhile, so when all the output is written, everything that changed
+ * since is sent as one update.  */
+static void
+write_terminal_output(struct terminal *term)
+{
+	int written = write_terminal_chunk(term, term->output, term->output_len);
+
+	/* Like hard_write(), give up on write errors.  */
+	if (written < 0) written = term->output_len;
+
+	term->output_len -= written;
+	if (term->output_len) {
+		memmove(term->output, term->output + written, term->output_len);
+		return;
+	}
+
+	mem_free_set(&term->output, NULL);
+	set_handlers(term->fdout,
+		     get_handler(term->fdout, SELECT_HANDLER_READ),
+		     NULL,
+		     get_handler(term->fdout, SELECT_HANDLER_ERROR),
+		     get_handler(term->fdout, SELECT_HANDLER_DATA));
+
+	dispatch_terminal_specials(term);
+	redraw_screen(term);
+}
+
+/** Writes @a data to terminal.fdout without blocking the select loop.
+ * What cannot be written right away is kept in terminal.output and
+ * written by write_terminal_output() when terminal.fdout is writable. */
+void
+queue_terminal_output(struct terminal *term, unsigned char *data, int len)
+{
+	int written = 0;
+	unsigned char *output;
+
+	if (!len) return;
+
+	if (!term->output_len && can_write(term->fdout)) {
+		written = write_terminal_chunk(term, data, len);
+		if (written < 0 || written == len) return;
+	}
+
+	output = mem_realloc(term->output, term->output_len + len - written);
+	if (!output) {
+		flush_terminal_output(term);
+		hard_write(term->fdout, data + written, len - written);
+		return;
+	}
+
+	memcpy(output + term->output_len, data + written, len - written);
+	term->output = output;
+	term->output_len += len - written;
+
+	set_handlers(term->fdout,
+		     get_handler(term->fdout, SELECT_HANDLER_READ),
+		     (select_handler_T) write_terminal_output,
+		     get_handler(term->fdout, SELECT_HANDLER_ERROR),
+		     term);
+}
+
+/** Writes all of terminal.output, blocking if needed.  This must be done
+ * before anything is written to the terminal bypassing the queue. */
+void
+flush_terminal_output(struct terminal *term)
+{
+	if (!term->output) return;
+
+	if (term->master) want_draw();
+	hard_write(term->fdout, term->output, term->output_len);
+	if (term->master) done_draw();
+
+	mem_free_set(&term->output, NULL);
+	term->output_len = 0;
+	set_handlers(term->fdout,
+		     get_handler(term->fdout, SELECT_HANDLER_READ),
+		     NULL,
+		     get_handler(term->fdout, SELECT_HANDLER_ERROR),
+		     get_handler(term->fdout, SELECT_HANDLER_DATA));
+	dispatch_terminal_specials(term);
+}
+
 void
 destroy_terminal(struct terminal *term)
 {
@@ -174,6 +312,7 @@ destroy_terminal(struct terminal *term)
 	mem_free_if(term->title);
 	if (term->screen) done_screen(term->screen);
 
+	flush_terminal_output(term);
 	clear_handlers(term->fdin);
 	mem_free_if(term->interlink);
 
@@ -324,7 +463,7 @@ exec_on_slave_terminal( struct terminal *term,
 	data[1] = fg;
 	memcpy(data + 2, path, plen + 1);
 	memcpy(data + 2 + plen + 1, delete_, dlen + 1);
-	hard_write(term->fdout, data, data_size);
+	queue_terminal_output(term, data, data_size);
 	fmem_free(data);
 }
 
@@ -344,10 +483,29 @@ exec_on_terminal(struct terminal *term, unsigned char *path,
 
 	if (term->master) {
 		if (!*path) {
+			/* This may write to the terminal directly, so it
+			 * has to wait for the queued output.  */
+			if (term->output) {
+				int len = strlen(delete_) + 1;
+				unsigned char *specials;
+
+				specials = mem_realloc(term->specials,
+						       term->specials_len + len);
+				if (!specials) return;
+
+				memcpy(specials + term->specials_len, delete_, len);
+				term->specials = specials;
+				term->specials_len += len;
+				return;
+			}
+
 			dispatch_special(delete_);
 			return;
 		}
 
+		/* The program will use the terminal. */
+		flush_terminal_output(term);
+
 		/* TODO: Should this be changed to allow TERM_EXEC_NEWWIN
 		 * in a blocked terminal?  There is similar code in
 		 * in_sock().  --KON, 2007 */
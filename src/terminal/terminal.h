@@ -117,6 +117,16 @@ struct terminal {
 	 * @see struct itrm */
 	int fdin, fdout;
 
+	/** Output for #fdout that has not been written yet, because
+	 * writing it could have blocked.  See queue_terminal_output(). */
+	unsigned char *output;
+	int output_len;
+
+	/** Terminal functions for dispatch_special() that have to wait
+	 * until #output is written, separated by null chars. */
+	unsigned char *specials;
+	int specials_len;
+
 	/** This indicates that the terminal is blocked, that is nothing should
 	 * be drawn on it etc. Typically an external program is running on it
 	 * right now. This is a file descriptor. */
@@ -189,6 +199,8 @@ int get_terminal_codepage(const struct terminal *);
 
 void redraw_all_terminals(void);
 void destroy_all_terminals(void);
+void queue_terminal_output(struct terminal *term, unsigned char *data, int len);
+void flush_terminal_output(struct terminal *term);
 void exec_thread(unsigned char *, int);
 void close_handle(void *);
 
@@ -0,0 +1,208 @@
+/* Benchmark finding the changed chars of the screen image */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "elinks.h"
+
+#include "terminal/draw.h"
+#include "util/memory.h"
+#include "util/test.h"
+
+
+/* The screen_char as it was before the unused node_number was dropped
+ * from its color union, which padded it to 16 bytes with true color. */
+struct old_screen_char {
+#ifdef CONFIG_UTF8
+	unicode_val_T data;
+#else
+	unsigned char data;
+#endif /* CONFIG_UTF8 */
+	unsigned char attr;
+	union {
+		unsigned char color[SCREEN_COLOR_SIZE];
+		unsigned int node_number;
+	} c;
+};
+
+/* What the cell loop of add_chars() in terminal/screen.c checks, without
+ * generating any output.  Both return the number of chars to redraw. */
+static int
+count_old(struct old_screen_char *image, struct old_screen_char *last,
+	  int width, int height)
+{
+	int changed = 0;
+	int i;
+
+	for (i = 0; i < width * height; i++) {
+		if (image[i].data == last[i].data
+		    && image[i].attr == last[i].attr
+		    && !memcmp(image[i].c.color, last[i].c.color,
+			       SCREEN_COLOR_SIZE))
+			continue;
+
+		changed++;
+	}
+
+	return changed;
+}
+
+static int
+count_new(struct screen_char *image, struct screen_char *last,
+	  int width, int height)
+{
+	int changed = 0;
+	int y;
+
+	for (y = 0; y < height; y++) {
+		int i = y * width;
+		int end = i + width;
+
+		if (compare_screen_chars(&image[i], &last[i], width))
+			continue;
+
+		for (; i < end; i++) {
+			if (image[i].data == last[i].data
+			    && image[i].attr == last[i].attr
+			    && !memcmp(image[i].c.color, last[i].c.color,
+				       SCREEN_COLOR_SIZE))
+				continue;
+
+			changed++;
+		}
+	}
+
+	return changed;
+}
+
+/* Fill both images with the same text in a few colors. */
+#define fill_image(image, width, height) \
+	do {								\
+		int i_;							\
+									\
+		for (i_ = 0; i_ < (width) * (height); i_++) {		\
+			int c_;						\
+									\
+			(image)[i_].data = 'a' + (i_ * 7) % 26;		\
+			(image)[i_].attr = (i_ / 40) % 3 ? 0 : SCREEN_ATTR_BOLD; \
+			for (c_ = 0; c_ < SCREEN_COLOR_SIZE; c_++)	\
+				(image)[i_].c.color[c_] = (i_ / 13 + c_) & 7; \
+		}							\
+	} while (0)
+
+/* Change @lines lines of @image, every (@height / @lines)th one. */
+#define change_image(image, width, height, lines, round) \
+	do {								\
+		int l_;							\
+									\
+		for (l_ = 0; l_ < (lines); l_++) {			\
+			int y_ = l_ * ((height) / (lines));		\
+									\
+			(image)[y_ * (width) + (round) % (width)].data++; \
+		}							\
+	} while (0)
+
+static double
+seconds(clock_t start)
+{
+	return (double) (clock() - start) / CLOCKS_PER_SEC;
+}
+
+int
+main(int argc, char *argv[])
+{
+	int width = 300, height = 100;
+	int rounds = 2000;
+	static const int changes[] = { 0, 1, 10, 100 };
+	struct old_screen_char *old_image, *old_last;
+	struct screen_char *image, *last;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		char *arg = argv[i];
+
+		if (strncmp(arg, "--", 2))
+			break;
+
+		arg += 2;
+
+		if (get_test_opt(&arg, "width", &i, argc, argv, "a number")) {
+			width = atoi(arg);
+			if (width <= 0) die("--width expects a positive number");
+
+		} else if (get_test_opt(&arg, "height", &i, argc, argv, "a number")) {
+			height = atoi(arg);
+			if (height <= 0) die("--height expects a positive number");
+
+		} else if (get_test_opt(&arg, "rounds", &i, argc, argv, "a number")) {
+			rounds = atoi(arg);
+			if (rounds <= 0) die("--rounds expects a positive number");
+
+		} else {
+			die("usage: %s [--width N] [--height N] [--rounds N]", argv[0]);
+		}
+	}
+
+	old_image = mem_calloc(width * height, sizeof(*old_image));
+	old_last = mem_calloc(width * height, sizeof(*old_last));
+	image = mem_calloc(width * height, sizeof(*image));
+	last = mem_calloc(width * height, sizeof(*last));
+	if (!old_image || !old_last || !image || !last) die("out of memory");
+
+	printf("%dx%d screen, %d and %d bytes per char\n", width, height,
+	       (int) sizeof(*old_image), (int) sizeof(*image));
+	printf("%8s %12s %12s %8s\n",
+	       "changed", "cells (us)", "lines (us)", "speedup");
+
+	for (i = 0; i < sizeof(changes) / sizeof(*changes); i++) {
+		int lines = changes[i] < height ? changes[i] : height;
+		double o, n;
+		clock_t start;
+		int r, old_count = 0, new_count = 0;
+
+		fill_image(old_image, width, height);
+		fill_image(old_last, width, height);
+		fill_image(image, width, height);
+		fill_image(last, width, height);
+
+		start = clock();
+		for (r = 0; r < rounds; r++) {
+			change_image(old_image, width, height, lines, r);
+			old_count += count_old(old_image, old_last, width, height);
+			memcpy(old_last, old_image, width * height * sizeof(*old_image));
+		}
+		o = seconds(start);
+
+		start = clock();
+		for (r = 0; r < rounds; r++) {
+			change_image(image, width, height, lines, r);
+			new_count += count_new(image, last, width, height);
+			copy_screen_chars(last, image, width * height);
+		}
+		n = seconds(start);
+
+		if (old_count != new_count)
+			die("%d changed lines: %d chars found but %d expected",
+			    lines, new_count, old_count);
+
+		/* Per redraw times in microseconds. */
+		o = o * 1e6 / rounds;
+		n = n * 1e6 / rounds;
+		printf("%8d %12.1f %12.1f %7.2fx\n",
+		       lines, o, n, n > 0 ? o / n : 0.0);
+	}
+
+	mem_free(old_image);
+	mem_free(old_last);
+	mem_free(image);
+	mem_free(last);
+
+	return 0;
+}
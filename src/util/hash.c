@@ -9,45 +9,58 @@
 
 #include "elinks.h"
 
+#include "util/error.h"
 #include "util/hash.h"
 #include "util/memory.h"
 
 
 /* String hashes functions chooser. */
+#define MURMUR_HASH /* Good and fast */
 /* #define MIX_HASH */ /* Far more better but slower */
-#define X31_HASH /* Weaker but faster */
+/* #define X31_HASH */ /* Weaker but faster */
 
 
-/* We provide common infrastructure for hashing - each hash consists from one
- * particularly large array full of small lists of keys with same index in the
- * array (same hash value). */
+/* We provide common infrastructure for hashing - each hash is an array of
+ * pointers to the items, looked up by linear probing from the slot given by
+ * the hash value of the key.  The array is doubled whenever it gets more
+ * than HASH_MAX_LOAD percent full, counting the tombstones left behind by
+ * deleted items. */
 
 #define hash_mask(n) (hash_size(n) - 1)
 #define hash_size(n) (1 << (n))
 
+/** Maximal percentage of used slots before the hash is grown or, if most
+ * of them are just tombstones, rehashed in place. */
+#define HASH_MAX_LOAD 75
+
+/** The array is never grown past 2^HASH_MAX_WIDTH slots; the probing
+ * then just gets slower. */
+#define HASH_MAX_WIDTH 24
+
+struct hash_item hash_deleted_item;
+
 static hash_value_T strhash(unsigned char *k, unsigned int length, hash_value_T initval);
 
 static inline struct hash *
 init_hash(unsigned int width, hash_func_T func)
 {
 	struct hash *hash;
-	unsigned int i = 0;
 
 	assert(width > 0 && func);
 	if_assert_failed return NULL;
 
-	/* One is already reserved in struct hash, so use size - 1. */
-	hash = mem_alloc(sizeof(*hash) + (hash_size(width) - 1)
-			 * sizeof(struct list_head));
+	hash = mem_calloc(1, sizeof(*hash));
 	if (!hash) return NULL;
 
+	hash->items = mem_calloc(hash_size(width), sizeof(*hash->items));
+	if (!hash->items) {
+		mem_free(hash);
+		return NULL;
+	}
+
 	hash->width = width;
 	hash->func = func;
 
-	/* Initialize dummy list_heads */
-	for (; i < hash_size(width); i++)
-		init_list(hash->hash[i]);
-
 	return hash;
 }
 
@@ -62,17 +75,64 @@ init_hash8(void)
 void
 free_hash(struct hash **hashp)
 {
-	unsigned int i = 0;
+	struct hash_item *item;
+	unsigned int i;
 
 	assert(hashp && *hashp);
 	if_assert_failed return;
 
-	for (; i < hash_size((*hashp)->width); i++)
-		free_list((*hashp)->hash[i]);
+	foreach_hash_item (item, **hashp, i)
+		mem_free(item);
 
+	mem_free((*hashp)->items);
 	mem_free_set(hashp, NULL);
 }
 
+/** Find the slot of the first empty slot or tombstone on the probe
+ * sequence of @a hashval. */
+static inline unsigned int
+find_free_slot(struct hash *hash, hash_value_T hashval)
+{
+	unsigned int mask = hash_mask(hash->width);
+	unsigned int slot = hashval & mask;
+
+	while (hash_slot_has_item(hash->items[slot]))
+		slot = (slot + 1) & mask;
+
+	return slot;
+}
+
+/** Move all items to a new array 2^@a width slots long, dropping the
+ * tombstones on the way.
+ * @returns 0 if there was not enough memory. */
+static int
+resize_hash(struct hash *hash, unsigned int width)
+{
+	struct hash_item **items = hash->items;
+	unsigned int size = hash_size(hash->width);
+	unsigned int i;
+
+	hash->items = mem_calloc(hash_size(width), sizeof(*hash->items));
+	if (!hash->items) {
+		hash->items = items;
+		return 0;
+	}
+
+	hash->width = width;
+	hash->used = hash->count;
+
+	for (i = 0; i < size; i++) {
+		struct hash_item *item = items[i];
+
+		if (!hash_slot_has_item(item)) continue;
+		hash->items[find_free_slot(hash, item->hashval)] = item;
+	}
+
+	mem_free(items);
+
+	return 1;
+}
+
 
 /** Initialization vector for the hash function.
  * I've no much idea about what to set here.. I think it doesn't matter much
@@ -85,18 +145,36 @@ struct hash_item *
 add_hash_item(struct hash *hash, unsigned char *key, unsigned int keylen,
 	      void *value)
 {
-	hash_value_T hashval;
-	struct hash_item *item = mem_alloc(sizeof(*item));
+	struct hash_item *item;
+	unsigned int slot;
 
-	if (!item) return NULL;
+	if ((hash->used + 1) * 100 > hash_size(hash->width) * HASH_MAX_LOAD) {
+		/* Rehash in place if at least a half of the used slots
+		 * are tombstones, otherwise double the size. */
+		unsigned int width = hash->width;
+
+		if (hash->count * 2 > hash->used && width < HASH_MAX_WIDTH)
+			width++;
+
+		/* Failing to grow is not fatal as long as there is at least
+		 * one empty slot left to end the probing. */
+		if (!resize_hash(hash, width)
+		    && hash->used + 1 >= hash_size(hash->width))
+			return NULL;
+	}
 
-	hashval = hash->func(key, keylen, HASH_MAGIC) & hash_mask(hash->width);
+	item = mem_alloc(sizeof(*item));
+	if (!item) return NULL;
 
 	item->key = key;
 	item->keylen = keylen;
 	item->value = value;
+	item->hashval = hash->func(key, keylen, HASH_MAGIC);
 
-	add_to_list(hash->hash[hashval], item);
+	slot = find_free_slot(hash, item->hashval);
+	if (!hash->items[slot]) hash->used++;
+	hash->items[slot] = item;
+	hash->count++;
 
 	return item;
 }
@@ -105,28 +183,31 @@ add_hash_item(struct hash *hash, unsigned char *key, unsigned int keylen,
 struct hash_item *
 get_hash_item(struct hash *hash, unsigned char *key, unsigned int keylen)
 {
-	struct list_head *list;
+	unsigned int mask = hash_mask(hash->width);
+	hash_value_T hashval = hash->func(key, keylen, HASH_MAGIC);
+	unsigned int slot = hashval & mask;
 	struct hash_item *item;
-	hash_value_T hashval;
 
-	hashval = hash->func(key, keylen, HASH_MAGIC) & hash_mask(hash->width);
-	list    = &hash->hash[hashval];
-
-	foreach (item, *list) {
+	for (; (item = hash->items[slot]); slot = (slot + 1) & mask) {
+		if (item == &hash_deleted_item) continue;
+		if (hashval != item->hashval) continue;
 		if (keylen != item->keylen) continue;
 		if (memcmp(key, item->key, keylen)) continue;
 
-		/* Watch the MFR (Move Front Rule)! Basically, it self-orders
-		 * the list by popularity of its items. Inspired from Links,
-		 * probably PerM. --pasky */
-		move_to_top_of_list(*list, item);
-
 		return item;
 	}
 
 	return NULL;
 }
 
+/** Hash @a length bytes of @a data, for users which need to identify some
+ * data by a hash value of their own. */
+hash_value_T
+hash_data(unsigned char *data, unsigned int length)
+{
+	return strhash(data, length, HASH_MAGIC);
+}
+
 #undef HASH_MAGIC
 
 /** Delete @a item from @a hash.
@@ -136,15 +217,96 @@ get_hash_item(struct hash *hash, unsigned char *key, unsigned int keylen)
 void
 del_hash_item(struct hash *hash, struct hash_item *item)
 {
+	unsigned int mask = hash_mask(hash->width);
+	unsigned int slot;
+
 	assert(item);
 	if_assert_failed return;
 
-	del_from_list(item);
+	for (slot = item->hashval & mask; hash->items[slot] != item;
+	     slot = (slot + 1) & mask) {
+		assertm(hash->items[slot] != NULL, "item not in hash");
+		if_assert_failed return;
+	}
+
+	hash->items[slot] = &hash_deleted_item;
+	hash->count--;
+
+	if (!hash->count) {
+		/* Nothing to probe past anymore, so drop the tombstones.
+		 * This keeps the array usable by foreach_hash_item. */
+		memset(hash->items, 0,
+		       hash_size(hash->width) * sizeof(*hash->items));
+		hash->used = 0;
+	}
+
 	mem_free(item);
 }
 
 
-#ifdef X31_HASH
+#if defined(MURMUR_HASH)
+
+/** Rotate a 32-bit value @a x left by @a r bits. */
+#define rotl32(x, r) (((x) << (r)) | ((x) >> (32 - (r))))
+
+/** Hash an array of bytes.  This is MurmurHash3 (x86, 32-bit) by Austin
+ * Appleby, which was placed in the public domain.  It mixes the key four
+ * bytes at a time and passes the usual avalanche tests while costing only
+ * a few multiplications per word.
+ * @param k		the key
+ * @param length	the length of the key
+ * @param initval	the previous hash, or an arbitrary value */
+static hash_value_T
+strhash(unsigned char *k,
+	unsigned int length,
+	hash_value_T initval)
+{
+	const uint32_t c1 = 0xcc9e2d51;
+	const uint32_t c2 = 0x1b873593;
+	uint32_t h = (uint32_t) initval;
+	uint32_t w;
+	unsigned int len = length;
+
+	for (; len >= 4; k += 4, len -= 4) {
+		/* Read the bytes one by one so that unaligned keys and
+		 * big endian machines give the same hash. */
+		w = k[0] | (k[1] << 8) | (k[2] << 16) | ((uint32_t) k[3] << 24);
+
+		w *= c1;
+		w = rotl32(w, 15);
+		w *= c2;
+
+		h ^= w;
+		h = rotl32(h, 13);
+		h = h * 5 + 0xe6546b64;
+	}
+
+	w = 0;
+	switch (len) {	/* all the case statements fall through */
+		case 3: w ^= k[2] << 16;
+		case 2: w ^= k[1] << 8;
+		case 1: w ^= k[0];
+			w *= c1;
+			w = rotl32(w, 15);
+			w *= c2;
+			h ^= w;
+	}
+
+	/* Force all bits of the hash to avalanche. */
+	h ^= length;
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+
+	return h;
+}
+
+#undef rotl32
+
+#elif defined(X31_HASH)
+
 
 /** Fast string hashing.
  * @param k		the key
@@ -186,7 +348,7 @@ strhash(unsigned char *k,
 	return h;
 }
 
-#else /* X31_HASH */
+#else /* MIX_HASH */
 
 /* String hashing function follows; it is not written by me, somewhere below
  * are credits. I only hacked it a bit. --pasky */
@@ -324,6 +486,8 @@ strhash(unsigned char *k,
 
 #undef keycompute
 #undef mix
-#undef hash_mask
 
 #endif /* MIX_HASH */
+
+#undef hash_mask
+#undef hash_size
@@ -1,8 +1,6 @@
 #ifndef EL__UTIL_HASH_H
 #define EL__UTIL_HASH_H
 
-#include "util/lists.h"
-
 /** This should be hopefully always 32bit at least. I'm not sure what will
  * happen when this will be of other length, but it should still work ok.
  * --pasky */
@@ -10,19 +8,33 @@ typedef unsigned long hash_value_T;
 typedef hash_value_T (* hash_func_T)(unsigned char *key, unsigned int keylen, hash_value_T magic);
 
 struct hash_item {
-	LIST_HEAD(struct hash_item);
-
 	unsigned char *key;
 	unsigned int keylen;
 	void *value;
+
+	/** The full hash value of @c key, so that probing and growing
+	 * need not rehash the key nor compare most of the keys. */
+	hash_value_T hashval;
 };
 
+/** Open addressing hash table.  The slots only point to the items, so
+ * the struct hash_item pointers returned by add_hash_item() stay valid
+ * until the item is deleted, even when the table grows. */
 struct hash {
-	unsigned int width; /**< Number of bits - hash array must be 2^width long. */
+	unsigned int width; /**< Number of bits - slots array is 2^width long. */
+	unsigned int count; /**< Number of items in the table. */
+	unsigned int used;  /**< Number of non-empty slots, tombstones included. */
 	hash_func_T func;
-	struct list_head hash[1]; /**< Must be at end ! */
+	struct hash_item **items;
 };
 
+/** Marks the slot of a deleted item, so that probing goes on past it.
+ * @relates hash */
+extern struct hash_item hash_deleted_item;
+
+#define hash_slot_has_item(slot) \
+	((slot) != NULL && (slot) != &hash_deleted_item)
+
 struct hash *init_hash8(void);
 
 void free_hash(struct hash **hashp);
@@ -31,9 +43,13 @@ struct hash_item *add_hash_item(struct hash *hash, unsigned char *key, unsigned
 struct hash_item *get_hash_item(struct hash *hash, unsigned char *key, unsigned int keylen);
 void del_hash_item(struct hash *hash, struct hash_item *item);
 
-/** @relates hash */
+hash_value_T hash_data(unsigned char *data, unsigned int length);
+
+/** Items may be deleted with del_hash_item() while iterating, but
+ * adding ones may grow the table and must be avoided.
+ * @relates hash */
 #define foreach_hash_item(item, hash_table, iterator) \
 	for (iterator = 0; iterator < (1 << (hash_table).width); iterator++) \
-		foreach (item, (hash_table).hash[iterator])
+		if (!hash_slot_has_item((item) = (hash_table).items[iterator])) ; else
 
 #endif
@@ -104,6 +104,19 @@ mem_realloc(void *p, size_t size)
 #endif
 
 
+/** Returns the size of a memory page, or 0 if it is not known. */
+int
+get_page_size(void)
+{
+	static int page_size;
+
+#ifdef HAVE_SC_PAGE_SIZE
+	if (!page_size) page_size = sysconf(_SC_PAGE_SIZE);
+#endif
+	return page_size > 0 ? page_size : 0;
+}
+
+
 /* TODO: Leak detector and the usual protection gear? patience()?
  *
  * We could just alias mem_mmap_* to mem_debug_* #if DEBUG_MEMLEAK, *WHEN* we are
@@ -111,18 +124,15 @@ mem_realloc(void *p, size_t size)
 
 #ifdef HAVE_MMAP
 
-static int page_size;
-
 /** Round up to a full page.
  * This tries to prevent useless reallocations, especially since they
  * are quite expensive in the mremap()-less case. */
 static size_t
 round_size(size_t size)
 {
-#ifdef HAVE_SC_PAGE_SIZE
-	if (!page_size) page_size = sysconf(_SC_PAGE_SIZE);
-#endif
-	if (page_size <= 0) page_size = 1;
+	int page_size = get_page_size();
+
+	if (!page_size) page_size = 1;
 	return (size / page_size + 1) * page_size;
 }
 
@@ -135,7 +145,9 @@ void *
 mem_mmap_alloc(size_t size)
 {
 	if (size) {
-		void *p = mmap(NULL, round_size(size), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+		/* Private, since mremap() cannot really grow a shared
+		 * anonymous mapping: the pages past the old size fault. */
+		void *p = mmap(NULL, round_size(size), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
 
 		if (p != MAP_FAILED)
 			return p;
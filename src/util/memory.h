@@ -20,6 +20,8 @@
 #include <sys/types.h>
 #include <stddef.h>
 
+int get_page_size(void);
+
 #ifdef HAVE_MMAP
 void *mem_mmap_alloc(size_t size);
 void mem_mmap_free(void *p, size_t size);
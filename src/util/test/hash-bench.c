@@ -0,0 +1,291 @@
+/* Benchmark the hash tables against the old chained ones */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "elinks.h"
+
+#include "util/hash.h"
+#include "util/lists.h"
+#include "util/memory.h"
+#include "util/test.h"
+
+
+/* The hash tables as they were before util/hash.c switched to open
+ * addressing: 256 lists of items, X31 string hash, move-to-front on
+ * lookup. */
+
+struct list_hash_item {
+	LIST_HEAD(struct list_hash_item);
+
+	unsigned char *key;
+	unsigned int keylen;
+	void *value;
+};
+
+struct list_hash {
+	struct list_head hash[256];
+};
+
+static hash_value_T
+x31_hash(unsigned char *k, unsigned int length)
+{
+	hash_value_T h = 0xdeadbeef;
+	unsigned int i;
+
+	for (i = 0; i < length; i++)
+		h = (h << 5) - h + k[i];
+
+	return h;
+}
+
+static struct list_hash *
+init_list_hash(void)
+{
+	struct list_hash *hash = mem_alloc(sizeof(*hash));
+	int i;
+
+	if (!hash) return NULL;
+
+	for (i = 0; i < 256; i++)
+		init_list(hash->hash[i]);
+
+	return hash;
+}
+
+static void
+free_list_hash(struct list_hash *hash)
+{
+	int i;
+
+	for (i = 0; i < 256; i++)
+		free_list(hash->hash[i]);
+
+	mem_free(hash);
+}
+
+static struct list_hash_item *
+add_list_hash_item(struct list_hash *hash, unsigned char *key,
+		   unsigned int keylen, void *value)
+{
+	struct list_hash_item *item = mem_alloc(sizeof(*item));
+
+	if (!item) return NULL;
+
+	item->key = key;
+	item->keylen = keylen;
+	item->value = value;
+	add_to_list(hash->hash[x31_hash(key, keylen) & 255], item);
+
+	return item;
+}
+
+static struct list_hash_item *
+get_list_hash_item(struct list_hash *hash, unsigned char *key,
+		   unsigned int keylen)
+{
+	struct list_head *list = &hash->hash[x31_hash(key, keylen) & 255];
+	struct list_hash_item *item;
+
+	foreach (item, *list) {
+		if (keylen != item->keylen) continue;
+		if (memcmp(key, item->key, keylen)) continue;
+
+		move_to_top_of_list(*list, item);
+		return item;
+	}
+
+	return NULL;
+}
+
+static void
+del_list_hash_item(struct list_hash_item *item)
+{
+	del_from_list(item);
+	mem_free(item);
+}
+
+
+static unsigned char **keys;
+static unsigned char **missing;
+static void **items;
+
+/* Make keys looking like the option names and URIs hashed by ELinks. */
+static unsigned char *
+make_key(int i, int missing)
+{
+	unsigned char *key = mem_alloc(64);
+
+	if (!key) die("out of memory");
+
+	if (i % 2)
+		snprintf(key, 64, "document.browse.option_%d%s", i,
+			 missing ? "x" : "");
+	else
+		snprintf(key, 64, "http://www%d.example.org/%s", i,
+			 missing ? "x" : "");
+
+	return key;
+}
+
+static double
+seconds(clock_t start)
+{
+	return (double) (clock() - start) / CLOCKS_PER_SEC;
+}
+
+static void
+bench_list_hash(int nkeys, int rounds, double t[4])
+{
+	struct list_hash *hash = init_list_hash();
+	clock_t start;
+	int i, r;
+
+	if (!hash) die("out of memory");
+
+	start = clock();
+	for (i = 0; i < nkeys; i++)
+		items[i] = add_list_hash_item(hash, keys[i], strlen(keys[i]), keys[i]);
+	t[0] = seconds(start);
+
+	start = clock();
+	for (r = 0; r < rounds; r++)
+		for (i = 0; i < nkeys; i++)
+			if (!get_list_hash_item(hash, keys[i], strlen(keys[i])))
+				die("list hash: key %s not found", keys[i]);
+	t[1] = seconds(start);
+
+	start = clock();
+	for (r = 0; r < rounds; r++)
+		for (i = 0; i < nkeys; i++)
+			if (get_list_hash_item(hash, missing[i], strlen(missing[i])))
+				die("list hash: key %s found", missing[i]);
+	t[2] = seconds(start);
+
+	start = clock();
+	for (i = 0; i < nkeys; i++)
+		del_list_hash_item(items[i]);
+	t[3] = seconds(start);
+
+	free_list_hash(hash);
+}
+
+static void
+bench_hash(int nkeys, int rounds, double t[4])
+{
+	struct hash *hash = init_hash8();
+	clock_t start;
+	int i, r;
+
+	if (!hash) die("out of memory");
+
+	start = clock();
+	for (i = 0; i < nkeys; i++)
+		items[i] = add_hash_item(hash, keys[i], strlen(keys[i]), keys[i]);
+	t[0] = seconds(start);
+
+	start = clock();
+	for (r = 0; r < rounds; r++)
+		for (i = 0; i < nkeys; i++)
+			if (!get_hash_item(hash, keys[i], strlen(keys[i])))
+				die("hash: key %s not found", keys[i]);
+	t[1] = seconds(start);
+
+	start = clock();
+	for (r = 0; r < rounds; r++)
+		for (i = 0; i < nkeys; i++)
+			if (get_hash_item(hash, missing[i], strlen(missing[i])))
+				die("hash: key %s found", missing[i]);
+	t[2] = seconds(start);
+
+	start = clock();
+	for (i = 0; i < nkeys; i++)
+		del_hash_item(hash, items[i]);
+	t[3] = seconds(start);
+
+	free_hash(&hash);
+}
+
+int
+main(int argc, char *argv[])
+{
+	static const char *names[] = { "add", "hit", "miss", "delete" };
+	static const int default_sizes[] = { 100, 1000, 10000, 100000 };
+	const int *sizes = default_sizes;
+	int nsizes = sizeof(default_sizes) / sizeof(*default_sizes);
+	int size = 0;
+	int total = 1000000;
+	int i, s;
+
+	for (i = 1; i < argc; i++) {
+		char *arg = argv[i];
+
+		if (strncmp(arg, "--", 2))
+			break;
+
+		arg += 2;
+
+		if (get_test_opt(&arg, "keys", &i, argc, argv, "a number")) {
+			size = atoi(arg);
+			if (size <= 0) die("--keys expects a positive number");
+			sizes = &size;
+			nsizes = 1;
+
+		} else if (get_test_opt(&arg, "lookups", &i, argc, argv, "a number")) {
+			total = atoi(arg);
+			if (total <= 0) die("--lookups expects a positive number");
+
+		} else {
+			die("usage: %s [--keys N] [--lookups N]", argv[0]);
+		}
+	}
+
+	printf("%8s %-7s %12s %12s %8s\n",
+	       "keys", "op", "list (ns)", "open (ns)", "speedup");
+
+	for (s = 0; s < nsizes; s++) {
+		int nkeys = sizes[s];
+		int rounds = total / nkeys > 0 ? total / nkeys : 1;
+		double old[4], new[4];
+
+		keys = mem_calloc(nkeys, sizeof(*keys));
+		missing = mem_calloc(nkeys, sizeof(*missing));
+		items = mem_calloc(nkeys, sizeof(*items));
+		if (!keys || !missing || !items) die("out of memory");
+
+		for (i = 0; i < nkeys; i++) {
+			keys[i] = make_key(i, 0);
+			missing[i] = make_key(i, 1);
+		}
+
+		bench_list_hash(nkeys, rounds, old);
+		bench_hash(nkeys, rounds, new);
+
+		for (i = 0; i < 4; i++) {
+			/* Per operation times in nanoseconds. */
+			int ops = (i == 1 || i == 2) ? nkeys * rounds : nkeys;
+			double o = old[i] * 1e9 / ops;
+			double n = new[i] * 1e9 / ops;
+
+			printf("%8d %-7s %12.1f %12.1f %7.2fx\n",
+			       nkeys, names[i], o, n, n > 0 ? o / n : 0.0);
+		}
+
+		for (i = 0; i < nkeys; i++) {
+			mem_free(keys[i]);
+			mem_free(missing[i]);
+		}
+		mem_free(keys);
+		mem_free(missing);
+		mem_free(items);
+	}
+
+	return 0;
+}
@@ -0,0 +1,126 @@
+/* Test the hash tables */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "elinks.h"
+
+#include "util/hash.h"
+#include "util/memory.h"
+
+#define KEYS 20000
+
+static unsigned char keys[KEYS][16];
+static struct hash_item *items[KEYS];
+static int count_fail = 0;
+
+#define check(cond, msg, i) \
+	do { \
+		if (!(cond)) { \
+			fprintf(stderr, "Test failed: %s (key %d)\n", msg, i); \
+			count_fail++; \
+		} \
+	} while (0)
+
+static int
+count_hash_items(struct hash *hash)
+{
+	struct hash_item *item;
+	int i, count = 0;
+
+	foreach_hash_item (item, *hash, i)
+		count++;
+
+	return count;
+}
+
+int
+main(void)
+{
+	struct hash *hash = init_hash8();
+	struct hash_item *item;
+	int i;
+
+	if (!hash) {
+		fputs("Cannot allocate the hash\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < KEYS; i++)
+		snprintf(keys[i], sizeof(keys[i]), "key%d", i);
+
+	/* Add enough items for the hash to grow several times. */
+	for (i = 0; i < KEYS; i++) {
+		items[i] = add_hash_item(hash, keys[i], strlen(keys[i]),
+					 &keys[i]);
+		check(items[i], "add", i);
+	}
+
+	check(hash->count == KEYS, "count after adding", 0);
+	check(count_hash_items(hash) == KEYS, "iteration after adding", 0);
+
+	/* The items do not move when the hash grows. */
+	for (i = 0; i < KEYS; i++) {
+		item = get_hash_item(hash, keys[i], strlen(keys[i]));
+		check(item == items[i], "lookup", i);
+		check(item && item->value == &keys[i], "value", i);
+	}
+
+	/* Keys with a common prefix are not confused. */
+	check(!get_hash_item(hash, "key", 3), "lookup of a prefix", 0);
+	check(!get_hash_item(hash, "key200000", 9), "lookup of a missing key", 0);
+
+	/* Delete the odd keys while iterating. */
+	foreach_hash_item (item, *hash, i) {
+		int n = (unsigned char (*)[16]) item->value - keys;
+
+		if (n % 2) {
+			del_hash_item(hash, item);
+			items[n] = NULL;
+		}
+	}
+
+	check(hash->count == KEYS / 2, "count after deleting", 0);
+	check(count_hash_items(hash) == KEYS / 2, "iteration after deleting", 0);
+
+	for (i = 0; i < KEYS; i++) {
+		item = get_hash_item(hash, keys[i], strlen(keys[i]));
+		check(item == items[i], "lookup after deleting", i);
+	}
+
+	/* Tombstones are reused or dropped when adding again. */
+	for (i = 1; i < KEYS; i += 2) {
+		items[i] = add_hash_item(hash, keys[i], strlen(keys[i]),
+					 &keys[i]);
+		check(items[i], "add after deleting", i);
+	}
+
+	for (i = 0; i < KEYS; i++) {
+		item = get_hash_item(hash, keys[i], strlen(keys[i]));
+		check(item == items[i], "lookup after adding again", i);
+	}
+
+	for (i = 0; i < KEYS; i++)
+		del_hash_item(hash, items[i]);
+
+	check(hash->count == 0 && hash->used == 0, "count after emptying", 0);
+	check(count_hash_items(hash) == 0, "iteration after emptying", 0);
+	check(!get_hash_item(hash, keys[0], strlen(keys[0])),
+	      "lookup after emptying", 0);
+
+	free_hash(&hash);
+	check(hash == NULL, "free", 0);
+
+	if (count_fail) {
+		printf("Summary of hash tests: %d failed\n", count_fail);
+		return EXIT_FAILURE;
+	}
+
+	printf("Summary of hash tests: all passed\n");
+	return EXIT_SUCCESS;
+}
@@ -616,6 +616,8 @@ do_action(struct session *ses, enum main_action action_id, int verbose)
 
 		case ACT_MAIN_TOGGLE_MOUSE:
 #ifdef CONFIG_MOUSE
+			/* This writes to the master terminal directly. */
+			if (term->master) flush_terminal_output(term);
 			toggle_mouse();
 #endif
 			break;
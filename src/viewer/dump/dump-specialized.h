@@ -47,6 +47,8 @@ DUMP_FUNCTION_SPECIALIZED(struct document *document, struct dump_output *out)
 #endif
 		int x;
 
+		render_plain_lines(document, y, 1);
+
 #ifdef DUMP_COLOR_MODE_16
 		write_color_16(color, out);
 #elif defined(DUMP_COLOR_MODE_256)
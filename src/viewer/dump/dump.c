@@ -25,6 +25,7 @@
 #include "document/document.h"
 #include "document/html/renderer.h"
 #include "document/options.h"
+#include "document/plain/renderer.h"
 #include "document/renderer.h"
 #include "document/view.h"
 #include "intl/charsets.h"
@@ -41,6 +42,7 @@
 #include "terminal/color.h"
 #include "terminal/hardio.h"
 #include "terminal/terminal.h"
+#include "util/math.h"
 #include "util/memory.h"
 #include "util/string.h"
 #include "viewer/dump/dump.h"
@@ -48,9 +50,31 @@
 #include "viewer/text/vs.h"
 
 
-static int dump_pos;
-static struct download dump_download;
-static int dump_redir_count = 0;
+/** One URL given to -dump or -source.  Up to document.dump.parallel
+ * of them are loaded at the same time but they are written out in the
+ * order they were given.  */
+struct dump_job {
+	LIST_HEAD(struct dump_job);
+
+	struct download download;
+	struct string_list_item *item;
+
+	/** The cache entry is locked here once the loading is over so
+	 * that it survives until it is the job's turn to be written.  */
+	struct cache_entry *cached;
+
+	/** How much of the source has been written already.  */
+	int pos;
+	int redirects;
+
+	/** The header has been written and the job is being dumped.  */
+	unsigned int started:1;
+	/** The URL was not understood or could not be loaded at all.  */
+	unsigned int bad_uri:1;
+};
+
+static INIT_LIST_OF(struct dump_job, dump_jobs);
+static INIT_LIST_OF(struct string_list_item, dump_todo_list);
 
 #define D_BUF	65536
 
@@ -468,15 +492,17 @@ dump_formatted(int fd, struct download *download, struct cache_entry *cached)
  * all went fine and 1 if something isn't quite right and we should terminate
  * ourselves ASAP. */
 static int
-dump_source(int fd, struct download *download, struct cache_entry *cached)
+dump_source(int fd, struct dump_job *job)
 {
+	struct download *download = &job->download;
+	struct cache_entry *cached = download->cached;
 	struct fragment *frag;
 
 	if (!cached) return 0;
 
 nextfrag:
 	foreach (frag, cached->frag) {
-		int d = dump_pos - frag->offset;
+		int d = job->pos - frag->offset;
 		int l, w;
 
 		if (d < 0 || frag->length <= d)
@@ -486,7 +512,7 @@ nextfrag:
 		w = hard_write(fd, frag->data + d, l);
 
 		if (w != l) {
-			detach_connection(download, dump_pos);
+			detach_connection(download, job->pos);
 
 			if (w < 0)
 				ERROR(gettext("Can't write to stdout: %s"),
@@ -498,8 +524,8 @@ nextfrag:
 			return 1;
 		}
 
-		dump_pos += w;
-		detach_connection(download, dump_pos);
+		job->pos += w;
+		detach_connection(download, job->pos);
 		goto nextfrag;
 	}
 
@@ -577,14 +603,14 @@ dump_print(unsigned char *option, struct string *url)
 	}
 }
 
+static void dump_jobs_step(void);
+
 static void
-dump_loading_callback(struct download *download, void *p)
+dump_loading_callback(struct download *download, struct dump_job *job)
 {
 	struct cache_entry *cached = download->cached;
-	int fd = get_output_handle();
 
-	if (fd == -1) return;
-	if (cached && cached->redirect && dump_redir_count++ < MAX_REDIRECTS) {
+	if (cached && cached->redirect && job->redirects++ < MAX_REDIRECTS) {
 		struct uri *uri = cached->redirect;
 
 		cancel_download(download, 0);
@@ -595,101 +621,174 @@ dump_loading_callback(struct download *download, void *p)
 
 	if (is_in_queued_state(download->state)) return;
 
+	if (is_in_result_state(download->state) && cached && !job->cached) {
+		job->cached = cached;
+		object_lock(cached);
+	}
+
+	dump_jobs_step();
+}
+
+static void
+dump_start(struct dump_job *job)
+{
+	unsigned char *url = job->item->string.source;
+	unsigned char *wd = get_cwd();
+	struct uri *uri = get_translated_uri(url, wd);
+
+	mem_free_if(wd);
+
+	if (!uri || get_protocol_external_handler(NULL, uri)) {
+		job->bad_uri = 1;
+		job->download.state = connection_state(S_BAD_URL);
+
+	} else {
+		job->download.callback = (download_callback_T *) dump_loading_callback;
+		job->download.data = job;
+
+		if (load_uri(uri, NULL, &job->download, PRI_MAIN, 0, -1))
+			job->bad_uri = 1;
+	}
+
+	if (uri) done_uri(uri);
+}
+
+/* Write out what is available of @job.  Returns non-zero when there is
+ * nothing more to write. */
+static int
+dump_job_output(int fd, struct dump_job *job)
+{
+	struct download *download = &job->download;
+
+	if (job->bad_uri) {
+		if (is_in_state(download->state, S_BAD_URL))
+			usrerror(gettext("URL protocol not supported (%s)."),
+				 job->item->string.source);
+		else
+			usrerror(get_state_message(download->state, NULL));
+		program.retval = RET_SYNTAX;
+		return 1;
+	}
+
 	if (get_cmd_opt_bool("dump")) {
-		if (is_in_transfering_state(download->state))
-			return;
+		if (!is_in_result_state(download->state))
+			return 0;
 
-		dump_formatted(fd, download, cached);
+		dump_formatted(fd, download, download->cached);
 
 	} else {
-		if (dump_source(fd, download, cached) > 0)
-			goto terminate;
+		if (dump_source(fd, job) > 0)
+			return 1;
 
 		if (is_in_progress_state(download->state))
-			return;
-
+			return 0;
 	}
 
 	if (!is_in_state(download->state, S_OK)) {
 		usrerror(get_state_message(download->state, NULL));
 		program.retval = RET_ERROR;
-		goto terminate;
 	}
 
-terminate:
-	program.terminate = 1;
-	dump_next(NULL);
+	return 1;
 }
 
 static void
-dump_start(unsigned char *url)
+done_dump_job(struct dump_job *job)
 {
-	unsigned char *wd = get_cwd();
-	struct uri *uri = get_translated_uri(url, wd);
+	if (!is_in_result_state(job->download.state))
+		cancel_download(&job->download, 1);
+	if (job->cached) object_unlock(job->cached);
 
-	mem_free_if(wd);
+	done_string(&job->item->string);
+	mem_free(job->item);
 
-	if (!uri || get_protocol_external_handler(NULL, uri)) {
-		usrerror(gettext("URL protocol not supported (%s)."), url);
-		goto terminate;
-	}
+	del_from_list(job);
+	mem_free(job);
+}
 
-	dump_download.callback = (download_callback_T *) dump_loading_callback;
-	dump_pos = 0;
+/* Start new loads and write out the finished jobs at the head of
+ * @dump_jobs.  This is called again from the loading callbacks, possibly
+ * from load_uri() itself, in which case the outer call does the work. */
+static void
+dump_jobs_step(void)
+{
+	static int stepping, step_again;
+	static int first = 1;
+	int fd = get_output_handle();
+	int parallel;
 
-	if (load_uri(uri, NULL, &dump_download, PRI_MAIN, 0, -1)) {
-terminate:
-		dump_next(NULL);
-		program.terminate = 1;
-		program.retval = RET_SYNTAX;
+	if (stepping) {
+		step_again = 1;
+		return;
 	}
 
-	if (uri) done_uri(uri);
+	if (fd == -1) return;
+
+	parallel = get_opt_int("document.dump.parallel", NULL);
+	int_upper_bound(&parallel, get_opt_int("connection.max_connections", NULL));
+
+	stepping = 1;
+
+	do {
+		step_again = 0;
+
+		/* Keep up to @parallel URLs loading or waiting for their
+		 * turn. */
+		while (!list_empty(dump_todo_list)
+		       && list_size(&dump_jobs) < parallel) {
+			struct dump_job *job = mem_calloc(1, sizeof(*job));
+
+			if (!job) break;
+
+			job->item = dump_todo_list.next;
+			del_from_list(job->item);
+			add_to_list_end(dump_jobs, job);
+			dump_start(job);
+		}
+
+		while (!list_empty(dump_jobs)) {
+			struct dump_job *job = dump_jobs.next;
+			struct string *url = &job->item->string;
+
+			if (!job->started) {
+				if (!first) {
+					dump_print("document.dump.separator", NULL);
+				} else {
+					first = 0;
+				}
+
+				dump_print("document.dump.header", url);
+				job->started = 1;
+			}
+
+			if (!dump_job_output(fd, job))
+				break;
+
+			dump_print("document.dump.footer", url);
+			done_dump_job(job);
+			step_again = 1;
+		}
+	} while (step_again);
+
+	stepping = 0;
+
+	program.terminate = list_empty(dump_jobs);
 }
 
 void
 dump_next(LIST_OF(struct string_list_item) *url_list)
 {
-	static INIT_LIST_OF(struct string_list_item, todo_list);
-	static INIT_LIST_OF(struct string_list_item, done_list);
-	struct string_list_item *item;
-
 	if (url_list) {
 		/* Steal all them nice list items but keep the same order */
 		while (!list_empty(*url_list)) {
-			item = url_list->next;
+			struct string_list_item *item = url_list->next;
+
 			del_from_list(item);
-			add_to_list_end(todo_list, item);
+			add_to_list_end(dump_todo_list, item);
 		}
 	}
 
-	/* Dump each url list item one at a time */
-	if (!list_empty(todo_list)) {
-		static int first = 1;
-
-		program.terminate = 0;
-
-		item = todo_list.next;
-		del_from_list(item);
-		add_to_list(done_list, item);
-
-		if (!first) {
-			dump_print("document.dump.separator", NULL);
-		} else {
-			first = 0;
-		}
-
-		dump_print("document.dump.header", &item->string);
-		dump_start(item->string.source);
-		/* XXX: I think it ought to print footer at the end of
-		 * the whole dump (not only this file). Testing required.
-		 * --pasky */
-		dump_print("document.dump.footer", &item->string);
-
-	} else {
-		free_string_list(&done_list);
-		program.terminate = 1;
-	}
+	dump_jobs_step();
 }
 
 struct string *
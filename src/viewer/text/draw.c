@@ -18,6 +18,7 @@
 #include "document/document.h"
 #include "document/html/frames.h"
 #include "document/options.h"
+#include "document/plain/renderer.h"
 #include "document/refresh.h"
 #include "document/renderer.h"
 #include "document/view.h"
@@ -286,6 +287,7 @@ draw_doc(struct session *ses, struct document_view *doc_view, int active)
 		if (ses->navigate_mode == NAVIGATE_LINKWISE)
 			check_vs(doc_view);
 	}
+	render_plain_lines(doc_view->document, vy, box->height);
 	for (y = int_max(vy, 0);
 	     y < int_min(doc_view->document->height, box->height + vy);
 	     y++) {
@@ -27,6 +27,7 @@
 #include "bfu/dialog.h"
 #include "config/kbdbind.h"
 #include "document/document.h"
+#include "document/plain/renderer.h"
 #include "document/view.h"
 #include "intl/charsets.h"
 #include "intl/gettext/libintl.h"
@@ -66,25 +67,28 @@ static INIT_INPUT_HISTORY(search_history);
 
 static UCHAR *memacpy_u(unsigned char *text, int textlen, int utf8);
 
+#define realloc_search(search, size) \
+	mem_align_alloc(search, size, (size) + 1, 0x3FF)
+
 static inline void
 add_srch_chr(struct document *document, UCHAR c, int x, int y, int nn)
 {
+	int n;
+
 	assert(document);
 	if_assert_failed return;
 
-	if (c == ' ' && !document->nsearch) return;
-
-	if (document->search) {
-		int n = document->nsearch;
+	n = document->nsearch;
+	if (c == ' ' && (!n || document->search[n - 1].c == ' '))
+		return;
 
-		if (c == ' ' && document->search[n - 1].c == ' ')
-			return;
+	if (!realloc_search(&document->search, n))
+		return;
 
-		document->search[n].c = c;
-		document->search[n].x = x;
-		document->search[n].y = y;
-		document->search[n].n = nn;
-	}
+	document->search[n].c = c;
+	document->search[n].x = x;
+	document->search[n].y = y;
+	document->search[n].n = nn;
 
 	document->nsearch++;
 }
@@ -159,8 +163,11 @@ get_srch(struct document *document)
 		int height = int_min(node->box.y + node->box.height, document->height);
 
 		for (y = node->box.y; y < height; y++) {
-			int width = int_min(node->box.x + node->box.width,
-					    document->data[y].length);
+			int width;
+
+			render_plain_lines(document, y, 1);
+			width = int_min(node->box.x + node->box.width,
+					document->data[y].length);
 
 			for (x = node->box.x;
 			     x < width && document->data[y].chars[x].data <= ' ';
@@ -206,22 +213,16 @@ get_srch(struct document *document)
 static void
 get_search_data(struct document *document)
 {
-	int n;
-
 	assert(document);
 	if_assert_failed return;
 
 	if (document->search) return;
 
-	n = get_srch(document);
-	if (!n) return;
+	/* The array grows as the chars are added, so that the lines of
+	 * plain text documents, which may be rendered only for this, are
+	 * gone through once. */
+	if (!get_srch(document)) return;
 
-	document->nsearch = 0;
-
-	document->search = mem_alloc(n * sizeof(*document->search));
-	if (!document->search) return;
-
-	get_srch(document);
 	while (document->nsearch
 	       && document->search[document->nsearch - 1].c == ' ') {
 		--document->nsearch;
@@ -278,6 +279,106 @@ get_range(struct document *document, int y, int height, int l,
 	return 0;
 }
 
+/** The text of document.search in one piece, and where the search word
+ * was last found in it, so that finding the next match and highlighting
+ * the matches in view do not go through the whole document again. */
+struct search_matches {
+	/* The chars of document.search, folded to lower case unless the
+	 * search is case sensitive. */
+	UCHAR *text;
+	int case_sensitive;
+
+	/* The search word, folded like @text unless it is a regex. */
+	UCHAR *word;
+	int length;
+
+	/* The flags @word was compiled with as a regex, or 0. */
+	int regex_flags;
+
+	/* Where @word starts in @text, in increasing order. */
+	int *matches;
+	int nmatches;
+
+#ifdef CONFIG_TRE
+	/* How long each of the regex matches is. */
+	int *lengths;
+
+	/* The regex matched the empty string, where the matching stops,
+	 * so the regex is run on the region in question every time. */
+	unsigned int empty:1;
+#endif
+};
+
+#define realloc_matches(matches, size) \
+	mem_align_alloc(matches, size, (size) + 1, 0xFF)
+
+static void
+done_search_matches_word(struct search_matches *search_matches)
+{
+	mem_free_set(&search_matches->word, NULL);
+	mem_free_set(&search_matches->matches, NULL);
+	search_matches->length = 0;
+	search_matches->regex_flags = 0;
+	search_matches->nmatches = 0;
+#ifdef CONFIG_TRE
+	mem_free_set(&search_matches->lengths, NULL);
+	search_matches->empty = 0;
+#endif
+}
+
+void
+done_search_matches(struct document *document)
+{
+	struct search_matches *search_matches = document->search_matches;
+
+	if (!search_matches) return;
+
+	document->search_matches = NULL;
+	done_search_matches_word(search_matches);
+	mem_free_if(search_matches->text);
+	mem_free(search_matches);
+}
+
+static struct search_matches *
+get_document_search_matches(struct document *document)
+{
+	if (!document->search_matches)
+		document->search_matches = mem_calloc(1, sizeof(*document->search_matches));
+
+	return document->search_matches;
+}
+
+/* Whether the matches are those of @word, possibly compiled with
+ * @regex_flags. */
+static inline int
+is_search_matches_word(struct search_matches *search_matches, UCHAR *word,
+		       int length, int regex_flags)
+{
+	return search_matches->word
+		&& search_matches->length == length
+		&& search_matches->regex_flags == regex_flags
+		&& !memcmp(search_matches->word, word, length * sizeof(*word));
+}
+
+/* Returns the first of the @search_matches that is at @from or after it. */
+static int
+find_first_search_match(struct search_matches *search_matches, int from)
+{
+	int left = 0;
+	int right = search_matches->nmatches;
+
+	while (left < right) {
+		int middle = (left + right) / 2;
+
+		if (search_matches->matches[middle] < from)
+			left = middle + 1;
+		else
+			right = middle;
+	}
+
+	return left;
+}
+
 #ifdef CONFIG_TRE
 /** Returns a string @c doc that is a copy of the text in the search
  * nodes from @a s1 to (@a s1 + @a doclen - 1) with the space at the
@@ -323,11 +424,25 @@ struct regex_match_context {
 	UCHAR *pattern;
 };
 
+/** A compiled search regex.  The recently used ones are kept, so that
+ * neither finding the next match nor redrawing the highlighted ones has
+ * to compile the pattern again. */
+struct search_regex {
+	LIST_HEAD(struct search_regex);
+
+	UCHAR *pattern;
+	int length;
+	int flags;
+	regex_t regex;
+};
+
+static INIT_LIST_OF(struct search_regex, search_regexes);
+static int search_regexes_count;
+
 static int
-init_regex(regex_t *regex, UCHAR *pattern)
+get_search_regex_flags(void)
 {
 	int regex_flags = REG_NEWLINE;
-	int reg_err;
 
 	if (get_opt_int("document.browse.search.regex", NULL) == 2)
 		regex_flags |= REG_EXTENDED;
@@ -335,46 +450,218 @@ init_regex(regex_t *regex, UCHAR *pattern)
 	if (!get_opt_bool("document.browse.search.case", NULL))
 		regex_flags |= REG_ICASE;
 
-	reg_err = Regcomp(regex, (PATTERN *)pattern, regex_flags);
-	if (reg_err) {
-		tre_regfree(regex);
+	return regex_flags;
+}
+
+static void
+done_search_regex(struct search_regex *search_regex)
+{
+	del_from_list(search_regex);
+	search_regexes_count--;
+	tre_regfree(&search_regex->regex);
+	mem_free(search_regex->pattern);
+	mem_free(search_regex);
+}
+
+/** Returns @a pattern of @a length chars compiled with @a flags, or NULL if
+ * it is not a valid regex. */
+static regex_t *
+get_search_regex(UCHAR *pattern, int length, int flags)
+{
+	struct search_regex *search_regex;
+
+	foreach (search_regex, search_regexes) {
+		if (search_regex->flags != flags
+		    || search_regex->length != length
+		    || memcmp(search_regex->pattern, pattern,
+			      length * sizeof(*pattern)))
+			continue;
+
+		move_to_top_of_list(search_regexes, search_regex);
+		return &search_regex->regex;
+	}
+
+	search_regex = mem_calloc(1, sizeof(*search_regex));
+	if (!search_regex) return NULL;
+
+	search_regex->pattern = mem_alloc((length + 1) * sizeof(*pattern));
+	if (!search_regex->pattern) {
+		mem_free(search_regex);
+		return NULL;
+	}
+
+	memcpy(search_regex->pattern, pattern, (length + 1) * sizeof(*pattern));
+	search_regex->length = length;
+	search_regex->flags = flags;
+
+	if (Regcomp(&search_regex->regex, (PATTERN *)pattern, flags)) {
+		tre_regfree(&search_regex->regex);
+		mem_free(search_regex->pattern);
+		mem_free(search_regex);
+		return NULL;
+	}
+
+	add_to_list(search_regexes, search_regex);
+	if (++search_regexes_count > MAX_SEARCH_REGEXES)
+		done_search_regex(search_regexes.prev);
+
+	return &search_regex->regex;
+}
+
+static void
+done_search_regexes(void)
+{
+	while (!list_empty(search_regexes))
+		done_search_regex(search_regexes.next);
+}
+
+/** Finds all the matches of the regex in the whole of @a document, the way
+ * search_for_pattern() goes through a region of it.
+ * @returns 0, or -1 if out of memory. */
+static int
+find_regex_matches(struct document *document,
+		   struct search_matches *search_matches, regex_t *regex)
+{
+	UCHAR *doc;
+	int doclen;
+	int regexec_flags = 0;
+	regmatch_t regmatch;
+	int pos = 0;
+
+	doc = get_search_region_from_search_nodes(document->search,
+						  document->search + document->nsearch,
+						  0, &doclen);
+	if (!doc) return doclen < 0 ? -1 : 0;
+
+	while (pos < doclen
+	       && !Regexec(regex, (PATTERN *)&doc[pos], 1, &regmatch, regexec_flags)) {
+		int n = search_matches->nmatches;
+		int start = pos + regmatch.rm_so;
+		int length = regmatch.rm_eo - regmatch.rm_so;
+
+		if (!length) {
+			search_matches->empty = 1;
+			break;
+		}
+
+		if (!realloc_matches(&search_matches->matches, n)
+		    || !realloc_matches(&search_matches->lengths, n)) {
+			mem_free(doc);
+			return -1;
+		}
+
+		search_matches->matches[n] = start;
+		search_matches->lengths[n] = length;
+		search_matches->nmatches++;
+
+		regexec_flags = REG_NOTBOL;
+		pos = start + length;
+	}
+
+	mem_free(doc);
+	return 0;
+}
+
+/** Sets @a regex to the compiled @a pattern of @a length chars and
+ * @a result to its matches in @a document, finding them only when the
+ * pattern or the options have changed since the last time.
+ * @returns 0, -1 if out of memory or -2 if @a pattern is not a valid
+ * regex. */
+static int
+get_regex_matches(struct document *document, UCHAR *pattern, int length,
+		  regex_t **regex, struct search_matches **result)
+{
+	struct search_matches *search_matches = get_document_search_matches(document);
+	int regex_flags = get_search_regex_flags();
+
+	if (!search_matches) return -1;
+
+	*regex = get_search_regex(pattern, length, regex_flags);
+	if (!*regex) return -2;
+
+	*result = search_matches;
+	if (is_search_matches_word(search_matches, pattern, length, regex_flags))
 		return 0;
+
+	done_search_matches_word(search_matches);
+
+	search_matches->word = mem_alloc((length + 1) * sizeof(*pattern));
+	if (!search_matches->word) return -1;
+
+	memcpy(search_matches->word, pattern, (length + 1) * sizeof(*pattern));
+	search_matches->length = length;
+	search_matches->regex_flags = regex_flags;
+
+	if (find_regex_matches(document, search_matches, *regex) < 0) {
+		done_search_matches_word(search_matches);
+		return -1;
 	}
 
-	return 1;
+	return 0;
 }
 
+/** Calls @a match for the matches in the region of @a common_ctx that
+ * lie within its lines. */
 static void
-search_for_pattern(struct regex_match_context *common_ctx, void *data,
+for_each_regex_match(struct document *document,
+		     struct search_matches *search_matches,
+		     struct regex_match_context *common_ctx, void *data,
+		     void (*match)(struct regex_match_context *, void *))
+{
+	int last = common_ctx->s2 - document->search + common_ctx->textlen;
+	int m;
+
+	for (m = find_first_search_match(search_matches,
+					 common_ctx->s1 - document->search);
+	     m < search_matches->nmatches && search_matches->matches[m] < last;
+	     m++) {
+		struct search *s1 = &document->search[search_matches->matches[m]];
+		int length = search_matches->lengths[m];
+
+		if (s1->y < common_ctx->y1 || s1[length - 1].y > common_ctx->y2)
+			continue;
+
+		common_ctx->s1 = s1;
+		common_ctx->textlen = length;
+		match(common_ctx, data);
+	}
+}
+
+static void
+search_for_pattern(struct document *document,
+		   struct regex_match_context *common_ctx, void *data,
 		   void (*match)(struct regex_match_context *, void *))
 {
+	struct search_matches *search_matches;
 	UCHAR *doc;
 	UCHAR *doctmp;
 	int doclen;
 	int regexec_flags = 0;
-	regex_t regex;
+	regex_t *regex;
 	regmatch_t regmatch;
 	int pos = 0;
 	struct search *search_start = common_ctx->s1;
 	unsigned char save_c;
+	int error;
 
 	/* TODO: show error message */
 	/* XXX: This will probably require that reg_err be passed thru
 	 * common_ctx to the caller. */
-	if (!init_regex(&regex, common_ctx->pattern)) {
-#if 0
-		/* Where and how should we display the error dialog ? */
-		unsigned char regerror_string[MAX_STR_LEN];
+	error = get_regex_matches(document, common_ctx->pattern,
+				  common_ctx->textlen, &regex, &search_matches);
+	if (error) {
+		common_ctx->found = error;
+		return;
+	}
 
-		tre_regerror(reg_err, &regex, regerror_string, sizeof(regerror_string));
-#endif
-		common_ctx->found = -2;
+	if (!search_matches->empty) {
+		for_each_regex_match(document, search_matches, common_ctx,
+				     data, match);
 		return;
 	}
 
 	doc = get_search_region_from_search_nodes(common_ctx->s1, common_ctx->s2, common_ctx->textlen, &doclen);
 	if (!doc) {
-		tre_regfree(&regex);
 		common_ctx->found = doclen;
 		return;
 	}
@@ -400,7 +687,7 @@ find_next:
 	save_c = doc[pos];
 	doc[pos] = 0;
 
-	while (*doctmp && !Regexec(&regex, (PATTERN *)doctmp, 1, &regmatch, regexec_flags)) {
+	while (*doctmp && !Regexec(regex, (PATTERN *)doctmp, 1, &regmatch, regexec_flags)) {
 		regexec_flags = REG_NOTBOL;
 		common_ctx->textlen = regmatch.rm_eo - regmatch.rm_so;
 		if (!common_ctx->textlen) { doc[pos] = save_c; common_ctx->found = 1; goto free_stuff; }
@@ -418,7 +705,6 @@ find_next:
 		goto find_next;
 
 free_stuff:
-	tre_regfree(&regex);
 	mem_free(doc);
 }
 
@@ -471,7 +757,7 @@ is_in_range_regex(struct document *document, int y, int height,
 	common_ctx.s1 = s1;
 	common_ctx.s2 = s2;
 
-	search_for_pattern(&common_ctx, &ctx, is_in_range_regex_match);
+	search_for_pattern(document, &common_ctx, &ctx, is_in_range_regex_match);
 	mem_free(txt);
 
 	return common_ctx.found;
@@ -536,59 +822,134 @@ lowered_string(unsigned char *text, int textlen, int utf8)
 	return ret;
 }
 
+/* Finds all the places where @word is in @text using the Boyer-Moore-Horspool
+ * algorithm.  The chars may be wider than a byte, so the shifts are indexed
+ * by the low byte of the chars, keeping the shortest one of the chars that
+ * share it. */
 static int
-is_in_range_plain(struct document *document, int y, int height,
-		  unsigned char *text, int textlen,
-		  int *min, int *max,
-		  struct search *s1, struct search *s2, int utf8)
+find_search_matches(struct search_matches *search_matches, int textlen)
 {
-	int yy = y + height;
-	UCHAR *txt;
-	int found = 0;
+	UCHAR *text = search_matches->text;
+	UCHAR *word = search_matches->word;
+	int length = search_matches->length;
+	int shift[256];
+	UCHAR last;
+	int i;
+
+	if (length <= 0) return 1;
+
+	for (i = 0; i < 256; i++)
+		shift[i] = length;
+	for (i = 0; i < length - 1; i++)
+		shift[word[i] & 0xFF] = length - 1 - i;
+
+	last = word[length - 1];
+
+	for (i = 0; i <= textlen - length;
+	     i += shift[text[i + length - 1] & 0xFF]) {
+		if (text[i + length - 1] != last
+		    || memcmp(&text[i], word, (length - 1) * sizeof(*word)))
+			continue;
+
+		if (!realloc_matches(&search_matches->matches,
+				     search_matches->nmatches))
+			return 0;
+
+		search_matches->matches[search_matches->nmatches++] = i;
+	}
+
+	return 1;
+}
+
+/* Returns the matches of @text in @document, finding them only when the
+ * word or the case sensitivity has changed since the last time. */
+static struct search_matches *
+get_search_matches(struct document *document, unsigned char *text,
+		   int textlen, int utf8)
+{
+	struct search_matches *search_matches = get_document_search_matches(document);
 	int case_sensitive = get_opt_bool("document.browse.search.case", NULL);
+	UCHAR *word;
 
-	txt = case_sensitive ? memacpy_u(text, textlen, utf8) : lowered_string(text, textlen, utf8);
-	if (!txt) return -1;
+	if (!search_matches) return NULL;
 
-	/* TODO: This is a great candidate for nice optimizations. Fresh CS
-	 * graduates can use their knowledge of ie. KMP (should be quite
-	 * trivial, probably a starter; very fast as well) or Turbo-BM (or
-	 * maybe some other Boyer-Moore variant, I don't feel that strong in
-	 * this area), hmm?  >:) --pasky */
 #if defined(CONFIG_UTF8) && defined(HAVE_WCTYPE_H)
 #define maybe_tolower(c) (case_sensitive ? (c) : utf8 ? towlower(c) : tolower(c))
 #else
 #define maybe_tolower(c) (case_sensitive ? (c) : tolower(c))
 #endif
-	for (; s1 <= s2; s1++) {
+	if (!search_matches->text
+	    || search_matches->case_sensitive != case_sensitive) {
 		int i;
 
-		if (maybe_tolower(s1->c) != txt[0]) {
-srch_failed:
-			continue;
-		}
+		done_search_matches_word(search_matches);
+		mem_free_if(search_matches->text);
+
+		search_matches->text = mem_alloc((document->nsearch + 1)
+						 * sizeof(*search_matches->text));
+		if (!search_matches->text) return NULL;
+
+		for (i = 0; i < document->nsearch; i++)
+			search_matches->text[i] = maybe_tolower(document->search[i].c);
+		search_matches->case_sensitive = case_sensitive;
+	}
+#undef maybe_tolower
+
+	word = case_sensitive ? memacpy_u(text, textlen, utf8)
+			      : lowered_string(text, textlen, utf8);
+	if (!word) return NULL;
+
+	if (is_search_matches_word(search_matches, word, textlen, 0)) {
+		mem_free(word);
+		return search_matches;
+	}
+
+	done_search_matches_word(search_matches);
+	search_matches->word = word;
+	search_matches->length = textlen;
 
-		for (i = 1; i < textlen; i++)
-			if (maybe_tolower(s1[i].c) != txt[i])
-				goto srch_failed;
+	if (!find_search_matches(search_matches, document->nsearch)) {
+		done_search_matches_word(search_matches);
+		return NULL;
+	}
+
+	return search_matches;
+}
+
+static int
+is_in_range_plain(struct document *document, int y, int height,
+		  unsigned char *text, int textlen,
+		  int *min, int *max,
+		  struct search *s1, struct search *s2, int utf8)
+{
+	struct search_matches *search_matches;
+	int yy = y + height;
+	int found = 0;
+	int last = s2 - document->search;
+	int m;
 
-		if (s1[i].y < y || s1[i].y >= yy)
+	search_matches = get_search_matches(document, text, textlen, utf8);
+	if (!search_matches) return -1;
+
+	for (m = find_first_search_match(search_matches, s1 - document->search);
+	     m < search_matches->nmatches && search_matches->matches[m] <= last;
+	     m++) {
+		struct search *match = &document->search[search_matches->matches[m]];
+		int i;
+
+		if (match[textlen].y < y || match[textlen].y >= yy)
 			continue;
 
 		found = 1;
 
 		for (i = 0; i < textlen; i++) {
-			if (!s1[i].n) continue;
+			if (!match[i].n) continue;
 
-			int_upper_bound(min, s1[i].x);
-			int_lower_bound(max, s1[i].x + s1[i].n);
+			int_upper_bound(min, match[i].x);
+			int_lower_bound(max, match[i].x + match[i].n);
 		}
 	}
 
-#undef maybe_tolower
-
-	mem_free(txt);
-
 	return found;
 }
 
@@ -629,48 +990,38 @@ static void
 get_searched_plain(struct document_view *doc_view, struct point **pt, int *pl,
 		   int l, struct search *s1, struct search *s2, int utf8)
 {
-	UCHAR *txt;
+	struct document *document = doc_view->document;
+	struct search_matches *search_matches;
 	struct point *points = NULL;
 	struct box *box;
 	int xoffset, yoffset;
 	int len = 0;
-	int case_sensitive = get_opt_bool("document.browse.search.case", NULL);
+	int last = s2 - document->search;
+	int m;
 
-	txt = case_sensitive ? memacpy_u(*doc_view->search_word, l, utf8)
-			     : lowered_string(*doc_view->search_word, l, utf8);
-	if (!txt) return;
+	search_matches = get_search_matches(document, *doc_view->search_word,
+					    l, utf8);
+	if (!search_matches) return;
 
 	box = &doc_view->box;
 	xoffset = box->x - doc_view->vs->x;
 	yoffset = box->y - doc_view->vs->y;
 
-#if defined(CONFIG_UTF8) && defined(HAVE_WCTYPE_H)
-#define maybe_tolower(c) (case_sensitive ? (c) : utf8 ? towlower(c) : tolower(c))
-#else
-#define maybe_tolower(c) (case_sensitive ? (c) : tolower(c))
-#endif
-
-	for (; s1 <= s2; s1++) {
+	for (m = find_first_search_match(search_matches, s1 - document->search);
+	     m < search_matches->nmatches && search_matches->matches[m] <= last;
+	     m++) {
+		struct search *match = &document->search[search_matches->matches[m]];
 		int i;
 
-		if (maybe_tolower(s1[0].c) != txt[0]) {
-srch_failed:
-			continue;
-		}
-
-		for (i = 1; i < l; i++)
-			if (maybe_tolower(s1[i].c) != txt[i])
-				goto srch_failed;
-
 		for (i = 0; i < l; i++) {
 			int j;
-			int y = s1[i].y + yoffset;
+			int y = match[i].y + yoffset;
 
 			if (!row_is_in_box(box, y))
 				continue;
 
-			for (j = 0; j < s1[i].n; j++) {
-				int sx = s1[i].x + j;
+			for (j = 0; j < match[i].n; j++) {
+				int sx = match[i].x + j;
 				int x = sx + xoffset;
 
 				if (!col_is_in_box(box, x))
@@ -680,14 +1031,11 @@ srch_failed:
 					continue;
 
 				points[len].x = sx;
-				points[len++].y = s1[i].y;
+				points[len++].y = match[i].y;
 			}
 		}
 	}
 
-#undef maybe_tolower
-
-	mem_free(txt);
 	*pt = points;
 	*pl = len;
 }
@@ -754,7 +1102,7 @@ get_searched_regex(struct document_view *doc_view, struct point **pt, int *pl,
 	common_ctx.s1 = s1;
 	common_ctx.s2 = s2;
 
-	search_for_pattern(&common_ctx, &ctx, get_searched_regex_match);
+	search_for_pattern(doc_view->document, &common_ctx, &ctx, get_searched_regex_match);
 
 	mem_free(txt);
 	*pt = ctx.points;
@@ -1763,6 +2111,9 @@ done_search_history(struct module *module)
 {
 	save_input_history(&search_history, SEARCH_HISTORY_FILENAME);
 	free_list(search_history.entries);
+#ifdef CONFIG_TRE
+	done_search_regexes();
+#endif
 }
 
 struct module search_history_module = struct_module(
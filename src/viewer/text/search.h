@@ -6,6 +6,7 @@
 #include "document/view.h"
 #include "viewer/action.h"
 
+struct document;
 struct module;
 struct session;
 struct terminal;
@@ -13,6 +14,7 @@ struct terminal;
 extern struct module search_history_module;
 
 void draw_searched(struct terminal *term, struct document_view *doc_view);
+void done_search_matches(struct document *document);
 
 enum frame_event_status find_next(struct session *ses, struct document_view *doc_view, int direction);
 
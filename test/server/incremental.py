@@ -0,0 +1,49 @@
+#!/usr/bin/env python
+# Serve a long page slowly for testing document.html.incremental.
+#
+# All the data is sent a while before the connection is closed, so that a
+# rendering runs after the last chunk arrived but while the document is
+# still loading.  The page must end with "Para 2999" and "The end." once
+# it has loaded, the same as with document.html.incremental off, and
+# searching for "lorem" must find each one only once.
+
+import sys, time
+
+try:
+	from BaseHTTPServer import BaseHTTPRequestHandler, HTTPServer
+except ImportError:
+	from http.server import BaseHTTPRequestHandler, HTTPServer
+
+paras = ["<p>Para %d: %s</p>\n" % (i, "lorem ipsum dolor sit amet " * 3)
+	 for i in range(3000)]
+# The table adds a node after the one of the whole document.
+page = ("<html><body>\n<table border=1><tr><td>Table</td><td>cell</td></tr>"
+	+ "</table>\n" + "".join(paras)
+	+ "<p>The end.</p>\n</body></html>\n").encode("ascii")
+
+CHUNK = 6 * 1024
+
+class incremental(BaseHTTPRequestHandler):
+	def do_GET(self):
+		self.send_response(200)
+		self.send_header("Content-Type", "text/html")
+		self.send_header("Connection", "close")
+		self.end_headers()
+		for i in range(0, len(page), CHUNK):
+			self.wfile.write(page[i:i + CHUNK])
+			self.wfile.flush()
+			time.sleep(0.05)
+		# Let the document be rendered with all the data.
+		time.sleep(2)
+
+def run(port=8901):
+	server_address = ('127.0.0.1', port)
+	httpd = HTTPServer(server_address, incremental)
+	while True:
+		httpd.handle_request()
+
+if __name__ == "__main__":
+	if len(sys.argv) > 1:
+		run(int(sys.argv[1]))
+	else:
+		run()